@@ -49,6 +49,7 @@ $messageMap =
     ['GET_BACKEND_INFO'  ,'GetBackendInfo'],
     ['PEER_LIST'         ,'PeerList'],
     ['MOUNT_LIST'        ,'MountList'],
+    ['FUSE_STAT_LIST'    ,'FuseStatList'],
     ['START_SYNC'        ,'StartSync'],
     ['LEADER_ELECT'      ,'LeaderElect'],
     ['DH_PARAMS'         ,'DiffieHellmanParams'],
@@ -62,6 +63,7 @@ $messageMap =
     ['UNSUBSCRIBE'       ,'Unsubscribe'],
     ['ID_MAP'            ,'IdMap'],
     ['NODE_INFO'         ,'NodeInfo'],
+    ['NODE_INFO_BATCH'   ,'NodeInfoBatch'],
     ['SEND_TREE'         ,'SendTree'],
     ['SEND_FILE'         ,'SendFile'],
     ['NEW_VERSION'       ,'NewVersion'],
@@ -27,13 +27,17 @@
 #ifndef OPENBOOK_FS_REFERENCECOUNTED_H_
 #define OPENBOOK_FS_REFERENCECOUNTED_H_
 
+#include <atomic>
+
 namespace   openbook {
 namespace filesystem {
 
+/// intrusive reference count, references may be taken and dropped from
+/// any thread
 class ReferenceCounted
 {
     protected:
-        int m_refCount;
+        std::atomic<int> m_refCount;
 
     public:
         ReferenceCounted():
@@ -42,12 +46,12 @@ class ReferenceCounted
 
         void reference()
         {
-            m_refCount++;
+            m_refCount.fetch_add(1,std::memory_order_relaxed);
         }
 
         bool dereference()
         {
-            return --m_refCount <= 0;
+            return m_refCount.fetch_sub(1,std::memory_order_acq_rel) <= 1;
         }
 };
 
@@ -94,9 +98,12 @@ struct RefPtr
 
         RefPtr<T>& operator=( const RefPtr<T>& other )
         {
+            // take the new reference first, so that assigning a pointer
+            // to itself doesn't free the object
+            if( other.m_ptr )
+                other.m_ptr->reference();
             dereference();
             m_ptr = other.m_ptr;
-            reference();
             return *this;
         }
 
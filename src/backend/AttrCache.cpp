@@ -0,0 +1,241 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/AttrCache.cpp
+ *
+ *  @brief  
+ */
+
+#include <cstring>
+#include <ctime>
+
+#include "AttrCache.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+const int          AttrCache::TIMEOUT;
+const unsigned int AttrCache::MAX_ENTRIES;
+
+int64_t AttrCache::now()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec;
+}
+
+std::string AttrCache::key( const Path_t& path )
+{
+    const std::string& in = path.string();
+    std::string out;
+    out.reserve( in.size() + 1 );
+    for( char c : in )
+        if( c != '/' || out.empty() || out[out.size()-1] != '/' )
+            out += c;
+
+    if( out.size() > 1 && out[out.size()-1] == '/' )
+        out.erase( out.size()-1 );
+    if( out.empty() || out[0] != '/' )
+        out.insert( 0, "/" );
+    return out;
+}
+
+AttrCache::AttrCache():
+    m_running(false)
+{
+    m_mutex.init();
+    m_notifyMutex.init();
+    m_pendingMutex.init();
+    m_pendingCond.init();
+}
+
+AttrCache::~AttrCache()
+{
+    m_mutex.destroy();
+    m_notifyMutex.destroy();
+    m_pendingMutex.destroy();
+    m_pendingCond.destroy();
+}
+
+void AttrCache::lockless_erase( const std::string& path )
+{
+    m_entries.erase(path);
+
+    // anything beneath path sorts directly after "path/"
+    std::string prefix = path;
+    if( prefix.empty() || prefix[prefix.size()-1] != '/' )
+        prefix += "/";
+
+    EntryMap_t::iterator begin = m_entries.lower_bound(prefix);
+    EntryMap_t::iterator end   = begin;
+    while( end != m_entries.end()
+            && end->first.compare( 0, prefix.size(), prefix ) == 0 )
+        ++end;
+    m_entries.erase(begin,end);
+}
+
+void AttrCache::lockless_put( const std::string& path, const Entry& entry )
+{
+    if( m_entries.size() >= MAX_ENTRIES )
+    {
+        int64_t time = now();
+        for( EntryMap_t::iterator it = m_entries.begin();
+                it != m_entries.end(); )
+        {
+            if( it->second.expires <= time )
+                m_entries.erase(it++);
+            else
+                ++it;
+        }
+
+        if( m_entries.size() >= MAX_ENTRIES )
+            m_entries.clear();
+    }
+
+    m_entries[path] = entry;
+}
+
+bool AttrCache::get( const Path_t& path, struct stat& attr, int& error )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    EntryMap_t::iterator it = m_entries.find( key(path) );
+    if( it == m_entries.end() )
+        return false;
+
+    if( it->second.expires <= now() )
+    {
+        m_entries.erase(it);
+        return false;
+    }
+
+    attr  = it->second.attr;
+    error = it->second.error;
+    return true;
+}
+
+void AttrCache::put( const Path_t& path, const struct stat& attr )
+{
+    Entry entry;
+    entry.attr    = attr;
+    entry.error   = 0;
+    entry.expires = now() + TIMEOUT;
+
+    pthreads::ScopedLock lock(m_mutex);
+    lockless_put( key(path), entry );
+}
+
+void AttrCache::putError( const Path_t& path, int error )
+{
+    Entry entry;
+    memset( &entry.attr, 0, sizeof(entry.attr) );
+    entry.error   = error;
+    entry.expires = now() + TIMEOUT;
+
+    pthreads::ScopedLock lock(m_mutex);
+    lockless_put( key(path), entry );
+}
+
+void AttrCache::invalidate( const Path_t& path )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    lockless_erase( key(path) );
+}
+
+void AttrCache::notify( const Path_t& path, bool data )
+{
+    invalidate(path);
+
+    // repeated notifications of the same path before the thread gets to
+    // it are delivered once
+    pthreads::ScopedLock lock(m_pendingMutex);
+    m_pending[ key(path) ] |= data;
+    m_pendingCond.signal();
+}
+
+void AttrCache::start()
+{
+    pthreads::ScopedLock lock(m_pendingMutex);
+    if( m_running )
+        return;
+    m_running = true;
+    m_thread.launch( dispatch_main, this );
+}
+
+void AttrCache::stop()
+{
+    {
+        pthreads::ScopedLock lock(m_pendingMutex);
+        if( !m_running )
+            return;
+        m_running = false;
+        m_pendingCond.signal();
+    }
+    m_thread.join();
+
+    pthreads::ScopedLock lock(m_pendingMutex);
+    m_pending.clear();
+}
+
+void* AttrCache::dispatch_main( void* vp_cache )
+{
+    static_cast<AttrCache*>(vp_cache)->main();
+    return vp_cache;
+}
+
+void AttrCache::main()
+{
+    while(true)
+    {
+        PendingMap_t pending;
+
+        // lock scope
+        {
+            pthreads::ScopedLock lock(m_pendingMutex);
+            while( m_running && m_pending.empty() )
+                m_pendingCond.wait(m_pendingMutex);
+            if( !m_running )
+                break;
+            pending.swap(m_pending);
+        }
+
+        // the listeners talk to the kernel, which may wait on fuse
+        // requests that need m_mutex, so it isn't held here
+        pthreads::ScopedLock lock(m_notifyMutex);
+        for( auto& pair : pending )
+            for( auto listener : m_listeners )
+                listener->invalidate( pair.first, pair.second );
+    }
+}
+
+void AttrCache::addListener( Listener* listener )
+{
+    pthreads::ScopedLock lock(m_notifyMutex);
+    m_listeners.insert(listener);
+}
+
+void AttrCache::removeListener( Listener* listener )
+{
+    pthreads::ScopedLock lock(m_notifyMutex);
+    m_listeners.erase(listener);
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
@@ -0,0 +1,165 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/AttrCache.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_ATTRCACHE_H_
+#define OPENBOOK_FS_ATTRCACHE_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+#include <cpp-pthreads.h>
+
+
+namespace   openbook {
+namespace filesystem {
+
+/// caches the attributes (or the absence) of files for getattr
+/**
+ *  Paths are the same as in the database (i.e. relative to the real root,
+ *  not to a mount point). They are normalized before they are used as keys
+ *  so that "//a" or "/a/" find the entry of "/a". Entries are dropped by invalidate() when a change
+ *  is made through fuse, and by notify() when a change arrives from a
+ *  peer. notify() also passes the path on to the listeners, which are the
+ *  frontends that can tell the kernel to drop it's own cached copy.
+ *
+ *  The listeners are called from a thread of our own and never from the
+ *  caller of notify(). Invalidating the kernel's pages waits on fuse reads
+ *  that are in flight, and those may be waiting on data which the caller
+ *  (i.e. a peer's message thread) has yet to deliver.
+ */
+class AttrCache
+{
+    public:
+        typedef boost::filesystem::path Path_t;
+
+        /// how long entries are valid (seconds), both here and in the
+        /// kernel. Invalidations are explicit so this can be long.
+        static const int TIMEOUT = 60;
+
+        /// if there are more entries than this then expired ones are
+        /// dropped, and if that isn't enough, all of them
+        static const unsigned int MAX_ENTRIES = 65536;
+
+        /// something that wants to know when a path is changed by a peer
+        class Listener
+        {
+            public:
+                virtual ~Listener(){}
+
+                /// @p path and anything beneath it have changed, if
+                /// @p data is false then only their attributes did
+                virtual void invalidate( const Path_t& path, bool data )=0;
+        };
+
+    private:
+        struct Entry
+        {
+            struct stat attr;       ///< cached attributes
+            int         error;      ///< errno of a failed getattr
+            int64_t     expires;    ///< monotonic time (seconds)
+        };
+
+        typedef std::map<std::string,Entry>  EntryMap_t;
+        typedef std::set<Listener*>          ListenerSet_t;
+        typedef std::map<std::string,bool>   PendingMap_t;
+
+        pthreads::Mutex m_mutex;        ///< locks m_entries
+        EntryMap_t      m_entries;
+
+        /// locks m_listeners, and is held while they are called so that
+        /// one isn't removed in the middle of a notification
+        pthreads::Mutex m_notifyMutex;
+        ListenerSet_t   m_listeners;
+
+        /// paths waiting to be passed to the listeners, and whether their
+        /// data changed (or only their attributes)
+        pthreads::Mutex     m_pendingMutex;
+        pthreads::Condition m_pendingCond;
+        PendingMap_t        m_pending;
+        bool                m_running;
+        pthreads::Thread    m_thread;
+
+        /// passes pending notifications to the listeners until stop()
+        void main();
+
+        static int64_t now();
+
+        /// the key of @p path in m_entries: repeated separators are
+        /// collapsed and a trailing one is dropped
+        static std::string key( const Path_t& path );
+
+        /// remove @p path and everything beneath it
+        void lockless_erase( const std::string& path );
+
+        /// insert an entry, making room if there are too many
+        void lockless_put( const std::string& path, const Entry& entry );
+
+    public:
+        AttrCache();
+        ~AttrCache();
+
+        /// retrieve cached attributes, returns false if there is no valid
+        /// entry. If the file is known not to exist then @p error is set
+        /// to the errno that getattr failed with, otherwise it is 0.
+        bool get( const Path_t& path, struct stat& attr, int& error );
+
+        /// cache the attributes of a file
+        void put( const Path_t& path, const struct stat& attr );
+
+        /// cache the failure of getattr for a file
+        void putError( const Path_t& path, int error );
+
+        /// drop @p path and anything beneath it, for changes made through
+        /// fuse (the kernel already knows about them)
+        void invalidate( const Path_t& path );
+
+        /// drop @p path and anything beneath it and queue it for the
+        /// listeners, for changes that the kernel doesn't know about. If
+        /// @p data is false then only the attributes changed and the
+        /// kernel may keep the contents it has cached.
+        void notify( const Path_t& path, bool data=true );
+
+        /// start the thread which calls the listeners
+        void start();
+
+        /// stop the thread, notifications still pending are dropped
+        void stop();
+
+        /// pthread-callable function
+        static void* dispatch_main( void* vp_cache );
+
+        void addListener( Listener* listener );
+        void removeListener( Listener* listener );
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // ATTRCACHE_H_
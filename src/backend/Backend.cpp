@@ -44,6 +44,11 @@
 #include <crypto++/base64.h>
 #include <soci/sqlite3/soci-sqlite3.h>
 #include "SelectSpec.h"
+#include "jobs/EvictCache.h"
+#include "jobs/ExpireFetches.h"
+#include "jobs/FlushVersions.h"
+#include "jobs/PingJob.h"
+#include "jobs/VerifyDownload.h"
 
 
 
@@ -54,13 +59,19 @@
 namespace   openbook {
 namespace filesystem {
 
-Backend::Backend() {
+Backend::Backend():
+    m_fetcher(this),
+    m_cache(this),
+    m_swarm(this) {
   m_mutex.init();
   m_configFile = "./obfs.yaml";
   m_displayName = "Anonymous";
   m_dataDir = "./.obfs";
 
   m_maxPeers = 10;
+  m_nextCookie = 1;
+  m_xferBlockSize = 256*1024;
+  m_flushMs = jobs::FlushVersions::INTERVAL_MS;
   m_connPool.reserve(m_maxPeers);
   m_workerPool.reserve(m_maxPeers);
 
@@ -140,6 +151,19 @@ int Backend::registerPeer( const std::string& base64,
         // do that for us
         // peerMap.signal();
     }
+
+    // start the keepalive for this connection
+    int32_t cookie = 0;
+    {
+        LockedPtr<USKeepAliveMap_t> keepAlive( &m_keepAlive );
+        cookie = m_nextCookie++;
+        KeepAlive& entry = (*keepAlive)[peerId];
+        entry.cookie = cookie;
+        entry.rtt    = -1;
+        entry.sent   = -1;
+    }
+    m_jobWorker.schedule( new jobs::Ping(this,peerId,cookie), 0 );
+
     return peerId;
 }
 
@@ -147,6 +171,53 @@ void Backend::unregisterPeer( int peerId )
 {
     std::cout << "Backend: removing " << peerId << "from map\n";
     m_peerMap.lockFor()->erase(peerId);
+    m_keepAlive.lockFor()->erase(peerId);
+
+    // nothing queued for this peer can be delivered anymore
+    m_jobWorker.cancel(peerId);
+    m_fetcher.peerLost(peerId);
+    m_swarm.peerLost(peerId);
+}
+
+bool Backend::isConnected( int peerId )
+{
+    LockedPtr<USPeerMap_t> peerMap( &m_peerMap );
+    return peerMap->find(peerId) != peerMap->end();
+}
+
+bool Backend::pingSent( int peerId, int32_t cookie, int64_t sent )
+{
+    LockedPtr<USKeepAliveMap_t> keepAlive( &m_keepAlive );
+    USKeepAliveMap_t::iterator it = keepAlive->find(peerId);
+    if( it == keepAlive->end() || it->second.cookie != cookie )
+        return false;
+
+    it->second.sent = sent;
+    return true;
+}
+
+bool Backend::pongReceived( int peerId, int32_t cookie, int64_t sent,
+                            int64_t rtt )
+{
+    LockedPtr<USKeepAliveMap_t> keepAlive( &m_keepAlive );
+    USKeepAliveMap_t::iterator it = keepAlive->find(peerId);
+    if( it == keepAlive->end()
+            || it->second.cookie != cookie
+            || it->second.sent   != sent )
+        return false;
+
+    it->second.rtt  = rtt;
+    it->second.sent = -1;
+    return true;
+}
+
+int64_t Backend::rtt( int peerId )
+{
+    LockedPtr<USKeepAliveMap_t> keepAlive( &m_keepAlive );
+    USKeepAliveMap_t::iterator it = keepAlive->find(peerId);
+    if( it == keepAlive->end() )
+        return -1;
+    return it->second.rtt;
 }
 
 
@@ -181,12 +252,14 @@ void Backend::onConnect(FdPtr_t sockfd, bool remote)
 
 void Backend::mount( const std::string& path,
                      const std::string& reldir,
-                     int argc, char** argv )
+                     int argc, char** argv,
+                     bool lowlevel,
+                     int threads )
 {
     MountPoint* mp = new MountPoint(path);
     try
     {
-        mp->mount(this,reldir,argc,argv);
+        mp->mount(this,reldir,argc,argv,lowlevel,threads);
 
         // lock access to m_mountPts
         m_mountPts.lockFor()->push_back(mp);
@@ -226,20 +299,60 @@ void Backend::unmount( int imp )
 
 
 
-void Backend::mapPeer( const messages::IdMapEntry& entry, std::map<int,int>& map )
+const int Backend::MAX_REMOTE_PEER_ID;
+
+void Backend::mapPeer( const messages::IdMap& msg, std::vector<int>& table )
 {
     LockedPtr<USIdMap_t> idMap( &m_idMap );
-    int peerId = 0;
 
-    // if we do not know about this peer, then add him to the map
-    USIdMap_t::iterator match = idMap->find( entry.publickey() );
-    if( match == idMap->end() )
-        peerId = m_db.registerPeer( entry.publickey(), entry.displayname() );
-    else
-        peerId = match->second;
+    // figure out how big the table needs to be, and which peers we
+    // don't know about
+    int maxId = 0;
+    std::vector<int>         unknown;
+    std::vector<std::string> keys;
+    std::vector<std::string> names;
+    for( int i=0; i < msg.peermap_size(); i++ )
+    {
+        const messages::IdMapEntry& entry = msg.peermap(i);
+        if( entry.peerid() < 0 || entry.peerid() > MAX_REMOTE_PEER_ID )
+        {
+            std::cerr << "Backend::mapPeer : ignoring remote peer id "
+                      << entry.peerid() << ", out of range\n";
+            continue;
+        }
 
-    map[entry.peerid()] = peerId;
+        maxId = std::max( maxId, (int)entry.peerid() );
+        if( idMap->find( entry.publickey() ) == idMap->end() )
+        {
+            unknown.push_back( i );
+            keys.push_back( entry.publickey() );
+            names.push_back( entry.displayname() );
+        }
+    }
 
+    // if we do not know about some peers, then add them to the map. Peers
+    // that couldn't be registered stay out of it so that they're tried
+    // again next time, and until then they're unmapped
+    if( unknown.size() > 0 )
+    {
+        std::vector<int> ids;
+        m_db.registerPeers( keys, names, ids );
+        for( unsigned int i=0; i < unknown.size(); i++ )
+            if( ids[i] >= 0 )
+                (*idMap)[ keys[i] ] = ids[i];
+    }
+
+    table.assign( maxId+1, -1 );
+    for( int i=0; i < msg.peermap_size(); i++ )
+    {
+        const messages::IdMapEntry& entry = msg.peermap(i);
+        if( entry.peerid() < 0 || entry.peerid() > MAX_REMOTE_PEER_ID )
+            continue;
+
+        USIdMap_t::iterator it = idMap->find( entry.publickey() );
+        if( it != idMap->end() )
+            table[ entry.peerid() ] = it->second;
+    }
 }
 
 
@@ -253,28 +366,53 @@ void Backend::buildPeerMap( messages::IdMap* map )
     entry->set_displayname( m_displayName );
 }
 
-void Backend::addDownload( int64_t peer,
+bool Backend::addDownload( int64_t peer,
                             const Path_t& path,
                             int64_t size,
-                            const VersionVector& version )
+                            const VersionVector& version,
+                            int64_t& tx,
+                            int64_t& offset )
 {
     std::cout << "Backend::addDownload() : here\n";
-    m_db.addDownload(peer,path,size,version,m_stageDir);
+    if( !m_db.addDownload(peer,path,size,version,m_stageDir,tx,offset) )
+        return false;
+
+    // the peer has a newer version than us, so if we're sending it our
+    // copy of the file then that transfer is obsolete
+    m_jobWorker.cancel( peer, path.string() );
+    return true;
 }
 
 void Backend::mergeData( int64_t peer, messages::FileChunk* chunk )
 {
-    m_db.mergeData( peer, m_stageDir, m_rootDir, chunk );
+    // chunks answering a ranged request go to the cache
+    if( m_fetcher.merge( peer, chunk ) )
+        return;
+
+    // pieces of a multi-peer download go to the primary download
+    if( m_swarm.merge( peer, chunk ) )
+        return;
+
+    // once the last bytes are in the file is verified off of the
+    // message thread
+    if( m_db.mergeData( peer, m_stageDir, chunk ) )
+        m_jobWorker.enqueue(
+            new jobs::VerifyDownload(this, peer, chunk->path(), chunk->tx()) );
 }
 
 void Backend::checkout( const Path_t& path )
 {
     m_db.checkout(m_rootDir,path);
+
+    // the change comes from the ui, not through fuse, so the kernel has
+    // to be told as well
+    m_attrCache.notify(path);
 }
 
 void Backend::release( const Path_t& path )
 {
     m_db.release(m_rootDir,path);
+    m_attrCache.notify(path);
 }
 
 void Backend::setDisplayName( const std::string& name )
@@ -329,6 +467,9 @@ void Backend::setDataDir( const std::string& dir )
             ex()() << "failed to create stage directory: " << m_stageDir;
     }
 
+    // cache for unsubscribed files that have been read
+    m_fetcher.setCacheDir( m_dataDir / "cache" );
+
     // if there is no private key file then create one
     m_privKey       = m_dataDir / "id_rsa.der";
     Path_t pubKey   = m_dataDir / "id_rsa_pub.der";
@@ -459,6 +600,50 @@ void Backend::setMaxConnections( int maxConnections )
     }
 }
 
+void Backend::setJobWorkers( int jobWorkers )
+{
+    std::cout << "Backend: job workers: " << jobWorkers << "\n";
+    m_jobWorker.setNumWorkers( jobWorkers );
+}
+
+void Backend::setXferBlockSize( int blockSize )
+{
+    // reads smaller than a file chunk don't make any sense
+    if( blockSize < 1024 )
+        blockSize = 1024;
+
+    std::cout << "Backend: transfer block size: " << blockSize << "\n";
+    m_xferBlockSize = blockSize;
+}
+
+void Backend::setVersionFlushInterval( int ms )
+{
+    // flushing more often than this just brings back the small
+    // transactions that deferring the flush avoids
+    if( ms < 10 )
+        ms = 10;
+
+    std::cout << "Backend: version flush interval: " << ms << "ms\n";
+    m_flushMs = ms;
+}
+
+void Backend::setFetchCacheSize( int64_t bytes )
+{
+    // less than one block would thrash
+    if( bytes < LazyFetcher::BLOCK_SIZE )
+        bytes = LazyFetcher::BLOCK_SIZE;
+
+    m_fetcher.setQuota( bytes );
+}
+
+void Backend::setCacheQuota( int64_t bytes )
+{
+    if( bytes < 0 )
+        bytes = 0;
+
+    m_cache.setQuota( bytes );
+}
+
 void Backend::loadConfig( const std::string& filename )
 {
     namespace fs = boost::filesystem;
@@ -560,6 +745,26 @@ void Backend::loadConfig( const std::string& filename )
     setMaxConnections(config["maxConnections"].as<int>());
   }
 
+  if (config["jobWorkers"]) {
+    setJobWorkers(config["jobWorkers"].as<int>());
+  }
+
+  if (config["xferBlockSize"]) {
+    setXferBlockSize(config["xferBlockSize"].as<int>());
+  }
+
+  if (config["versionFlushInterval"]) {
+    setVersionFlushInterval(config["versionFlushInterval"].as<int>());
+  }
+
+  if (config["fetchCacheSize"]) {
+    setFetchCacheSize(config["fetchCacheSize"].as<int64_t>());
+  }
+
+  if (config["cacheQuota"]) {
+    setCacheQuota(config["cacheQuota"].as<int64_t>());
+  }
+
   if (config["mountPoints"]) {
     int entry_index = -1;
     for (const auto& node : config["mountPoints"]) {
@@ -569,6 +774,8 @@ void Backend::loadConfig( const std::string& filename )
 
       std::string mountPoint;
       std::string relDir;
+      bool lowlevel = false;
+      int threads = MountPoint::DEFAULT_THREADS;
       char argBuf[nchars];  //< buffer for arguments
       int argw = 0;       //< write offset
       char* argv[nargs];    //< argument index
@@ -594,6 +801,12 @@ void Backend::loadConfig( const std::string& filename )
       } else
         relDir = "";
 
+      if (node["lowlevel"])
+        lowlevel = node["lowlevel"].as<bool>();
+
+      if (node["threads"])
+        threads = node["threads"].as<int>();
+
       if (node["argv"]) {
         char* pwrite = argBuf;  //< write head
 
@@ -624,7 +837,7 @@ void Backend::loadConfig( const std::string& filename )
           std::cout << "\n        " << argv[i];
         std::cout << "\n";
 
-        mount(mountPoint, relDir, argc, argv);
+        mount(mountPoint, relDir, argc, argv, lowlevel, threads);
       } catch (const std::exception& ex) {
         std::cerr << "Backend::loadConfig: Failed to mount " << mountPoint
                   << "\n";
@@ -694,6 +907,16 @@ void Backend::saveConfig( const std::string& filename )
              << YAML::EndMap
          << YAML::Key   << "maxConnections"
          << YAML::Value << m_maxPeers
+         << YAML::Key   << "jobWorkers"
+         << YAML::Value << m_jobWorker.numWorkers()
+         << YAML::Key   << "xferBlockSize"
+         << YAML::Value << m_xferBlockSize
+         << YAML::Key   << "versionFlushInterval"
+         << YAML::Value << m_flushMs
+         << YAML::Key   << "fetchCacheSize"
+         << YAML::Value << m_fetcher.quota()
+         << YAML::Key   << "cacheQuota"
+         << YAML::Value << m_cache.quota()
          << YAML::Key   << "mountPoints"
          << YAML::Value
              << YAML::BeginSeq;
@@ -708,6 +931,10 @@ void Backend::saveConfig( const std::string& filename )
                     << YAML::Value << mountPts[i]->mountPoint()
                     << YAML::Key   << "reldir"
                     << YAML::Value << mountPts[i]->relDir()
+                    << YAML::Key   << "lowlevel"
+                    << YAML::Value << mountPts[i]->lowlevel()
+                    << YAML::Key   << "threads"
+                    << YAML::Value << mountPts[i]->threads()
                     << YAML::Key   << "argv"
                     << YAML::Value
                         << YAML::BeginSeq;
@@ -880,6 +1107,10 @@ void Backend::getPeers( messages::PeerList* message )
                 entry->set_peerid     ( row.get<int>(0)         );
                 entry->set_displayname( row.get<std::string>(1) );
                 entry->set_publickey  ( row.get<std::string>(2) );
+
+                int64_t peerRtt = rtt( row.get<int>(0) );
+                if( peerRtt >= 0 )
+                    entry->set_rtt( peerRtt );
             }
         }
     }
@@ -908,6 +1139,10 @@ void Backend::getKnownPeers( messages::PeerList* message )
             entry->set_peerid     ( row.get<int>(0)         );
             entry->set_displayname( row.get<std::string>(1) );
             entry->set_publickey  ( row.get<std::string>(2) );
+
+            int64_t peerRtt = rtt( row.get<int>(0) );
+            if( peerRtt >= 0 )
+                entry->set_rtt( peerRtt );
         }
     }
     catch( const std::exception& ex )
@@ -933,6 +1168,11 @@ void Backend::getMounts( messages::MountList* message )
     }
 }
 
+void Backend::getFuseStats( messages::FuseStatList* message )
+{
+    m_fuseStats.fill(message);
+}
+
 
 void Backend::parse(int argc, char** argv)
 {
@@ -1046,8 +1286,22 @@ int Backend::run(int argc, char** argv)
         for(int i=0; i < NUM_LISTENERS; i++)
             m_listeners[i].setInterface( "localhost", 3030+i);
 
-        // star the long job worker
-        m_jobThread.launch( JobWorker::dispatch_main, &m_jobWorker );
+        // start the thread which passes peer changes on to the kernel
+        m_attrCache.start();
+
+        // start the long job workers
+        m_jobWorker.start();
+
+        // and the periodic check of the cache quota
+        m_jobWorker.schedule( new jobs::EvictCache(this),
+                              jobs::EvictCache::INTERVAL_MS );
+
+        // and the version increases of modified files
+        m_jobWorker.schedule( new jobs::FlushVersions(this), m_flushMs );
+
+        // and the lazy reads that a peer never answered
+        m_jobWorker.schedule( new jobs::ExpireFetches(this),
+                              jobs::ExpireFetches::INTERVAL_MS );
     }
 
     sleep(1);
@@ -1061,10 +1315,9 @@ int Backend::run(int argc, char** argv)
             ( g_termNote->readFd(), select_spec::READ );
     selectme.wait(false);
 
-    // kill the job worker
-    std::cout << "Backend: Killing job worker\n";
-    m_jobWorker.enqueue( new JobKiller() );
-    m_jobThread.join();
+    // kill the job workers
+    std::cout << "Backend: Killing job workers\n";
+    m_jobWorker.stop();
 
     // wait for listener threads to quit
     for(int i=0; i < NUM_LISTENERS; i++)
@@ -1078,6 +1331,9 @@ int Backend::run(int argc, char** argv)
             mountPts[i]->unmount();
     }
 
+    // once unmounted the kernel answers anything still in flight
+    m_attrCache.stop();
+
     // save the configuration
     // todo: there is a race condition right here, it's possible for someone
     // to modify the mountpoints while we're saving, perhaps change saveConfig
@@ -1093,6 +1349,10 @@ int Backend::run(int argc, char** argv)
         mountPts.clear();
     }
 
+    // now that nothing can modify files, apply the version increases that
+    // are still pending
+    m_db.flushVersions();
+
     // wait for all connections to finish
     std::cout << "Backend: waiting for connections to finish\n";
     while(m_connPool.size() < m_connPool.capacity())
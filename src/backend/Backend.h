@@ -32,7 +32,12 @@
 
 #include "Connection.h"
 #include "FileDescriptor.h"
+#include "CacheManager.h"
+#include "AttrCache.h"
+#include "FuseStats.h"
+#include "LazyFetcher.h"
 #include "LongJob.h"
+#include "SwarmDownloader.h"
 #include "MessageHandler.h"
 #include "NotifyPipe.h"
 #include "SocketListener.h"
@@ -61,6 +66,18 @@ class Backend
         typedef std::map<std::string,int>   USIdMap_t;
         typedef Synchronized<USIdMap_t>     IdMap_t;
 
+        /// keepalive state for a connected peer
+        struct KeepAlive
+        {
+            int32_t cookie; ///< changes each time the peer connects
+            int64_t rtt;    ///< last round trip time (us), -1 if unknown
+            int64_t sent;   ///< when the outstanding ping was sent, -1 if
+                            ///  there isn't one
+        };
+
+        typedef std::map<int,KeepAlive>         USKeepAliveMap_t;
+        typedef Synchronized<USKeepAliveMap_t>  KeepAliveMap_t;
+
         enum Listeners
         {
             LISTEN_LOCAL,
@@ -94,12 +111,22 @@ class Backend
         ConnPool_t      m_connPool;     ///< connection pool
         WorkerPool_t    m_workerPool;   ///< worker pool
 
-        pthreads::Thread    m_jobThread;    ///< for long jobs
-        JobWorker           m_jobWorker;    ///< for long jobs
+        JobWorker           m_jobWorker;    ///< pool for long jobs
+        LazyFetcher         m_fetcher;      ///< reads unsubscribed files
+        CacheManager        m_cache;        ///< evicts checked-out files
+        SwarmDownloader     m_swarm;        ///< multi-peer downloads
+        AttrCache           m_attrCache;    ///< attributes for getattr
+        FuseStats           m_fuseStats;    ///< counters of fuse calls
+        int                 m_xferBlockSize;///< size of disk reads for
+                                            ///  file transfers
+        int                 m_flushMs;      ///< time between version
+                                            ///  flushes
 
         PeerMap_t   m_peerMap;  ///< maps peer id to connection objects
         MountMap_t  m_mountPts; ///< stores mount points
         IdMap_t     m_idMap;    ///< maps base64 public keys to ids
+        KeepAliveMap_t  m_keepAlive;    ///< keepalive state of peers
+        int32_t         m_nextCookie;   ///< next keepalive cookie
 
         // for outgoing connections
         int         m_clientFamily; ///< address family AF_[INET|INET6|UNIX]
@@ -124,16 +151,36 @@ class Backend
         /// unregister a connected peer
         void unregisterPeer( int peerId );
 
+        /// record that a ping stamped @p sent is going out to @p peerId,
+        /// returns false if @p cookie doesn't identify the current
+        /// connection, so that pings for old connections stop
+        bool pingSent( int peerId, int32_t cookie, int64_t sent );
+
+        /// record the round trip time of a pong, returns true if it
+        /// answers the outstanding ping of the current connection. Only
+        /// then is the next ping scheduled, so a duplicate or late pong
+        /// can't start a second chain.
+        bool pongReceived( int peerId, int32_t cookie, int64_t sent,
+                           int64_t rtt );
+
+        /// return the last measured round trip time to a peer in
+        /// microseconds, or -1 if it isn't known
+        int64_t rtt( int peerId );
+
         /// return the path to the private key file
         std::string privateKeyFile();
 
         /// callback for new peer connections
         void onConnect(FdPtr_t sockfd, bool remote);
 
-        /// add a mount point
+        /// add a mount point, @p lowlevel selects the inode based fuse
+        /// frontend and @p threads is the number of threads that dispatch
+        /// it's requests
         void mount( const std::string& mountPoint,
                     const std::string& reldir,
-                    int argc, char** argv );
+                    int argc, char** argv,
+                    bool lowlevel=false,
+                    int threads=MountPoint::DEFAULT_THREADS );
 
         /// remote a mount point by id
         void unmount( int id );
@@ -163,24 +210,62 @@ class Backend
         /// long jobs
         JobWorker* jobs(){ return &m_jobWorker; }
 
+        /// return the object which serves reads of unsubscribed files
+        LazyFetcher& fetcher(){ return m_fetcher; }
+
+        /// return the object which keeps checked-out files within quota
+        CacheManager& cache(){ return m_cache; }
+
+        /// return the object which downloads files from many peers at once
+        SwarmDownloader& swarm(){ return m_swarm; }
+
+        /// return the cache of file attributes shared by all mounts
+        AttrCache& attrCache(){ return m_attrCache; }
+
+        /// return the counters of fuse calls shared by all mounts
+        FuseStats& fuseStats(){ return m_fuseStats; }
+
+        /// returns true if we currently have a connection to @p peerId
+        bool isConnected( int peerId );
+
+        /// return the size of disk reads used when sending files
+        int xferBlockSize(){ return m_xferBlockSize; }
+
+        /// return the time in milliseconds between applying the version
+        /// increases of modified files
+        int versionFlushInterval(){ return m_flushMs; }
+
         /// return the the data directory of the backend
         const Path_t dataDir(){ return m_dataDir; }
 
         /// return the real root of the filesystem
         const Path_t realRoot(){ return m_rootDir; }
 
-        /// generate a mapping from remote peer id to local peer id
-        void mapPeer( const messages::IdMapEntry& entry, std::map<int,int>& map );
+        /// return the path to the staging directory
+        const Path_t stageDir(){ return m_stageDir; }
+
+        /// largest remote peer id accepted in an id map, the translation
+        /// table is dense so this bounds it's size
+        static const int MAX_REMOTE_PEER_ID = 65535;
+
+        /// generate a table mapping remote peer id (index) to local peer
+        /// id (value, or -1 if unmapped). Peers that we don't know about
+        /// are registered all at once.
+        void mapPeer( const messages::IdMap& msg, std::vector<int>& table );
 
         /// fill a peer map message
         void buildPeerMap( messages::IdMap* map );
 
         /// adds the requested path for download or pre-empts a current
-        /// download if a newer version is to be retrieved
-        void addDownload( int64_t peer,
+        /// download if a newer version is to be retrieved, returns true
+        /// if the file should be requested with transaction @p tx starting
+        /// at byte @p offset (see Database::addDownload)
+        bool addDownload( int64_t peer,
                             const Path_t& path,
                             int64_t size,
-                            const VersionVector& version );
+                            const VersionVector& version,
+                            int64_t& tx,
+                            int64_t& offset );
 
         void mergeData( int64_t peer, messages::FileChunk* chunk );
 
@@ -221,6 +306,23 @@ class Backend
         /// set the size of the connection pool
         void setMaxConnections( int maxConnections );
 
+        /// set the number of threads working on long jobs
+        void setJobWorkers( int jobWorkers );
+
+        /// set the size of disk reads used when sending files
+        void setXferBlockSize( int blockSize );
+
+        /// set the time in milliseconds between applying the version
+        /// increases of modified files
+        void setVersionFlushInterval( int ms );
+
+        /// set the number of bytes of unsubscribed files that may be cached
+        void setFetchCacheSize( int64_t bytes );
+
+        /// set the number of bytes of checked-out files to keep, 0 for
+        /// no limit
+        void setCacheQuota( int64_t bytes );
+
         /// loads a configuration file
         void loadConfig(const std::string& filename);
 
@@ -235,6 +337,7 @@ class Backend
         void getPeers( messages::PeerList* message );
         void getKnownPeers( messages::PeerList* message );
         void getMounts( messages::MountList* message );
+        void getFuseStats( messages::FuseStatList* message );
 
     private:
         /// parses the command line
@@ -0,0 +1,87 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/ByteRanges.cpp
+ *
+ *  @brief  
+ */
+
+#include <algorithm>
+
+#include "ByteRanges.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+int64_t addRange( RangeMap_t& ranges,
+                  int64_t prefix, int64_t begin, int64_t end )
+{
+    typedef RangeMap_t::iterator iterator;
+
+    if( end <= begin )
+        return prefix;
+
+    if( begin <= prefix )
+        prefix = std::max(prefix,end);
+    else
+    {
+        // merge with the range before, if it overlaps
+        iterator it = ranges.upper_bound(begin);
+        if( it != ranges.begin() )
+        {
+            iterator prev = it;
+            --prev;
+            if( prev->second >= begin )
+            {
+                begin = prev->first;
+                end   = std::max(end,prev->second);
+                ranges.erase(prev);
+            }
+        }
+
+        // and any ranges after that it overlaps
+        while( it != ranges.end() && it->first <= end )
+        {
+            end = std::max(end,it->second);
+            ranges.erase(it++);
+        }
+
+        ranges[begin] = end;
+    }
+
+    // absorb any ranges that now touch the prefix
+    while( !ranges.empty() && ranges.begin()->first <= prefix )
+    {
+        prefix = std::max(prefix,ranges.begin()->second);
+        ranges.erase(ranges.begin());
+    }
+
+    return prefix;
+}
+
+bool mergeChunk( RangeMap_t& ranges, int64_t& prefix, int64_t size,
+                 int64_t begin, int64_t end )
+{
+    prefix = addRange( ranges, prefix, begin, end );
+    return prefix >= size;
+}
+
+} //< namespace filesystem
+} //< namespace openbook
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/ByteRanges.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_BYTERANGES_H_
+#define OPENBOOK_FS_BYTERANGES_H_
+
+#include <map>
+#include <stdint.h>
+
+
+namespace   openbook {
+namespace filesystem {
+
+/// non-overlapping byte ranges [first,second) of a file
+typedef std::map<int64_t,int64_t>   RangeMap_t;
+
+/// add the range [begin,end) to the set of received ranges and return the
+/// new length of the contiguous prefix that has been received, ranges which
+/// become part of the prefix are removed from the set
+int64_t addRange( RangeMap_t& ranges,
+                  int64_t prefix, int64_t begin, int64_t end );
+
+/// merge a chunk [begin,end) of a download of @p size bytes into the
+/// received ranges, update @p prefix and return true if the whole file
+/// has been received
+/**
+ *  A chunk that completes the download is not necessarily the one which
+ *  moved the prefix: an empty file, or a resume when every byte is already
+ *  on disk, is finished by an empty chunk that only carries the hash.
+ */
+bool mergeChunk( RangeMap_t& ranges, int64_t& prefix, int64_t size,
+                 int64_t begin, int64_t end );
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // BYTERANGES_H_
@@ -0,0 +1,214 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/CacheManager.cpp
+ *
+ *  @brief  
+ */
+
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include <vector>
+#include <sys/stat.h>
+
+#include "CacheManager.h"
+#include "Backend.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+const unsigned int CacheManager::BATCH_SIZE;
+
+/// a file that may be released
+struct EvictCandidate
+{
+    int64_t                     atime;  ///< last access time
+    int64_t                     bytes;  ///< disk usage
+    boost::filesystem::path     path;   ///< the file
+
+    bool operator<( const EvictCandidate& other ) const
+    {
+        return atime < other.atime;
+    }
+};
+
+CacheManager::CacheManager( Backend* backend ):
+    m_backend(backend),
+    m_quota(0)
+{
+    m_mutex.init();
+    m_released.init();
+}
+
+CacheManager::~CacheManager()
+{
+    m_mutex.destroy();
+    m_released.destroy();
+}
+
+void CacheManager::setQuota( int64_t bytes )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    std::cout << "CacheManager: quota: " << bytes << "\n";
+    m_quota = bytes;
+}
+
+int64_t CacheManager::quota()
+{
+    pthreads::ScopedLock lock(m_mutex);
+    return m_quota;
+}
+
+void CacheManager::touch( const Path_t& path )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    m_access[ path.string() ] = time(0);
+}
+
+void CacheManager::pin( const Path_t& path )
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    // a batch is released in one database transaction, after which the
+    // file is opened from a peer's copy
+    while( m_evicting.count( path.string() ) )
+        m_released.wait(m_mutex);
+
+    m_pins[ path.string() ]++;
+    m_access[ path.string() ] = time(0);
+}
+
+void CacheManager::unpin( const Path_t& path, int64_t atime )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    PinMap_t::iterator it = m_pins.find( path.string() );
+    if( it != m_pins.end() && --(it->second) <= 0 )
+        m_pins.erase(it);
+
+    int64_t& last = m_access[ path.string() ];
+    last = std::max( last, atime );
+}
+
+void CacheManager::evict()
+{
+    int64_t quota = this->quota();
+    if( quota <= 0 )
+        return;
+
+    std::vector<Database::CacheEntry> entries;
+    m_backend->db().getCacheEntries( entries );
+
+    // measure what is checked out, files that we haven't seen accessed
+    // since startup go by their atime on disk
+    Path_t  root  = m_backend->realRoot();
+    int64_t usage = 0;
+    std::vector<EvictCandidate> candidates;
+    for( auto& entry : entries )
+    {
+        struct stat fileStat;
+        if( ::lstat( (root / entry.path).c_str(), &fileStat ) < 0
+                || !S_ISREG(fileStat.st_mode) )
+            continue;
+
+        int64_t bytes = (int64_t)fileStat.st_blocks * 512;
+        usage += bytes;
+        if( !entry.evictable )
+            continue;
+
+        EvictCandidate candidate;
+        candidate.atime = fileStat.st_atime;
+        candidate.bytes = bytes;
+        candidate.path  = entry.path;
+
+        pthreads::ScopedLock lock(m_mutex);
+        AccessMap_t::iterator it = m_access.find( entry.path.string() );
+        if( it != m_access.end() )
+            candidate.atime = it->second;
+        candidates.push_back(candidate);
+    }
+
+    if( usage <= quota )
+        return;
+
+    std::cout << "CacheManager: " << usage << " bytes checked out, quota is "
+              << quota << ", releasing files\n";
+
+    std::sort( candidates.begin(), candidates.end() );
+
+    std::vector<Path_t>  batch;
+    std::vector<int64_t> batchBytes;
+    std::vector<Path_t>  released;
+    std::vector<EvictCandidate>::iterator next = candidates.begin();
+    while( usage > quota && next != candidates.end() )
+    {
+        // mark the batch as being evicted so that it can't be opened
+        // while it is released
+        batch.clear();
+        batchBytes.clear();
+        {
+            pthreads::ScopedLock lock(m_mutex);
+            for( ; next != candidates.end()
+                    && batch.size() < BATCH_SIZE
+                    && usage > quota; ++next )
+            {
+                if( m_pins.count( next->path.string() ) )
+                    continue;
+
+                m_evicting.insert( next->path.string() );
+                batch.push_back( next->path );
+                batchBytes.push_back( next->bytes );
+                usage -= next->bytes;
+            }
+        }
+
+        if( batch.empty() )
+            break;
+
+        // the database keeps files that changed since getCacheEntries()
+        // or that no peer has a copy of
+        released.clear();
+        m_backend->db().release( root, batch, released );
+        for( size_t i=0; i < batch.size(); i++ )
+            if( std::find( released.begin(), released.end(), batch[i] )
+                    == released.end() )
+                usage += batchBytes[i];
+
+        // the contents are the same, only where they come from changed
+        for( auto& path : released )
+            m_backend->attrCache().notify( path, false );
+
+        pthreads::ScopedLock lock(m_mutex);
+        for( auto& path : batch )
+        {
+            m_evicting.erase( path.string() );
+            m_access.erase( path.string() );
+        }
+        m_released.broadcast();
+    }
+
+    if( usage > quota )
+        std::cerr << "CacheManager: " << usage << " bytes still checked "
+                  << "out, nothing left which can be released\n";
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/CacheManager.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_CACHEMANAGER_H_
+#define OPENBOOK_FS_CACHEMANAGER_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <stdint.h>
+
+#include <boost/filesystem.hpp>
+#include <cpp-pthreads.h>
+
+
+namespace   openbook {
+namespace filesystem {
+
+class Backend;
+
+/// keeps the checked-out files within a byte quota by releasing the least
+/// recently used ones
+/**
+ *  The fuse operations report when files are opened and released, the
+ *  last time a file was read or written through a handle is kept by the
+ *  handle (see FileContext::access()) and reported when it is released.
+ *  Periodically (see jobs::EvictCache) the total size of subscribed files
+ *  is measured and, if it exceeds the quota, files which are fully synced
+ *  and unmodified are released in least recently used order until it
+ *  doesn't. Files which are open are pinned and never released.
+ */
+class CacheManager
+{
+    public:
+        typedef boost::filesystem::path     Path_t;
+
+        /// number of files released in one database transaction
+        static const unsigned int BATCH_SIZE = 32;
+
+    private:
+        typedef std::map<std::string,int64_t>   AccessMap_t;
+        typedef std::map<std::string,int>       PinMap_t;
+        typedef std::set<std::string>           PathSet_t;
+
+        Backend*        m_backend;
+        pthreads::Mutex m_mutex;        ///< locks everything below
+        pthreads::Condition m_released; ///< signalled after each batch
+        int64_t         m_quota;        ///< max bytes, 0 for no limit
+        AccessMap_t     m_access;       ///< last access time of files
+        PinMap_t        m_pins;         ///< open count of files
+        PathSet_t       m_evicting;     ///< files being released
+
+    public:
+        CacheManager( Backend* backend );
+        ~CacheManager();
+
+        /// set the maximum number of bytes of checked-out files, 0 for
+        /// no limit
+        void setQuota( int64_t bytes );
+
+        /// return the maximum number of bytes of checked-out files
+        int64_t quota();
+
+        /// record that a file was accessed without a handle
+        void touch( const Path_t& path );
+
+        /// record that a file was opened so that it wont be released
+        /// while it is open, if it is being released right now then this
+        /// waits until it has been
+        void pin( const Path_t& path );
+
+        /// record that a file was closed, @p atime is the last time it was
+        /// read or written through the handle
+        void unpin( const Path_t& path, int64_t atime=0 );
+
+        /// if checked-out files exceed the quota then release the least
+        /// recently used evictable ones until they don't
+        void evict();
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // CACHEMANAGER_H_
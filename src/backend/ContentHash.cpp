@@ -0,0 +1,246 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/ContentHash.cpp
+ *
+ *  @brief  
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#include <cpp-pthreads.h>
+
+#include "ContentHash.h"
+#include "ExceptionStream.h"
+#include "LongJob.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+const int64_t ContentHash::LEAF_SIZE;
+const int     ContentHash::DIGEST_SIZE;
+
+/// prefixes which keep leaf digests and root digests from colliding
+static const unsigned char LEAF_PREFIX = 0x00;
+static const unsigned char ROOT_PREFIX = 0x01;
+
+ContentHash::ContentHash()
+{
+    reset(0);
+}
+
+void ContentHash::reset( int64_t offset )
+{
+    if( offset % LEAF_SIZE )
+        ex()() << "ContentHash: can't start streaming at " << offset
+               << " which is not a leaf boundary";
+
+    m_leaves.resize( offset / LEAF_SIZE );
+    m_offset = offset;
+    m_fill   = 0;
+    m_leaf.Restart();
+    m_leaf.Update( &LEAF_PREFIX, 1 );
+}
+
+void ContentHash::finishLeaf()
+{
+    std::string leaf( DIGEST_SIZE, '\0' );
+    m_leaf.TruncatedFinal( (unsigned char*)&leaf[0], DIGEST_SIZE );
+    m_leaves.push_back(leaf);
+
+    m_fill = 0;
+    m_leaf.Update( &LEAF_PREFIX, 1 );
+}
+
+void ContentHash::update( const char* data, int64_t len )
+{
+    while( len > 0 )
+    {
+        int64_t n = std::min( len, LEAF_SIZE - m_fill );
+        m_leaf.Update( (const unsigned char*)data, n );
+        m_fill   += n;
+        m_offset += n;
+        data     += n;
+        len      -= n;
+
+        if( m_fill == LEAF_SIZE )
+            finishLeaf();
+    }
+}
+
+namespace {
+
+/// shared state for threads hashing leaves of one file
+struct LeafWork
+{
+    int                         fd;
+    int64_t                     end;
+    std::vector<std::string>*   leaves;
+    std::atomic<int64_t>        next;   ///< next leaf to hash
+    std::atomic<int>            error;  ///< errno of the first failure
+};
+
+void* hashLeavesMain( void* vp_work )
+{
+    LeafWork* work = static_cast<LeafWork*>(vp_work);
+    std::vector<char> buf( ContentHash::LEAF_SIZE );
+
+    while( !work->error )
+    {
+        int64_t i = work->next++;
+        int64_t off = i * ContentHash::LEAF_SIZE;
+        if( off >= work->end )
+            break;
+
+        int64_t len = std::min( ContentHash::LEAF_SIZE, work->end - off );
+        int64_t got = 0;
+        while( got < len )
+        {
+            int result = pread( work->fd, &buf[got], len - got, off + got );
+            if( result <= 0 )
+            {
+                work->error = result < 0 ? errno : EIO;
+                return 0;
+            }
+            got += result;
+        }
+
+        (*work->leaves)[i] = ContentHash::hashLeaf( &buf[0], len );
+    }
+
+    return 0;
+}
+
+}
+
+void ContentHash::hashLeaves( int fd, int64_t end, int nThreads )
+{
+    int64_t nLeaves = ( end + LEAF_SIZE - 1 ) / LEAF_SIZE;
+    if( (int64_t)m_leaves.size() < nLeaves )
+        m_leaves.resize( nLeaves );
+
+    if( nThreads < 1 )
+        nThreads = sysconf( _SC_NPROCESSORS_ONLN );
+    if( nThreads < 1 )
+        nThreads = 1;
+    if( nThreads > nLeaves )
+        nThreads = nLeaves;
+
+    LeafWork work;
+    work.fd     = fd;
+    work.end    = end;
+    work.leaves = &m_leaves;
+    work.next   = 0;
+    work.error  = 0;
+
+    // this thread does a share of the work too
+    std::vector<pthreads::Thread> threads( nThreads > 1 ? nThreads-1 : 0 );
+    for( auto& thread : threads )
+        thread.launch( hashLeavesMain, &work );
+    hashLeavesMain( &work );
+    for( auto& thread : threads )
+        thread.join();
+
+    if( work.error )
+        codedExcept(work.error)() << "ContentHash: failed to read leaves";
+}
+
+void ContentHash::hashLeaves( int fd, int64_t end, JobWorker* pool,
+                              int held )
+{
+    // no point holding slots for more threads than there are leaves
+    int64_t nLeaves = ( end + LEAF_SIZE - 1 ) / LEAF_SIZE;
+    int     wanted  = std::min<int64_t>( nLeaves, INT_MAX ) - held;
+
+    JobWorker::CpuReservation extra( pool, std::max( 0, wanted ) );
+    hashLeaves( fd, end, std::max( 1, held + extra.count() ) );
+}
+
+std::string ContentHash::digest( int64_t size )
+{
+    // finish any partial leaf at the end of the file
+    if( m_fill > 0 )
+        finishLeaf();
+
+    int64_t nLeaves = ( size + LEAF_SIZE - 1 ) / LEAF_SIZE;
+    if( (int64_t)m_leaves.size() != nLeaves )
+        ex()() << "ContentHash: have " << m_leaves.size() << " leaves but a "
+               << size << " byte file has " << nLeaves;
+
+    unsigned char sizeBytes[8];
+    for( int i=0; i < 8; i++ )
+        sizeBytes[i] = ( size >> (8*i) ) & 0xff;
+
+    CryptoPP::BLAKE2b root;
+    root.Update( &ROOT_PREFIX, 1 );
+    root.Update( sizeBytes, 8 );
+    for( auto& leaf : m_leaves )
+        root.Update( (const unsigned char*)leaf.data(), leaf.size() );
+
+    std::string result( DIGEST_SIZE, '\0' );
+    root.TruncatedFinal( (unsigned char*)&result[0], DIGEST_SIZE );
+    return result;
+}
+
+std::string ContentHash::hashFile( int fd, int64_t size, int nThreads )
+{
+    ContentHash hash;
+    hash.hashLeaves( fd, size, nThreads );
+    return hash.digest( size );
+}
+
+std::string ContentHash::hashFile( int fd, int64_t size,
+                                  JobWorker* pool, int held )
+{
+    ContentHash hash;
+    hash.hashLeaves( fd, size, pool, held );
+    return hash.digest( size );
+}
+
+std::string ContentHash::hashLeaf( const char* data, int64_t len )
+{
+    CryptoPP::BLAKE2b leaf;
+    leaf.Update( &LEAF_PREFIX, 1 );
+    leaf.Update( (const unsigned char*)data, len );
+
+    std::string result( DIGEST_SIZE, '\0' );
+    leaf.TruncatedFinal( (unsigned char*)&result[0], DIGEST_SIZE );
+    return result;
+}
+
+std::string ContentHash::toHex( const std::string& digest )
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string result;
+    result.reserve( 2*digest.size() );
+    for( unsigned char c : digest )
+    {
+        result.push_back( hex[c >> 4] );
+        result.push_back( hex[c & 0x0f] );
+    }
+    return result;
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
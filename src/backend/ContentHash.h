@@ -0,0 +1,113 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/ContentHash.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_CONTENTHASH_H_
+#define OPENBOOK_FS_CONTENTHASH_H_
+
+#include <string>
+#include <vector>
+#include <crypto++/blake2.h>
+
+
+namespace   openbook {
+namespace filesystem {
+
+class JobWorker;
+
+/// tree-mode BLAKE2b hash of file contents
+/**
+ *  The file is split into leaves of LEAF_SIZE bytes which are each hashed
+ *  independently, and the root hash is computed over the file size and the
+ *  list of leaf hashes. Because leaves are independent a large file can be
+ *  hashed in parallel, and a sender which is resuming a transfer can hash
+ *  the leaves it isn't sending separately from the ones it is streaming.
+ *
+ *  A ContentHash object accumulates leaf hashes. Data can be streamed into
+ *  it starting from any leaf boundary with update(), and leaves can be
+ *  hashed directly from a file with hashLeaves().
+ */
+class ContentHash
+{
+    public:
+        /// number of bytes in one leaf
+        static const int64_t LEAF_SIZE   = 1024*1024;
+
+        /// number of bytes in a digest
+        static const int     DIGEST_SIZE = 32;
+
+    private:
+        std::vector<std::string> m_leaves;  ///< digests of each leaf
+        CryptoPP::BLAKE2b        m_leaf;    ///< hash of the current leaf
+        int64_t                  m_offset;  ///< offset of the next byte
+        int64_t                  m_fill;    ///< bytes in the current leaf
+
+        /// finish the current leaf and store it's digest
+        void finishLeaf();
+
+    public:
+        ContentHash();
+
+        /// start streaming data at @p offset, which must be a multiple
+        /// of LEAF_SIZE
+        void reset( int64_t offset=0 );
+
+        /// hash the next @p len bytes of the file
+        void update( const char* data, int64_t len );
+
+        /// hash the leaves covering bytes [0,end) of a file directly from
+        /// the file descriptor, using @p nThreads threads (or one per core
+        /// if zero)
+        void hashLeaves( int fd, int64_t end, int nThreads=0 );
+
+        /// hashLeaves() on as many threads as @p pool has cpu slots to
+        /// spare, on top of the @p held slots the calling job already has
+        /// (i.e. 1 for a JOB_CPU job, 0 for a JOB_IO job). The calling
+        /// thread always does a share.
+        void hashLeaves( int fd, int64_t end, JobWorker* pool, int held );
+
+        /// compute the root digest of a file of @p size bytes, all leaves
+        /// must have been hashed
+        std::string digest( int64_t size );
+
+        /// compute the digest of an entire file
+        static std::string hashFile( int fd, int64_t size, int nThreads=0 );
+
+        /// compute the digest of an entire file on the cpu slots of
+        /// @p pool, see hashLeaves()
+        static std::string hashFile( int fd, int64_t size,
+                                     JobWorker* pool, int held );
+
+        /// compute the digest of a single leaf
+        static std::string hashLeaf( const char* data, int64_t len );
+
+        /// printable representation of a digest
+        static std::string toHex( const std::string& digest );
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // CONTENTHASH_H_
@@ -6,26 +6,38 @@
  *  @brief  
  */
 
+#include <algorithm>
+#include <cstring>
+#include <set>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <soci/soci.h>
 #include <soci/sqlite3/soci-sqlite3.h>
 #include <boost/format.hpp>
 
 #include "Database.h"
+#include "ContentHash.h"
 #include "ExceptionStream.h"
 
 
 namespace   openbook {
 namespace filesystem {
 
-Database::Database()
+const int Database::BUSY_TIMEOUT_MS = 5000;
+
+Database::Database():
+    m_genCounter(0)
 {
     m_mutex.init();
+    m_genMutex.init();
+    m_dirtyMutex.init();
 }
 
 Database::~Database()
 {
     m_mutex.destroy();
+    m_genMutex.destroy();
+    m_dirtyMutex.destroy();
 }
 
 void Database::setPath( const Path_t& path )
@@ -33,6 +45,11 @@ void Database::setPath( const Path_t& path )
     m_dbFile = path;
 }
 
+void Database::setReaderTimeout( soci::session& sql )
+{
+    sql << boost::format("PRAGMA busy_timeout=%d") % BUSY_TIMEOUT_MS;
+}
+
 void Database::init()
 {
     pthreads::ScopedLock lock(m_mutex);
@@ -43,6 +60,12 @@ void Database::init()
     std::cout << "Initializing database" << std::endl;
     session sql(sqlite3,m_dbFile.string());
 
+    // write ahead logging lets the read-only queries from fuse threads run
+    // concurrently with each other and with a writer. It is a property of
+    // the database file so it only needs to be set once.
+    std::string journalMode;
+    sql << "PRAGMA journal_mode=WAL", soci::into(journalMode);
+
     // stores a list of all files that we know about
     sql << "CREATE TABLE IF NOT EXISTS files ("
             // unique identifier
@@ -55,10 +78,32 @@ void Database::init()
             "path   TEXT UNIQUE NOT NULL, "
             // whether or not it's checked out
             "subscribed INTEGER NOT NULL, "
+            // size, st_mode, and times of the entry, for unsubscribed
+            // files these come from the peers
+            "size   INTEGER, "
+            "mode   INTEGER, "
+            "ctime  INTEGER, "
+            "mtime  INTEGER, "
             // parent, node pairs must be unique
             "UNIQUE (parent,node)"
             ") ";
 
+    // databases created before the metadata columns existed need them
+    // added
+    {
+        std::set<std::string> columns;
+        soci::rowset<soci::row> rs =
+                ( sql.prepare << "PRAGMA table_info(files)" );
+        for( auto& row : rs )
+            columns.insert( row.get<std::string>(1) );
+
+        const char* metaColumns[] = { "size", "mode", "ctime", "mtime" };
+        for( const char* column : metaColumns )
+            if( !columns.count(column) )
+                sql << "ALTER TABLE files ADD COLUMN " << column
+                    << " INTEGER";
+    }
+
     sql << "INSERT OR IGNORE INTO files (parent,node,path,subscribed) "
             " VALUES(0,'/','/',0) ";
 
@@ -136,6 +181,41 @@ void Database::init()
             // a path/peer is unique
             "PRIMARY KEY(path,peer,v_peer) ) ";
 
+    // stores the peers which have a copy of files that we aren't
+    // subscribed to, so that they can be fetched on demand
+    sql << "CREATE TABLE IF NOT EXISTS remote_files ("
+            // the file
+            "file_id    INTEGER NOT NULL, "
+            // the peer with a copy of it
+            "peer       INTEGER NOT NULL, "
+            // size of the peer's copy
+            "size       INTEGER NOT NULL, "
+            // modification time of the peer's copy
+            "mtime      INTEGER NOT NULL, "
+            // file_id,peer pairs must be unique
+            "PRIMARY KEY(file_id,peer) ) ";
+
+    // stores the version of subscribed files that each peer last told us
+    // it has, so that we know when a peer has the same copy as us
+    sql << "CREATE TABLE IF NOT EXISTS peer_versions ("
+            // the file
+            "file_id    INTEGER NOT NULL, "
+            // the peer with a copy of it
+            "peer       INTEGER NOT NULL, "
+            // the peer's version vector (in our keys), see versionKey()
+            "version    TEXT NOT NULL, "
+            // file_id,peer pairs must be unique
+            "PRIMARY KEY(file_id,peer) ) ";
+
+    // stores the content hash of the current version of a file, if we
+    // know it
+    sql << "CREATE TABLE IF NOT EXISTS content_hash ("
+            // the file it belongs to
+            "file_id    INTEGER PRIMARY KEY, "
+            // hex encoded ContentHash digest
+            "hash       TEXT NOT NULL"
+            ") ";
+
     // stores clients that we know about and assigns them a unique
     // numerical index
     sql << "CREATE TABLE IF NOT EXISTS known_clients ("
@@ -223,6 +303,54 @@ int Database::registerPeer( const std::string&  base64,
 }
 
 
+void Database::registerPeers( const std::vector<std::string>& publicKeys,
+                              const std::vector<std::string>& displayNames,
+                              std::vector<int>& ids )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    using namespace soci;
+
+    // 0 is our own id, so failures must not be left at 0
+    ids.assign( publicKeys.size(), -1 );
+
+    // create sqlite connection
+    session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        transaction tx(sql);
+
+        for( unsigned int i=0; i < publicKeys.size(); i++ )
+        {
+            const std::string& base64      = publicKeys[i];
+            const std::string& displayName = displayNames[i];
+
+            // insert the key into the database if it isn't already there
+            sql << "INSERT OR IGNORE INTO known_clients "
+                   "(client_key, client_name) "
+                   "VALUES ('"<< base64 << "','" << displayName << "')";
+
+            // now select out the id
+            sql << "SELECT client_id FROM known_clients WHERE client_key='"
+                << base64 << "'",
+                    soci::into(ids[i]);
+
+            // update the client name
+            sql << "UPDATE known_clients SET client_name='" << displayName
+                << "' WHERE client_id=" << ids[i];
+        }
+
+        tx.commit();
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database: Failed to register peers: " << ex.what()
+                  << "\n";
+        ids.assign( publicKeys.size(), -1 );
+    }
+}
+
+
 void Database::buildPeerMap( messages::IdMap* map )
 {
     pthreads::ScopedLock lock(m_mutex);
@@ -255,11 +383,13 @@ void Database::buildPeerMap( messages::IdMap* map )
 }
 
 
-void Database::addDownload( int64_t peer,
+bool Database::addDownload( int64_t peer,
                             const Path_t& path,
                             int64_t size,
                             const VersionVector& version,
-                            const Path_t& stageDir  )
+                            const Path_t& stageDir,
+                            int64_t& tx,
+                            int64_t& offset )
 {
     pthreads::ScopedLock lock(m_mutex);
 
@@ -297,14 +427,20 @@ void Database::addDownload( int64_t peer,
             for( auto& row : rs )
                 v_prev[ row.get<int>(0) ] = row.get<int>(1);
 
-            // if the current download is the not less then the requested
+            // if it is the same version that we were already downloading
+            // then we can resume from wherever we left off
+            if( v_prev == version )
+                return lockless_resumeDownload( sql, peer, path, stageDir,
+                                                    tx, offset );
+
+            // if the current download is newer then the requested
             // download there is nothing left to do
             if( v_prev >= version )
             {
                 std::cerr << "Database::addDownload ignoring download for "
                           << peer << " : "
                           << path << "because already in progress\n";
-                return;
+                return false;
             }
 
             // otherwise simply reset the bytes received, increment the
@@ -335,33 +471,29 @@ void Database::addDownload( int64_t peer,
                     ;
             }
 
-            // truncate the temporary file
+            // resize the temporary file, anything we've received is for
+            // the old version
             std::string temp;
             sql << boost::format(
-                "SELECT temp FROM downloads WHERE path='%s' AND peer=%d" )
+                "SELECT temp,tx FROM downloads WHERE path='%s' AND peer=%d" )
                 % path.string()
-                % peer, into(temp);
+                % peer, into(temp), into(tx);
 
-            truncate( (stageDir / temp).c_str(), size );
+            m_stageRanges.erase(temp);
+            m_stageHash.erase(temp);
+            FdCache::FdPtr_t fd =
+                    m_stageFds.get( (stageDir / temp).string(), O_WRONLY );
+            lockless_allocateStageFile( *fd, size );
 
-            return;
+            offset = 0;
+            return true;
         }
 
         std::cout << "Database::addDownload() : creating new download\n";
 
         // if the file is not already being downloaded
         // create a file to store the download
-        std::string tpl = ( stageDir / "XXXXXX").string();
-        int fd = mkstemp( &tpl[0] );
-        if( fd < 0 )
-        {
-            codedExcept(errno)()
-                << "Failed to create a temporary with template " << tpl;
-        }
-        ftruncate(fd,size);
-        close(fd);
-
-        std::string temp = tpl.substr(tpl.size()-6,6);
+        std::string temp = lockless_createStageFile( stageDir, size );
 
         // insert the download
         sql << boost::format(
@@ -384,6 +516,10 @@ void Database::addDownload( int64_t peer,
                     % pair.second
                 ;
         }
+
+        tx     = 0;
+        offset = 0;
+        return true;
     }
     catch( const std::exception& ex )
     {
@@ -391,13 +527,321 @@ void Database::addDownload( int64_t peer,
                   << ex.what()
                   << "\n";
     }
+
+    return false;
+}
+
+/// a canonical string for a version vector, with the zero entries left
+/// out, so that equal vectors can be compared in sql
+static std::string versionKey( const VersionVector& version )
+{
+    std::stringstream key;
+    for( auto& pair : version )
+        if( pair.second )
+            key << pair.first << ":" << pair.second << ",";
+    return key.str();
+}
+
+void Database::syncVersions( int64_t peer, std::vector<SyncEntry>& entries )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    lockless_flushVersions();
+    using namespace soci;
+
+    // create sqlite connection
+    session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        // one transaction for the whole batch, so that sqlite only syncs
+        // the journal once
+        transaction tx(sql);
+
+        for( SyncEntry& entry : entries )
+        {
+            entry.subscribed  = false;
+            entry.attrChanged = false;
+            entry.dataChanged = false;
+            entry.mine.clear();
+            entry.hash.clear();
+
+            int64_t   fileId     = 0;
+            int       subscribed = 0;
+            int64_t   size       = 0;
+            int       mode       = 0;
+            int64_t   mtime      = 0;
+            indicator sizeInd    = i_null;
+            indicator modeInd    = i_null;
+            indicator mtimeInd   = i_null;
+            sql << boost::format(
+                    "SELECT id,subscribed,size,mode,mtime FROM files "
+                    "WHERE path='%s'")
+                    % entry.path.string(),
+                    into(fileId),
+                    into(subscribed),
+                    into(size,sizeInd),
+                    into(mode,modeInd),
+                    into(mtime,mtimeInd);
+
+            if( !sql.got_data() )
+                continue;
+
+            // remember where we can get unsubscribed files from, and what
+            // they look like
+            if( !subscribed )
+            {
+                // so the caller only invalidates what the mounts may have
+                // cached wrongly
+                entry.dataChanged = sizeInd  != i_ok || size  != entry.size
+                                 || mtimeInd != i_ok || mtime != entry.mtime;
+                entry.attrChanged = entry.dataChanged
+                                 || modeInd  != i_ok || mode  != entry.mode;
+
+                sql << boost::format(
+                        "INSERT OR REPLACE INTO remote_files "
+                        "(file_id,peer,size,mtime) VALUES (%d,%d,%d,%d)" )
+                        % fileId
+                        % peer
+                        % entry.size
+                        % entry.mtime;
+                sql << boost::format(
+                        "UPDATE files SET size=%d, mode=%d, ctime=%d, "
+                        "mtime=%d WHERE id=%d" )
+                        % entry.size
+                        % entry.mode
+                        % entry.ctime
+                        % entry.mtime
+                        % fileId;
+                continue;
+            }
+            entry.subscribed = true;
+
+            // assimilate version keys so that future file changes notify
+            // connected peers
+            for( auto& pair : entry.theirs )
+            {
+                sql << boost::format(
+                        "INSERT OR IGNORE INTO version (file_id,peer,version) "
+                        "VALUES (%d,%d,%d)")
+                        % fileId
+                        % pair.first
+                        % 0;
+            }
+
+            // retrieve my version
+            rowset<row> rs = ( sql.prepare << boost::format(
+                    "SELECT peer,version FROM version WHERE file_id=%d" )
+                    % fileId );
+            for( auto& row : rs )
+                entry.mine[ row.get<int>(0) ] = row.get<int>(1);
+
+            // remember what the peer has, the cache only drops our copy
+            // once some peer has the same version
+            sql << boost::format(
+                    "INSERT OR REPLACE INTO peer_versions "
+                    "(file_id,peer,version) VALUES (%d,%d,'%s')" )
+                    % fileId
+                    % peer
+                    % versionKey( entry.theirs );
+
+            // and my content hash
+            std::string hex;
+            indicator   ind = i_null;
+            sql << boost::format(
+                    "SELECT hash FROM content_hash WHERE file_id=%d" )
+                    % fileId, into(hex,ind);
+            if( sql.got_data() && ind == i_ok )
+                entry.hash = lockless_parseHash(hex);
+        }
+
+        tx.commit();
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database::syncVersions failed: "
+                  << ex.what()
+                  << "\n";
+    }
+}
+
+void Database::getRemoteFiles( const Path_t& path,
+                               std::vector<RemoteFile>& sources )
+{
+    selectRemoteFiles( ( boost::format(
+                            "(SELECT id FROM files WHERE path='%s')" )
+                            % path.string() ).str(), sources );
+}
+
+void Database::getRemoteFiles( int64_t fileId,
+                               std::vector<RemoteFile>& sources )
+{
+    selectRemoteFiles( ( boost::format("%d") % fileId ).str(), sources );
+}
+
+void Database::selectRemoteFiles( const std::string& fileId,
+                                  std::vector<RemoteFile>& sources )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    using namespace soci;
+
+    // create sqlite connection
+    session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        // sizes may not fit in an int so fetch into 64 bit vectors, a
+        // file has at most a handful of remote sources
+        std::vector<long long> fileIds(32);
+        std::vector<long long> peers(32);
+        std::vector<long long> sizes(32);
+        std::vector<long long> mtimes(32);
+        sql << boost::format(
+                "SELECT file_id,peer,size,mtime FROM remote_files "
+                "WHERE file_id=%s" )
+                % fileId,
+                into(fileIds), into(peers), into(sizes), into(mtimes);
+
+        for( unsigned int i=0; i < fileIds.size(); i++ )
+        {
+            RemoteFile source;
+            source.fileId = fileIds[i];
+            source.peer   = peers[i];
+            source.size   = sizes[i];
+            source.mtime  = mtimes[i];
+            sources.push_back(source);
+        }
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database::getRemoteFiles(" << fileId << ") failed: "
+                  << ex.what() << "\n";
+    }
+}
+
+void Database::lockless_saveMetadata( soci::session& sql,
+                                      int64_t fileId,
+                                      const Path_t& fullpath )
+{
+    struct stat buf;
+    if( ::lstat( fullpath.c_str(), &buf ) < 0 )
+        return;
+
+    sql << boost::format(
+            "UPDATE files SET size=%d, mode=%d, ctime=%d, mtime=%d "
+            "WHERE id=%d" )
+            % buf.st_size
+            % buf.st_mode
+            % buf.st_ctime
+            % buf.st_mtime
+            % fileId;
+}
+
+std::string Database::lockless_createStageFile( const Path_t& stageDir,
+                                                int64_t size )
+{
+    std::string tpl = ( stageDir / "XXXXXX").string();
+    int fd = mkstemp( &tpl[0] );
+    if( fd < 0 )
+    {
+        codedExcept(errno)()
+            << "Failed to create a temporary with template " << tpl;
+    }
+    lockless_allocateStageFile(fd,size);
+    close(fd);
+
+    return tpl.substr(tpl.size()-6,6);
+}
+
+void Database::lockless_allocateStageFile( int fd, int64_t size )
+{
+    if( ftruncate(fd,size) < 0 )
+        codedExcept(errno)() << "Failed to resize staging file";
+
+    // not all filesystems support fallocate, in which case the file is
+    // simply sparse
+    if( size > 0 && fallocate(fd,0,0,size) < 0 )
+    {
+        std::cerr << "Database: failed to preallocate staging file: "
+                  << strerror(errno) << "\n";
+    }
+}
+
+bool Database::lockless_resumeDownload( soci::session& sql,
+                                        int64_t peer,
+                                        const Path_t& path,
+                                        const Path_t& stageDir,
+                                        int64_t& tx,
+                                        int64_t& offset )
+{
+    using namespace soci;
+
+    std::string temp;
+    int64_t     recd;
+    int64_t     size;
+
+    sql << boost::format(
+            "SELECT temp,tx,recd,size FROM downloads "
+                "WHERE path='%s' AND peer=%d" )
+            % path.string()
+            % peer,
+            into(temp),
+            into(tx),
+            into(recd),
+            into(size);
+
+    // the staging file must still be there and at least as long as the
+    // prefix we recorded. What's in it isn't checked here, a corrupt
+    // prefix is caught when the finished file doesn't match it's hash
+    // (see jobs::VerifyDownload) and the download starts over from zero.
+    Path_t fullpath = stageDir / temp;
+    struct stat fs;
+    if( ::stat( fullpath.c_str(), &fs ) < 0 )
+    {
+        std::cerr << "Database::addDownload : staging file " << fullpath
+                  << " for " << path << " is missing, restarting download\n";
+        m_stageFds.evict( fullpath.string() );
+        m_stageRanges.erase( temp );
+        m_stageHash.erase( temp );
+        temp = lockless_createStageFile( stageDir, size );
+        recd = 0;
+    }
+    else
+    {
+        if( recd > fs.st_size )
+            recd = fs.st_size;
+        if( fs.st_size != size )
+            truncate( fullpath.c_str(), size );
+    }
+
+    if( recd < 0 )
+        recd = 0;
+    if( recd > size )
+        recd = size;
+
+    // bump the transaction so that any chunks still in flight from the
+    // interrupted transfer are discarded instead of being double-counted
+    tx++;
+    sql << boost::format(
+            "UPDATE downloads SET tx=%d, temp='%s', recd=%d "
+            "WHERE path='%s' AND peer=%d" )
+            % tx
+            % temp
+            % recd
+            % path.string()
+            % peer;
+
+    std::cout << "Database::addDownload() : resuming download of " << path
+              << " from peer " << peer << " at " << recd << "/" << size
+              << " bytes, tx " << tx << "\n";
+
+    offset = recd;
+    return true;
 }
 
 
 
-void Database::mergeData( int64_t peer,
+bool Database::mergeData( int64_t peer,
                             const Path_t& stageDir,
-                            const Path_t& rootDir,
                             messages::FileChunk* chunk )
 {
     pthreads::ScopedLock lock(m_mutex);
@@ -408,8 +852,6 @@ void Database::mergeData( int64_t peer,
     // create sqlite connection
     session sql(soci::sqlite3, m_dbFile.string() );
 
-    Path_t relpath = chunk->path();
-
     // initialize the id map
     try
     {
@@ -429,113 +871,356 @@ void Database::mergeData( int64_t peer,
                 into(recd),
                 into(size);
 
-        if( tx > chunk->tx() )
+        if( tx != chunk->tx() )
         {
             std::stringstream report;
             report << "Database::mergeData : aborting merge b/c file chunk"
-                        " is from an older version\n";
-            std::cout << report;
+                        " is from transaction " << chunk->tx()
+                   << " but the current transaction is " << tx << "\n";
+            std::cout << report.str();
+            return false;
         }
 
-        Path_t fullpath = stageDir / temp;
-
-        // otherwise read in some bytes
-        int fd = open(fullpath.c_str(), O_WRONLY );
-        if( fd < 0 )
+        // a chunk which doesn't fit in the file would grow the staging
+        // file past the size we verify and rename
+        if( chunk->offset() < 0
+                || chunk->offset() + (int64_t)chunk->data().size() > size )
         {
-            codedExcept(errno)() << "Database::mergeData: Failed to open "
-                               << fullpath;
+            std::stringstream report;
+            report << "Database::mergeData : dropping chunk of "
+                   << chunk->path() << " at " << chunk->offset()
+                   << " with " << chunk->data().size()
+                   << " bytes, past the end of the file (" << size << ")\n";
+            std::cout << report.str();
+            return false;
         }
 
-        // move the read head
-        if( chunk->offset() != lseek(fd,chunk->offset(),SEEK_SET) )
+        Path_t fullpath = stageDir / temp;
+
+        // the staging file stays open for the life of the download
+        FdCache::FdPtr_t fd = m_stageFds.get( fullpath.string(), O_WRONLY );
+
+        // write the data, pwrite may return early so keep going until the
+        // whole chunk is on disk, otherwise we would record a range that
+        // we don't actually have
+        const std::string& data = chunk->data();
+        int64_t bytesWritten    = 0;
+        while( bytesWritten < (int64_t)data.size() )
         {
-            close(fd);
-            codedExcept(errno)() << "Database::mergeData: Failed to seek to offset "
-                               << chunk->offset()
-                               << " of file " << fullpath;
+            ssize_t result = pwrite( *fd,
+                                     &data[bytesWritten],
+                                     data.size() - bytesWritten,
+                                     chunk->offset() + bytesWritten );
+            if( result < 0 && errno == EINTR )
+                continue;
+            if( result < 0 )
+            {
+                codedExcept(errno)() << "Database::mergeData: Failed to "
+                                        "write to " << fullpath;
+            }
+            if( result == 0 )
+            {
+                ex()() << "Database::mergeData: short write to "
+                       << fullpath;
+            }
+            bytesWritten += result;
         }
 
-        // write the data
-        int bytesWritten = write(fd,&chunk->data()[0],chunk->data().size());
-        if( bytesWritten < 0 )
+        // the last chunk carries the hash of the whole file
+        if( chunk->has_hash() )
+            m_stageHash[temp] = chunk->hash();
+
+        // update bytes written, recd is the length of the contiguous
+        // prefix that we have on disk so that an interrupted download can
+        // be resumed from there. Anything received past a gap is
+        // remembered in memory until the gap is filled.
+        int64_t prefix   = recd;
+        bool    complete = mergeChunk( m_stageRanges[temp], prefix, size,
+                                       chunk->offset(),
+                                       chunk->offset() + bytesWritten );
+        if( prefix != recd )
         {
-            close(fd);
-            codedExcept(errno)() << "Database::mergeData: Failed to write to "
-                               << fullpath;
+            recd = prefix;
+            sql << boost::format(
+                "UPDATE downloads SET recd=%d "
+                    "WHERE path='%s' AND peer=%d" )
+                % recd
+                % chunk->path()
+                % peer;
         }
 
-        // close the file
-        close(fd);
+        // an empty file, or a resume with every byte already on disk, is
+        // completed by an empty chunk which doesn't move the prefix. The
+        // hash may follow the data (see jobs::SendFile), in which case
+        // the download isn't complete until it arrives.
+        return complete && m_stageHash.count(temp);
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database::mergeData failed: "
+                  << ex.what()
+                  << "\n";
+    }
+
+    return false;
+}
+
+bool Database::getStagedDownload( int64_t peer,
+                                  const Path_t& path,
+                                  int64_t tx,
+                                  const Path_t& stageDir,
+                                  Path_t& stagePath,
+                                  int64_t& size,
+                                  std::string& hash )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    using namespace soci;
+
+    session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        std::string temp;
+        int64_t     curTx;
+        int64_t     recd;
+
+        sql << boost::format(
+                "SELECT temp,tx,recd,size FROM downloads "
+                    "WHERE path='%s' AND peer=%d" )
+                % path.string()
+                % peer,
+                into(temp),
+                into(curTx),
+                into(recd),
+                into(size);
+
+        if( curTx != tx || recd < size )
+            return false;
+
+        stagePath = stageDir / temp;
+        hash.clear();
+        StageHash_t::iterator it = m_stageHash.find(temp);
+        if( it != m_stageHash.end() )
+            hash = it->second;
+        return true;
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database::getStagedDownload failed: "
+                  << ex.what()
+                  << "\n";
+    }
+
+    return false;
+}
+
+void Database::finishDownload( int64_t peer,
+                               const Path_t& relpath,
+                               int64_t tx,
+                               const Path_t& stageDir,
+                               const Path_t& rootDir,
+                               const std::string& hash,
+                               bool verified )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    lockless_flushVersions();
+
+    namespace fs = boost::filesystem;
+    using namespace soci;
+
+    // create sqlite connection
+    session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        std::string temp;
+        int64_t     curTx;
 
-        // update bytes written
-        recd += chunk->data().size();
         sql << boost::format(
-            "UPDATE downloads SET recd=%d "
-                "WHERE path='%s' AND peer=%d" )
-            % recd
-            % chunk->path()
-            % peer;
+                "SELECT temp,tx FROM downloads "
+                    "WHERE path='%s' AND peer=%d" )
+                % relpath.string()
+                % peer,
+                into(temp),
+                into(curTx);
 
-        if( recd >= size )
+        // the download was pre-empted while we were verifying it
+        if( curTx != tx )
+            return;
+
+        Path_t fullpath = stageDir / temp;
+
+        // if the file we assembled isn't what the peer sent then throw
+        // away what we've got, it will be requested again at the next
+        // sync
+        if( !verified )
         {
-            // check to make sure that this file is truly newer
-            VersionVector v_mine;
-            lockless_getVersion( relpath, v_mine );
+            std::cerr << "Database::finishDownload : " << relpath
+                      << " from peer " << peer << " failed verification, "
+                         "discarding\n";
 
-            // perform the version query
-            rowset<row> rs = ( sql.prepare << boost::format(
-                    "SELECT v_peer,v_version FROM downloads_v "
-                    " WHERE path='%s' AND peer=%d" )
-                    % relpath.string()
-                    % peer );
+            m_stageRanges.erase( temp );
+            m_stageHash.erase( temp );
+            sql << boost::format(
+                "UPDATE downloads SET tx=tx+1, recd=0 "
+                    "WHERE path='%s' AND peer=%d" )
+                % relpath.string()
+                % peer;
+            return;
+        }
 
-            std::cout << "Database::mergeData : building version vector\n";
+        // check to make sure that this file is truly newer
+        VersionVector v_mine;
+        lockless_getVersion( relpath, v_mine );
 
-            // build the version vector
-            VersionVector v_theirs;
-            for( auto& row : rs )
-                v_theirs[ row.get<int>(0) ] = row.get<int>(1);
+        // perform the version query
+        rowset<row> rs = ( sql.prepare << boost::format(
+                "SELECT v_peer,v_version FROM downloads_v "
+                " WHERE path='%s' AND peer=%d" )
+                % relpath.string()
+                % peer );
 
-            std::cout << "Database::mergeData : version built\n";
+        std::cout << "Database::finishDownload : building version vector\n";
+
+        // build the version vector
+        VersionVector v_theirs;
+        for( auto& row : rs )
+            v_theirs[ row.get<int>(0) ] = row.get<int>(1);
 
-            // if it is truely newer, move the file and delete the
-            // download
-            if( v_mine < v_theirs )
+        std::cout << "Database::finishDownload : version built\n";
+
+        // if it is truely newer, move the file and delete the
+        // download
+        if( v_mine < v_theirs )
+        {
+            // make sure the data is on disk before the file appears
+            // in the tree
+            FdCache::FdPtr_t fd = m_stageFds.get( fullpath.string(), O_WRONLY );
+            if( fdatasync(*fd) < 0 )
             {
-                int result = rename( (stageDir/temp).c_str(),
-                                        (rootDir/relpath).c_str() );
-                if( result < 0 )
-                {
-                    codedExcept(errno)() << "Database::mergeData : "
-                            "Failed to rename " << (stageDir/temp)
-                            << " -> " << (rootDir/relpath);
-                }
-
-                // update the version vector
-                lockless_setVersion( relpath, v_theirs );
-
-                // delete the download if it is complete
-                sql << boost::format(
-                    "DELETE FROM downloads WHERE path='%s' AND peer=%d" )
-                    % chunk->path()
-                    % peer;
+                codedExcept(errno)() << "Database::finishDownload : "
+                        "Failed to sync " << fullpath;
+            }
+            m_stageFds.evict( fullpath.string() );
+            m_stageRanges.erase( temp );
+            m_stageHash.erase( temp );
 
-                sql << boost::format(
-                    "DELETE FROM downloads_v WHERE path='%s' AND peer=%d" )
-                    % chunk->path()
-                    % peer;
+            int result = rename( (stageDir/temp).c_str(),
+                                    (rootDir/relpath).c_str() );
+            if( result < 0 )
+            {
+                codedExcept(errno)() << "Database::finishDownload : "
+                        "Failed to rename " << (stageDir/temp)
+                        << " -> " << (rootDir/relpath);
             }
+
+            // update the version vector, and remember the hash of the
+            // new version
+            lockless_setVersion( relpath, v_theirs );
+            lockless_setContentHash( sql, relpath, hash );
+
+            // delete the download if it is complete
+            sql << boost::format(
+                "DELETE FROM downloads WHERE path='%s' AND peer=%d" )
+                % relpath.string()
+                % peer;
+
+            sql << boost::format(
+                "DELETE FROM downloads_v WHERE path='%s' AND peer=%d" )
+                % relpath.string()
+                % peer;
         }
     }
     catch( const std::exception& ex )
     {
-        std::cerr << "Database::mergeData failed: "
+        std::cerr << "Database::finishDownload failed: "
                   << ex.what()
                   << "\n";
     }
 }
 
+void Database::lockless_setContentHash( soci::session& sql,
+                                        const Path_t& path,
+                                        const std::string& hash )
+{
+    int64_t fileId;
+    sql << boost::format("SELECT id FROM files WHERE path='%s'")
+            % path.string(), soci::into(fileId);
+
+    if( hash.empty() )
+        sql << boost::format("DELETE FROM content_hash WHERE file_id=%d")
+                % fileId;
+    else
+        sql << boost::format(
+                "INSERT OR REPLACE INTO content_hash (file_id,hash) "
+                "VALUES (%d,'%s')" )
+                % fileId
+                % ContentHash::toHex(hash);
+}
+
+std::string Database::lockless_parseHash( const std::string& hex )
+{
+    if( hex.size() != 2*ContentHash::DIGEST_SIZE )
+        return std::string();
+
+    std::string hash( ContentHash::DIGEST_SIZE, '\0' );
+    for( int i=0; i < ContentHash::DIGEST_SIZE; i++ )
+        hash[i] = strtol( hex.substr(2*i,2).c_str(), 0, 16 );
+    return hash;
+}
+
+std::string Database::getContentHash( const Path_t& path )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    lockless_flushVersions();
+    soci::session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        std::string hex;
+        soci::indicator ind = soci::i_null;
+        sql << boost::format(
+                "SELECT hash FROM content_hash WHERE file_id="
+                    "(SELECT id FROM files WHERE path='%s')" )
+                % path.string(), soci::into(hex,ind);
+
+        if( !sql.got_data() || ind != soci::i_ok )
+            return std::string();
+
+        return lockless_parseHash(hex);
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database::getContentHash('" << path << "') failed: "
+                  << ex.what() << "\n";
+    }
+
+    return std::string();
+}
+
+void Database::setContentHash( const Path_t& path,
+                               const std::string& hash,
+                               uint64_t gen )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    lockless_flushVersions();
+
+    // the file changed since the hash was computed
+    if( generation(path) != gen )
+        return;
+
+    soci::session sql(soci::sqlite3, m_dbFile.string() );
+    try
+    {
+        lockless_setContentHash( sql, path, hash );
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database::setContentHash('" << path << "') failed: "
+                  << ex.what() << "\n";
+    }
+}
+
 
 
 void Database::lockless_mknod( const Path_t& path )
@@ -594,6 +1279,8 @@ void Database::lockless_unlink( const Path_t& path )
 {
     namespace fs = boost::filesystem;
 
+    touch(path);
+
     // create sqlite connection
     soci::session sql(soci::sqlite3, m_dbFile.string() );
 
@@ -608,6 +1295,10 @@ void Database::lockless_unlink( const Path_t& path )
                 % fileId;
         sql << boost::format("DELETE FROM version WHERE file_id=%d")
                 % fileId;
+        sql << boost::format("DELETE FROM content_hash WHERE file_id=%d")
+                % fileId;
+        sql << boost::format("DELETE FROM peer_versions WHERE file_id=%d")
+                % fileId;
     }
     catch( const std::exception& ex )
     {
@@ -628,6 +1319,8 @@ void Database::lockless_readdir( const Path_t& path,
 
     try
     {
+        setReaderTimeout(sql);
+
         // get the fileId
         int64_t fileId;
         sql << boost::format("SELECT id FROM files WHERE path='%s'")
@@ -764,12 +1457,16 @@ void Database::lockless_merge( messages::DirChunk* msg )
         for(int i=0; i < msg->entries_size(); i++)
         {
             const messages::DirEntry& entry = msg->entries(i);
+
+            // until a peer sends NodeInfo for it we only know the type
             sql << boost::format(
-                "INSERT OR IGNORE INTO files (parent,node,path,subscribed) "
-                "VALUES(%d,'%s','%s',0) " )
+                "INSERT OR IGNORE INTO files "
+                "(parent,node,path,subscribed,mode) "
+                "VALUES(%d,'%s','%s',0,%d) " )
                 % parentId
                 % entry.path()
-                % (parentPath / entry.path()).string();
+                % (parentPath / entry.path()).string()
+                % toMode( entry.type(), 0 );
         }
     }
     catch( const std::exception& ex )
@@ -781,30 +1478,57 @@ void Database::lockless_merge( messages::DirChunk* msg )
     }
 }
 
-void Database::lockless_incrementVersion( const Path_t& path )
+void Database::lockless_incrementVersion( soci::session& sql,
+                                          const Path_t& path )
 {
-    namespace fs = boost::filesystem;
-    using namespace soci;
+    int64_t fileId = 0;
+    sql << boost::format("SELECT id FROM files WHERE path='%s'")
+            % path.string(), soci::into(fileId);
+
+    // it may have been removed since it was modified
+    if( !sql.got_data() )
+        return;
+
+    sql << boost::format(
+        "UPDATE version SET version=version+1 "
+        "WHERE file_id=%d AND peer=0" ) % fileId;
+
+    // the contents have changed so we no longer know the hash
+    sql << boost::format("DELETE FROM content_hash WHERE file_id=%d")
+            % fileId;
+}
+
+void Database::lockless_flushVersions()
+{
+    PathSet_t dirty;
+    {
+        pthreads::ScopedLock lock(m_dirtyMutex);
+        dirty.swap(m_dirty);
+    }
+
+    if( dirty.empty() )
+        return;
 
     // create sqlite connection
-    session sql(soci::sqlite3, m_dbFile.string() );
+    soci::session sql(soci::sqlite3, m_dbFile.string() );
 
     try
     {
-        int64_t fileId;
-        sql << boost::format("SELECT id FROM files WHERE path='%s'")
-                % path.string(), soci::into(fileId);
-
-        sql << boost::format(
-            "UPDATE version SET version=version+1 "
-            "WHERE file_id=%d AND peer=0" ) % fileId;
+        soci::transaction tx(sql);
+        for( auto& path : dirty )
+            lockless_incrementVersion( sql, path );
+        tx.commit();
     }
     catch( const std::exception& ex )
     {
         std::stringstream report;
-        report << "Database::incrementVersion('" << path << "') failed:\n"
-               << ex.what() << "\n";
+        report << "Database::flushVersions(" << dirty.size()
+               << " files) failed:\n" << ex.what() << "\n";
         std::cerr << report.str();
+
+        // try again on the next flush
+        pthreads::ScopedLock lock(m_dirtyMutex);
+        m_dirty.insert( dirty.begin(), dirty.end() );
     }
 }
 
@@ -844,6 +1568,8 @@ void Database::lockless_setVersion( const Path_t& path, const VersionVector& v )
     namespace fs = boost::filesystem;
     using namespace soci;
 
+    touch(path);
+
     // create sqlite connection
     session sql(soci::sqlite3, m_dbFile.string() );
 
@@ -915,16 +1641,77 @@ void Database::mknod( const Path_t& path )
 void Database::unlink( const Path_t& path )
 {
     pthreads::ScopedLock lock(m_mutex);
+    lockless_flushVersions();
     lockless_unlink(path);
 }
 
 void Database::readdir( const Path_t& path,
                 void *buf, fuse_fill_dir_t filler, off_t offset )
 {
-    pthreads::ScopedLock lock(m_mutex);
+    // read only, so it doesn't need m_mutex (see setReaderTimeout())
     lockless_readdir(path,buf,filler,offset);
 }
 
+void Database::readdir( int64_t dirId,
+                void *ctx, ListFiller_t filler, off_t offset )
+{
+    using namespace soci;
+
+    // create sqlite connection
+    session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        setReaderTimeout(sql);
+
+        // sizes may not fit in an int, so rather than a rowset of rows
+        // (which are typed by the column declaration) we fetch into 64 bit
+        // values one row at a time
+        ListEntry entry;
+        int       subscribed = 0;
+        int64_t   size  = 0;
+        int       mode  = 0;
+        int64_t   ctime = 0;
+        int64_t   mtime = 0;
+        indicator sizeInd, modeInd, ctimeInd, mtimeInd;
+
+        statement st = ( sql.prepare << boost::format(
+                "SELECT id,node,subscribed,size,mode,ctime,mtime "
+                "FROM files WHERE parent=%d "
+                "ORDER BY node LIMIT -1 OFFSET %d" )
+                % dirId
+                % offset,
+                into(entry.id),
+                into(entry.name),
+                into(subscribed),
+                into(size,sizeInd),
+                into(mode,modeInd),
+                into(ctime,ctimeInd),
+                into(mtime,mtimeInd) );
+        st.execute();
+
+        while( st.fetch() )
+        {
+            // columns that no peer has filled in yet are null
+            entry.meta.subscribed = subscribed;
+            entry.meta.size       = sizeInd  == i_ok ? size  : 0;
+            entry.meta.mode       = modeInd  == i_ok ? mode  : 0;
+            entry.meta.ctime      = ctimeInd == i_ok ? ctime : 0;
+            entry.meta.mtime      = mtimeInd == i_ok ? mtime : 0;
+
+            if( filler(ctx,entry,++offset) )
+                return;
+        }
+    }
+    catch( const std::exception& ex )
+    {
+        std::stringstream report;
+        report << "Database::readdir(" << dirId << ", fuse) failed:\n"
+               << ex.what() << "\n";
+        std::cerr << report.str();
+    }
+}
+
 void Database::readdir( const Path_t& path,
                 messages::DirChunk* msg )
 {
@@ -947,20 +1734,32 @@ void Database::merge( messages::DirChunk* msg )
 }
 
 void Database::incrementVersion( const Path_t& path )
+{
+    // anything polling the generation needs to know about the change now,
+    // the version can wait
+    touch(path);
+
+    pthreads::ScopedLock lock(m_dirtyMutex);
+    m_dirty.insert( path.string() );
+}
+
+void Database::flushVersions()
 {
     pthreads::ScopedLock lock(m_mutex);
-    lockless_incrementVersion(path);
+    lockless_flushVersions();
 }
 
 void Database::getVersion( const Path_t& path, VersionVector& v )
 {
     pthreads::ScopedLock lock(m_mutex);
+    lockless_flushVersions();
     lockless_getVersion(path,v);
 }
 
 void Database::setVersion( const Path_t& path, const VersionVector& v )
 {
     pthreads::ScopedLock lock(m_mutex);
+    lockless_flushVersions();
     lockless_setVersion(path,v);
 }
 
@@ -972,8 +1771,6 @@ void Database::assimilateKeys( const Path_t& path, const VersionVector& v)
 
 bool Database::isSubscribed( const Path_t& path )
 {
-    pthreads::ScopedLock lock(m_mutex);
-
     namespace fs = boost::filesystem;
     using namespace soci;
 
@@ -982,6 +1779,8 @@ bool Database::isSubscribed( const Path_t& path )
 
     try
     {
+        setReaderTimeout(sql);
+
         int subscribed;
         sql << boost::format("SELECT subscribed FROM files WHERE path='%s'")
                 % path.string(), soci::into(subscribed);
@@ -1000,6 +1799,141 @@ bool Database::isSubscribed( const Path_t& path )
     return false;
 }
 
+int64_t Database::getFileId( const Path_t& path )
+{
+    // create sqlite connection
+    soci::session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        setReaderTimeout(sql);
+
+        int64_t fileId = -1;
+        sql << boost::format("SELECT id FROM files WHERE path='%s'")
+                % path.string(), soci::into(fileId);
+        return fileId;
+    }
+    catch( const std::exception& ex )
+    {
+        std::stringstream report;
+        report << "Database::getFileId('" << path << "') failed:\n"
+               << ex.what() << "\n";
+        std::cerr << report.str();
+    }
+
+    return -1;
+}
+
+int64_t Database::getChildId( int64_t parentId, const std::string& name )
+{
+    // create sqlite connection
+    soci::session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        setReaderTimeout(sql);
+
+        int64_t fileId = -1;
+        sql << boost::format(
+                "SELECT id FROM files WHERE parent=%d AND node='%s'")
+                % parentId
+                % name,
+                soci::into(fileId);
+        return fileId;
+    }
+    catch( const std::exception& ex )
+    {
+        std::stringstream report;
+        report << "Database::getChildId(" << parentId << ",'" << name
+               << "') failed:\n" << ex.what() << "\n";
+        std::cerr << report.str();
+    }
+
+    return -1;
+}
+
+bool Database::getMetadata( const Path_t& path, Metadata& meta )
+{
+    return selectMetadata( ( boost::format("path='%s'")
+                                % path.string() ).str(), meta );
+}
+
+bool Database::getMetadata( int64_t fileId, Metadata& meta )
+{
+    return selectMetadata( ( boost::format("id=%d") % fileId ).str(), meta );
+}
+
+bool Database::selectMetadata( const std::string& where, Metadata& meta )
+{
+    using namespace soci;
+
+    // create sqlite connection
+    session sql(soci::sqlite3, m_dbFile.string() );
+
+    try
+    {
+        setReaderTimeout(sql);
+
+        int       subscribed = 0;
+        int64_t   size  = 0;
+        int       mode  = 0;
+        int64_t   ctime = 0;
+        int64_t   mtime = 0;
+        indicator sizeInd, modeInd, ctimeInd, mtimeInd;
+        sql << boost::format(
+                "SELECT subscribed,size,mode,ctime,mtime FROM files "
+                "WHERE %s")
+                % where,
+                into(subscribed),
+                into(size,sizeInd),
+                into(mode,modeInd),
+                into(ctime,ctimeInd),
+                into(mtime,mtimeInd);
+
+        if( !sql.got_data() )
+            return false;
+
+        // columns that no peer has filled in yet are null
+        meta.subscribed = subscribed;
+        meta.size       = sizeInd  == i_ok ? size  : 0;
+        meta.mode       = modeInd  == i_ok ? mode  : 0;
+        meta.ctime      = ctimeInd == i_ok ? ctime : 0;
+        meta.mtime      = mtimeInd == i_ok ? mtime : 0;
+        return true;
+    }
+    catch( const std::exception& ex )
+    {
+        std::stringstream report;
+        report << "Database::getMetadata(" << where << ") failed:\n"
+               << ex.what() << "\n";
+        std::cerr << report.str();
+    }
+
+    return false;
+}
+
+int Database::toMode( messages::NodeType type, int perms )
+{
+    int mode = perms & ~S_IFMT;
+    switch( type )
+    {
+        case messages::DIRECTORY:
+            return mode | S_IFDIR;
+
+        case messages::SIMLINK:
+            return mode | S_IFLNK;
+
+        case messages::PIPE:
+            return mode | S_IFIFO;
+
+        case messages::SOCKET:
+            return mode | S_IFSOCK;
+
+        default:
+            return mode | S_IFREG;
+    }
+}
+
 void Database::checkout( const Path_t& rootDir, const Path_t& path )
 {
     std::stringstream report;
@@ -1058,6 +1992,8 @@ void Database::release( const Path_t& rootDir, const Path_t& path )
     report << "Database::release('" << path << "') \n";
     std::cout << report.str();
 
+    touch(path);
+
     pthreads::ScopedLock lock(m_mutex);
     namespace fs = boost::filesystem;
 
@@ -1079,10 +2015,13 @@ void Database::release( const Path_t& rootDir, const Path_t& path )
         // set the file as subscribed
         sql << boost::format("UPDATE files SET subscribed=0 WHERE id=%d")
                 % fileId;
+        lockless_saveMetadata( sql, fileId, rootDir / path );
 
         // delete version vector
         sql << boost::format(
                 "DELETE FROM version WHERE file_id=%d" ) % fileId;
+        sql << boost::format(
+                "DELETE FROM content_hash WHERE file_id=%d" ) % fileId;
 
         // delete the file
         Path_t fullpath = rootDir / path;
@@ -1103,6 +2042,190 @@ void Database::release( const Path_t& rootDir, const Path_t& path )
     }
 }
 
+void Database::release( const Path_t& rootDir,
+                        const std::vector<Path_t>& paths,
+                        std::vector<Path_t>& released )
+{
+    std::cout << "Database::release(" << paths.size() << " files)\n";
+
+    for( auto& path : paths )
+        touch(path);
+
+    pthreads::ScopedLock lock(m_mutex);
+
+    // the files may have been modified since the cache decided they
+    // could go, and the version increase may not be applied yet
+    lockless_flushVersions();
+
+    // create sqlite connection
+    soci::session sql(soci::sqlite3, m_dbFile.string() );
+
+    size_t first = released.size();
+    try
+    {
+        soci::transaction tx(sql);
+
+        for( auto& path : paths )
+        {
+            int fileId     = 0;
+            int subscribed = 0;
+            int evictable  = 0;
+            sql << boost::format(
+                    "SELECT f.id, f.subscribed, "
+                        "IFNULL(v.version,0)=0 "
+                        "AND NOT EXISTS "
+                            "(SELECT 1 FROM downloads d WHERE d.path=f.path) "
+                        "AND NOT EXISTS "
+                            "(SELECT 1 FROM conflicts c WHERE c.path=f.path) "
+                    "FROM files f LEFT JOIN version v "
+                        "ON v.file_id=f.id AND v.peer=0 "
+                    "WHERE f.path='%s'")
+                    % path.string(),
+                    soci::into(fileId),
+                    soci::into(subscribed),
+                    soci::into(evictable);
+
+            if( !subscribed || !evictable )
+                continue;
+
+            // our copy may be the only one of this version
+            VersionVector mine;
+            soci::rowset<soci::row> rs = ( sql.prepare << boost::format(
+                    "SELECT peer,version FROM version WHERE file_id=%d" )
+                    % fileId );
+            for( auto& row : rs )
+                mine[ row.get<int>(0) ] = row.get<int>(1);
+
+            int copies = 0;
+            sql << boost::format(
+                    "SELECT COUNT(*) FROM peer_versions "
+                    "WHERE file_id=%d AND version='%s'" )
+                    % fileId
+                    % versionKey(mine),
+                    soci::into(copies);
+            if( !copies )
+            {
+                std::cout << "Database::release: keeping " << path
+                          << ", no peer has been seen with our version\n";
+                continue;
+            }
+
+            sql << boost::format("UPDATE files SET subscribed=0 WHERE id=%d")
+                    % fileId;
+            lockless_saveMetadata( sql, fileId, rootDir / path );
+            sql << boost::format(
+                    "DELETE FROM version WHERE file_id=%d" ) % fileId;
+            sql << boost::format(
+                    "DELETE FROM content_hash WHERE file_id=%d" ) % fileId;
+            sql << boost::format(
+                    "DELETE FROM peer_versions WHERE file_id=%d" ) % fileId;
+            released.push_back(path);
+        }
+
+        tx.commit();
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database::release(" << paths.size()
+                  << " files) failed:\n" << ex.what() << "\n";
+
+        // the transaction was rolled back
+        released.resize(first);
+        return;
+    }
+
+    // the files are only deleted once the database no longer refers to
+    // them
+    for( size_t i = first; i < released.size(); i++ )
+    {
+        const Path_t& path = released[i];
+        Path_t fullpath = rootDir / path;
+        if( ::unlink( fullpath.c_str() ) < 0 )
+            std::cerr << "Database::release: failed to unlink "
+                      << fullpath << ", errno " << errno << "\n";
+    }
+}
+
+void Database::getCacheEntries( std::vector<CacheEntry>& entries )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    lockless_flushVersions();
+
+    // create sqlite connection
+    soci::session sql(soci::sqlite3, m_dbFile.string() );
+    typedef soci::rowset<soci::row>    rowset;
+
+    try
+    {
+        rowset rs = ( sql.prepare <<
+                "SELECT f.path, "
+                    "IFNULL(v.version,0)=0 "
+                    "AND NOT EXISTS "
+                        "(SELECT 1 FROM downloads d WHERE d.path=f.path) "
+                    "AND NOT EXISTS "
+                        "(SELECT 1 FROM conflicts c WHERE c.path=f.path) "
+                "FROM files f LEFT JOIN version v "
+                    "ON v.file_id=f.id AND v.peer=0 "
+                "WHERE f.subscribed=1" );
+        for( auto& row : rs )
+        {
+            CacheEntry entry;
+            entry.path      = row.get<std::string>(0);
+            entry.evictable = row.get<int>(1) != 0;
+            entries.push_back(entry);
+        }
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "Database::getCacheEntries() failed: "
+                  << ex.what() << "\n";
+    }
+}
+
+uint64_t Database::watch( const Path_t& path )
+{
+    pthreads::ScopedLock lock(m_genMutex);
+    GenMap_t::iterator it = m_generation.find( path.string() );
+    if( it == m_generation.end() )
+    {
+        Generation entry;
+        entry.gen      = m_genCounter;
+        entry.watchers = 0;
+        it = m_generation.insert(
+                GenMap_t::value_type( path.string(), entry ) ).first;
+    }
+
+    it->second.watchers++;
+    return it->second.gen;
+}
+
+void Database::unwatch( const Path_t& path )
+{
+    pthreads::ScopedLock lock(m_genMutex);
+    GenMap_t::iterator it = m_generation.find( path.string() );
+    if( it != m_generation.end() && --it->second.watchers < 1 )
+        m_generation.erase(it);
+}
+
+uint64_t Database::generation( const Path_t& path )
+{
+    pthreads::ScopedLock lock(m_genMutex);
+    GenMap_t::iterator it = m_generation.find( path.string() );
+    if( it == m_generation.end() )
+        return 0;
+    return it->second.gen;
+}
+
+void Database::touch( const Path_t& path )
+{
+    pthreads::ScopedLock lock(m_genMutex);
+
+    // nobody is watching the path so there is nothing to record
+    GenMap_t::iterator it = m_generation.find( path.string() );
+    if( it != m_generation.end() )
+        it->second.gen = ++m_genCounter;
+}
+
 
 } //< namespace filesystem
 } //< namespace openbook
@@ -10,18 +10,23 @@
 #define OPENBOOK_FS_DATABASE_H_
 
 #include <map>
+#include <set>
 #include <string>
 #include <list>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <cpp-pthreads.h>
 
 #include "fuse_include.h"
 #include "messages.pb.h"
+#include "ByteRanges.h"
+#include "FdCache.h"
 #include "Synchronized.h"
 #include "VersionVector.h"
 
 
+namespace soci { class session; }
 
 namespace   openbook {
 namespace filesystem {
@@ -35,10 +40,168 @@ class Database
         typedef std::map<std::string,int>   USIdMap_t;
         typedef Synchronized<USIdMap_t>     IdMap_t;
 
+        /// change generation of a path that somebody is watching
+        struct Generation
+        {
+            uint64_t    gen;        ///< generation of the last change
+            int         watchers;   ///< number of watch() calls pending
+        };
+
+        typedef std::map<std::string,Generation> GenMap_t;
+        typedef std::set<std::string>            PathSet_t;
+
+        /// one file in a batched version comparison
+        struct SyncEntry
+        {
+            Path_t          path;       ///< [in] the file
+            VersionVector   theirs;     ///< [in] peer's version (our keys)
+            int64_t         size;       ///< [in] size of the peer's file
+            int             mode;       ///< [in] peer's st_mode
+            int64_t         ctime;      ///< [in] peer's change time
+            int64_t         mtime;      ///< [in] peer's modification time
+            bool            subscribed; ///< [out] if we are subscribed
+            bool            attrChanged;///< [out] unsubscribed, and the
+                                        ///  size, mode or mtime changed
+            bool            dataChanged;///< [out] unsubscribed, and the
+                                        ///  size or mtime changed
+            VersionVector   mine;       ///< [out] our version
+            std::string     hash;       ///< [out] our content hash, if known
+        };
+
+        typedef std::map<std::string,RangeMap_t> StageRanges_t;
+        typedef std::map<std::string,std::string> StageHash_t;
+
+        /// a peer that has a copy of a file
+        struct RemoteFile
+        {
+            int64_t     fileId; ///< our id for the file
+            int64_t     peer;   ///< the peer with a copy
+            int64_t     size;   ///< size of the peer's copy
+            int64_t     mtime;  ///< modification time of the peer's copy
+        };
+
+        /// what we know about a file from the files table. For files that
+        /// we aren't subscribed to the stat fields are those of the last
+        /// copy that a peer told us about (or of our own copy when it was
+        /// released)
+        struct Metadata
+        {
+            bool        subscribed; ///< we have a local copy
+            int64_t     size;       ///< size in bytes
+            int         mode;       ///< st_mode, zero if unknown
+            int64_t     ctime;      ///< change time
+            int64_t     mtime;      ///< modification time
+        };
+
+        /// one entry of a directory listing
+        struct ListEntry
+        {
+            int64_t     id;     ///< id of the entry in the files table
+            std::string name;   ///< name of the entry in it's directory
+            Metadata    meta;   ///< what we know about the entry
+        };
+
+        /// receives the entries of a directory listing, returns non-zero
+        /// when it doesn't want any more
+        typedef int (*ListFiller_t)( void* ctx, const ListEntry& entry,
+                                     off_t offset );
+
+        /// a subscribed file, for cache eviction
+        struct CacheEntry
+        {
+            Path_t      path;       ///< the file
+            bool        evictable;  ///< it is fully synced and unmodified
+        };
+
+        /// how long a reader waits on a locked database before failing
+        static const int BUSY_TIMEOUT_MS;
+
     private:
         Path_t          m_dbFile;
+
+        /// serializes writers. Queries which only read (the ones that fuse
+        /// calls on every operation) don't take it, they rely on sqlite's
+        /// own locking instead, see setReaderTimeout()
         pthreads::Mutex m_mutex;
 
+        pthreads::Mutex m_genMutex;     ///< locks the generation map
+        GenMap_t        m_generation;   ///< change generation of paths
+        uint64_t        m_genCounter;   ///< last generation handed out
+
+        pthreads::Mutex m_dirtyMutex;   ///< locks the dirty set
+        PathSet_t       m_dirty;        ///< paths whose version needs to
+                                        ///  be bumped by flushVersions()
+
+        /// open staging files for in-progress downloads
+        FdCache         m_stageFds;
+
+        /// for each staging file, the ranges that have been received past
+        /// the contiguous prefix that is stored in the database (i.e.
+        /// chunks that arrived out of order)
+        StageRanges_t   m_stageRanges;
+
+        /// for each staging file, the content hash that the sender
+        /// reported
+        StageHash_t     m_stageHash;
+
+        /// create an empty staging file of the requested size and return
+        /// its name relative to the staging directory
+        std::string lockless_createStageFile( const Path_t& stageDir,
+                                                int64_t size );
+
+        /// set the size of a staging file and allocate it's blocks so
+        /// that the download is written contiguously
+        void lockless_allocateStageFile( int fd, int64_t size );
+
+        /// prepare a connection for a read-only query made without
+        /// holding m_mutex, so that it waits out a concurrent writer
+        /// rather than failing. Unlike the lockless_ methods the caller
+        /// doesn't (and shouldn't) hold m_mutex.
+        static void setReaderTimeout( soci::session& sql );
+
+        /// getMetadata() of the files matching the sql condition @p where
+        bool selectMetadata( const std::string& where, Metadata& meta );
+
+        /// getRemoteFiles() of the file whose id is the sql expression
+        /// @p fileId
+        void selectRemoteFiles( const std::string& fileId,
+                                std::vector<RemoteFile>& sources );
+
+        /// record the stat of a local file as the metadata of it's entry
+        /// so that it can still be reported after the file is released
+        void lockless_saveMetadata( soci::session& sql,
+                                    int64_t fileId,
+                                    const Path_t& fullpath );
+
+        /// increase the version vector for entry 0 (this peer) and forget
+        /// the content hash
+        void lockless_incrementVersion( soci::session& sql,
+                                        const Path_t& path );
+
+        /// bump the versions of all of the dirty paths in one transaction,
+        /// must be called with m_mutex held before anything which reads
+        /// versions or content hashes
+        void lockless_flushVersions();
+
+        /// decode a hex encoded content hash from the database
+        std::string lockless_parseHash( const std::string& hex );
+
+        /// store (or clear if empty) the content hash of a file
+        void lockless_setContentHash( soci::session& sql,
+                                      const Path_t& path,
+                                      const std::string& hash );
+
+        /// reset an existing download to resume from the last contiguous
+        /// byte recorded, as long as it's staging file is still there. The
+        /// bytes themselves aren't checked until the whole file is
+        /// verified against it's hash.
+        bool lockless_resumeDownload( soci::session& sql,
+                                        int64_t peer,
+                                        const Path_t& path,
+                                        const Path_t& stageDir,
+                                        int64_t& tx,
+                                        int64_t& offset );
+
     public:
         Database( );
 
@@ -58,23 +221,86 @@ class Database
         int registerPeer( const std::string& publicKey,
                           const std::string& displayName );
 
+        /// register many peers at once in a single transaction, @p ids
+        /// is filled with the peerId of each key, or -1 if it couldn't be
+        /// registered
+        void registerPeers( const std::vector<std::string>& publicKeys,
+                            const std::vector<std::string>& displayNames,
+                            std::vector<int>& ids );
+
         /// fill a peer map message
         void buildPeerMap( messages::IdMap* map );
 
         /// adds the requested path for download or pre-empts a current
-        /// download if a newer version is to be retrieved
-        void addDownload( int64_t peer,
+        /// download if a newer version is to be retrieved. If a download
+        /// of the same version is already in the database the download is
+        /// resumed from the partial staging file.
+        /// @return true if data should be requested from the peer, in which
+        ///         case @p tx and @p offset are filled with the transaction
+        ///         id and the byte offset to request from
+        bool addDownload( int64_t peer,
                             const Path_t& path,
                             int64_t size,
                             const VersionVector& version,
-                            const Path_t& stageDir );
-
-        /// merge a file chunk into a staging file
-        void mergeData( int64_t peer,
+                            const Path_t& stageDir,
+                            int64_t& tx,
+                            int64_t& offset );
+
+        /// for each entry assimilate the peer's version keys and retrieve
+        /// our own version and content hash, all in one transaction. For
+        /// files we are not subscribed to the peer is recorded as a
+        /// remote source of the file.
+        void syncVersions( int64_t peer, std::vector<SyncEntry>& entries );
+
+        /// get the peers that have a copy of an unsubscribed file
+        void getRemoteFiles( const Path_t& path,
+                             std::vector<RemoteFile>& sources );
+
+        /// get the peers that have a copy of an unsubscribed file by it's
+        /// id in the files table
+        void getRemoteFiles( int64_t fileId,
+                             std::vector<RemoteFile>& sources );
+
+        /// merge a file chunk into a staging file, returns true if this
+        /// chunk completed the download, in which case it should be
+        /// verified and then finished with finishDownload()
+        bool mergeData( int64_t peer,
                         const Path_t& stageDir,
-                        const Path_t& rootDir,
                         messages::FileChunk* chunk );
 
+        /// retrieve the staging file of a completed download and the
+        /// content hash that the sender reported for it (empty if the
+        /// sender didn't send one), returns false if the download isn't
+        /// complete or is no longer transaction @p tx
+        bool getStagedDownload( int64_t peer,
+                                const Path_t& path,
+                                int64_t tx,
+                                const Path_t& stageDir,
+                                Path_t& stagePath,
+                                int64_t& size,
+                                std::string& hash );
+
+        /// move a completed download into the tree if it is newer than
+        /// what we have. If it failed verification it is discarded
+        /// instead.
+        void finishDownload( int64_t peer,
+                             const Path_t& path,
+                             int64_t tx,
+                             const Path_t& stageDir,
+                             const Path_t& rootDir,
+                             const std::string& hash,
+                             bool verified );
+
+        /// return the content hash of the current version of a file, or
+        /// an empty string if we don't know it
+        std::string getContentHash( const Path_t& path );
+
+        /// store the content hash of the current version of a file, but
+        /// only if the file's change generation is still @p gen
+        void setContentHash( const Path_t& path,
+                             const std::string& hash,
+                             uint64_t gen );
+
         /// add an entry to the file list for
         void lockless_mknod( const Path_t& path );
 
@@ -97,9 +323,6 @@ class Database
         /// merge entries from another peer
         void lockless_merge( messages::DirChunk* msg );
 
-        /// increase the version vector for entry 0 (this peer)
-        void lockless_incrementVersion( const Path_t& path );
-
         /// get the version for a path
         void lockless_getVersion( const Path_t& path, VersionVector& v );
 
@@ -121,6 +344,11 @@ class Database
         void readdir( const Path_t& path,
                         void *buf, fuse_fill_dir_t filler, off_t offset );
 
+        /// read entries of the directory with id @p dirId along with
+        /// their metadata, in a single query
+        void readdir( int64_t dirId,
+                        void *ctx, ListFiller_t filler, off_t offset );
+
         /// read directory entries into a message
         void readdir( const Path_t& path,
                         messages::DirChunk* msg );
@@ -133,9 +361,15 @@ class Database
         /// merge entries from another peer
         void merge( messages::DirChunk* msg );
 
-        /// increase the version vector for entry 0 (this peer)
+        /// mark the file as modified, the version vector entry for this
+        /// peer is increased by the next flushVersions(). Anything that
+        /// reads the version flushes first, so it is never stale.
         void incrementVersion( const Path_t& path );
 
+        /// apply the version increases of all files modified since the
+        /// last flush, in a single transaction
+        void flushVersions();
+
         /// get the version for a path
         void getVersion( const Path_t& path, VersionVector& v );
 
@@ -148,10 +382,87 @@ class Database
 
         bool isSubscribed( const Path_t& path );
 
+        /// return the id of a path in the files table, or -1 if we don't
+        /// know about it
+        int64_t getFileId( const Path_t& path );
+
+        /// return the id of the entry @p name in the directory with id
+        /// @p parentId, or -1 if we don't know about it
+        int64_t getChildId( int64_t parentId, const std::string& name );
+
+        /// retrieve the metadata of a path, returns false if we don't
+        /// know about it
+        bool getMetadata( const Path_t& path, Metadata& meta );
+
+        /// retrieve the metadata of a file by it's id in the files table,
+        /// returns false if we don't know about it
+        bool getMetadata( int64_t fileId, Metadata& meta );
+
+        /// the st_mode of a node of type @p type with permissions
+        /// @p perms
+        static int toMode( messages::NodeType type, int perms );
+
+        /// start watching a path and return it's change generation,
+        /// which is an in-memory counter that is changed whenever the
+        /// contents or version of the file change. It is much cheaper
+        /// than getVersion() for polling whether a file has changed.
+        /// Generations are only tracked for watched paths, so every call
+        /// must be paired with unwatch()
+        uint64_t watch( const Path_t& path );
+
+        /// stop watching a path, when the last watcher is gone the path's
+        /// generation is forgotten
+        void unwatch( const Path_t& path );
+
+        /// return the change generation of a watched path
+        uint64_t generation( const Path_t& path );
+
+        /// watches a path for the lifetime of the object
+        class GenerationWatch
+        {
+            private:
+                Database&   m_db;
+                Path_t      m_path;
+                uint64_t    m_gen;
+
+            public:
+                GenerationWatch( Database& db, const Path_t& path ):
+                    m_db(db),
+                    m_path(path),
+                    m_gen(db.watch(path))
+                {}
+
+                ~GenerationWatch(){ m_db.unwatch(m_path); }
+
+                /// the generation when the watch started
+                uint64_t gen() const { return m_gen; }
+
+                /// true if the path has changed since the watch started
+                bool changed() const
+                    { return m_db.generation(m_path) != m_gen; }
+        };
+
+        /// signal that the contents of a file have changed
+        void touch( const Path_t& path );
+
         void checkout( const Path_t& rootDir, const Path_t& path );
 
         void release( const Path_t& rootDir, const Path_t& path );
 
+        /// release many files at once, in a single transaction. Files
+        /// which have changed since they were chosen, or of which no peer
+        /// has been seen with the same version, are kept. The files
+        /// which were released are appended to @p released.
+        void release( const Path_t& rootDir,
+                      const std::vector<Path_t>& paths,
+                      std::vector<Path_t>& released );
+
+        /// list all subscribed files. A file is evictable if we have never
+        /// modified it (our own version key is zero), and it has no
+        /// download or conflict pending, so that it's contents can be
+        /// retrieved from a peer.
+        void getCacheEntries( std::vector<CacheEntry>& entries );
+
 
 };
 
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/FdCache.cpp
+ *
+ *  @brief  
+ */
+
+#include <cerrno>
+#include <fcntl.h>
+
+#include "FdCache.h"
+#include "ExceptionStream.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+FdCache::FdCache( unsigned int capacity ):
+    m_capacity(capacity)
+{
+    m_mutex.init();
+}
+
+FdCache::~FdCache()
+{
+    m_mutex.destroy();
+}
+
+FdCache::FdPtr_t FdCache::get( const std::string& path, int flags )
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    // if it's already open then move it to the front of the line
+    EntryMap_t::iterator it = m_entries.find(path);
+    if( it != m_entries.end() )
+    {
+        m_lru.splice( m_lru.begin(), m_lru, it->second.lru );
+        return it->second.fd;
+    }
+
+    int fd = ::open( path.c_str(), flags );
+    if( fd < 0 )
+        codedExcept(errno)() << "FdCache: failed to open " << path;
+
+    // make room
+    while( m_entries.size() >= m_capacity && !m_lru.empty() )
+    {
+        m_entries.erase( m_lru.back() );
+        m_lru.pop_back();
+    }
+
+    m_lru.push_front(path);
+    Entry& entry = m_entries[path];
+    entry.fd  = FileDescriptor::create(fd);
+    entry.lru = m_lru.begin();
+
+    return entry.fd;
+}
+
+void FdCache::evict( const std::string& path )
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    EntryMap_t::iterator it = m_entries.find(path);
+    if( it == m_entries.end() )
+        return;
+
+    m_lru.erase( it->second.lru );
+    m_entries.erase( it );
+}
+
+void FdCache::clear()
+{
+    pthreads::ScopedLock lock(m_mutex);
+    m_entries.clear();
+    m_lru.clear();
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
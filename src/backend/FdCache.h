@@ -0,0 +1,90 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/FdCache.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_FDCACHE_H_
+#define OPENBOOK_FS_FDCACHE_H_
+
+#include <list>
+#include <map>
+#include <string>
+#include <cpp-pthreads.h>
+
+#include "FileDescriptor.h"
+#include "ReferenceCounted.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+/// a bounded cache of open file descriptors, keyed by path
+/**
+ *  Used to keep files open across many small operations (i.e. writing
+ *  file chunks into a staging file) without holding an unbounded number
+ *  of descriptors. When the cache is full the least recently used
+ *  descriptor is dropped. Since descriptors are reference counted a
+ *  descriptor which is evicted while in use is closed when the last user
+ *  releases it.
+ */
+class FdCache
+{
+    public:
+        typedef RefPtr<FileDescriptor>      FdPtr_t;
+
+    private:
+        typedef std::list<std::string>      LruList_t;
+
+        struct Entry
+        {
+            FdPtr_t             fd;
+            LruList_t::iterator lru;
+        };
+
+        typedef std::map<std::string,Entry> EntryMap_t;
+
+        pthreads::Mutex m_mutex;
+        unsigned int    m_capacity; ///< max number of open descriptors
+        EntryMap_t      m_entries;  ///< open descriptors
+        LruList_t       m_lru;      ///< paths, most recently used first
+
+    public:
+        FdCache( unsigned int capacity=32 );
+        ~FdCache();
+
+        /// return the cached descriptor for @p path, or open it with
+        /// @p flags if it isn't cached
+        FdPtr_t get( const std::string& path, int flags );
+
+        /// drop the descriptor for @p path from the cache
+        void evict( const std::string& path );
+
+        /// drop all descriptors
+        void clear();
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // FDCACHE_H_
@@ -36,7 +36,8 @@ FileContext::FileContext( Backend* backend, const Path_t& path, int fd ):
     m_backend(backend),
     m_path(path),
     m_fd(fd),
-    m_changed(false)
+    m_changed(false),
+    m_atime(time(0))
 {
 
 }
@@ -49,6 +50,16 @@ FileContext::~FileContext()
         m_backend->db().incrementVersion(m_path);
 }
 
+void FileContext::mark()
+{
+    // the version isn't bumped until close, but anything reading the file
+    // for a transfer needs to know that it's changing now. This is done on
+    // every write and not just the first, since a watch may have started
+    // after the first write through this handle.
+    m_changed = true;
+    m_backend->db().touch(m_path);
+}
+
 RefPtr<FileContext> FileContext::create( Backend* backend, const Path_t& path, int fd )
 {
     return new FileContext(backend,path,fd);
@@ -56,63 +67,187 @@ RefPtr<FileContext> FileContext::create( Backend* backend, const Path_t& path, i
 
 
 
-FileMap::FileMap( Backend* backend, int size )
+const int FileMap::SEGMENT_BITS;
+const int FileMap::MAX_SEGMENTS;
+
+FileMap::FileMap( Backend* backend ):
+    m_backend(backend),
+    m_used(0),
+    m_free(0)
 {
-    m_backend = backend;
-    m_mutex.init();
-    m_fileVec.resize(size,0);
-    m_freeStore.reserve(size);
+    m_growMutex.init();
+    for(int i=0; i < MAX_SEGMENTS; i++)
+        m_segments[i].store(0);
 
-    for(int i=0; i < size; i++)
-        m_freeStore.push_back(i);
+    // most mounts never need more than the first segment
+    allocSlot(0);
 }
 
 FileMap::~FileMap()
 {
+    for(int i=0; i < MAX_SEGMENTS; i++)
+    {
+        Slot* segment = m_segments[i].load();
+        if( !segment )
+            continue;
+
+        uint32_t size = (1u << SEGMENT_BITS) << i;
+        for(uint32_t j=0; j < size; j++)
+        {
+            FileContext* file = segment[j].file.load();
+            if( file && file->dereference() )
+                delete file;
+        }
+        delete [] segment;
+    }
 
+    m_growMutex.destroy();
 }
 
-RefPtr<FileContext> FileMap::operator[](int i)
+FileMap::Slot* FileMap::slot( uint32_t idx )
 {
-    pthreads::ScopedLock lock( m_mutex );
-
-    if( i < 0 || i >= m_fileVec.size() )
-        return (FileContext*)0;
-    return m_fileVec[i];
+    // segment k holds indices [ (2^k - 1) << SEGMENT_BITS,
+    //                           (2^(k+1) - 1) << SEGMENT_BITS )
+    uint32_t v   = (idx >> SEGMENT_BITS) + 1;
+    int      seg = 31 - __builtin_clz(v);
+    if( seg >= MAX_SEGMENTS )
+        return 0;
+
+    Slot* segment = m_segments[seg].load(std::memory_order_acquire);
+    if( !segment )
+        return 0;
+
+    return segment + ( idx - (((1u << seg) - 1) << SEGMENT_BITS) );
 }
 
-int FileMap::registerFile( const Path_t& path, int os_fd )
+FileMap::Slot* FileMap::allocSlot( uint32_t idx )
 {
-    pthreads::ScopedLock lock( m_mutex );
+    Slot* s = slot(idx);
+    if( s )
+        return s;
 
-    if( m_freeStore.size() < 1 )
+    uint32_t v   = (idx >> SEGMENT_BITS) + 1;
+    int      seg = 31 - __builtin_clz(v);
+    if( seg >= MAX_SEGMENTS )
         ex()() << "No available file descriptors";
 
-    int fd = m_freeStore.back();
-    m_freeStore.pop_back();
-
-    try
     {
-        m_fileVec[fd] = FileContext::create(m_backend,path,os_fd);
+        pthreads::ScopedLock lock( m_growMutex );
+        if( !m_segments[seg].load(std::memory_order_relaxed) )
+        {
+            uint32_t size    = (1u << SEGMENT_BITS) << seg;
+            Slot*    segment = new Slot[size];
+            for(uint32_t i=0; i < size; i++)
+            {
+                segment[i].gen.store(0,std::memory_order_relaxed);
+                segment[i].file.store(0,std::memory_order_relaxed);
+                segment[i].next.store(0,std::memory_order_relaxed);
+            }
+            m_segments[seg].store(segment,std::memory_order_release);
+        }
     }
-    catch( const std::exception& ex )
+
+    return slot(idx);
+}
+
+bool FileMap::pop( uint32_t& idx )
+{
+    uint64_t head = m_free.load(std::memory_order_acquire);
+    while( uint32_t(head) )
     {
-        m_freeStore.push_back(fd);
-        throw;
+        Slot*    s    = slot( uint32_t(head) - 1 );
+        uint64_t next = ( ((head >> 32) + 1) << 32 )
+                        | s->next.load(std::memory_order_acquire);
+        if( m_free.compare_exchange_weak( head, next,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_acquire ) )
+        {
+            idx = uint32_t(head) - 1;
+            return true;
+        }
     }
-
-    return fd;
+    return false;
 }
 
-void FileMap::unregisterFile( int fd )
+void FileMap::push( uint32_t idx )
 {
-    pthreads::ScopedLock lock( m_mutex );
+    Slot*    s    = slot(idx);
+    uint64_t head = m_free.load(std::memory_order_acquire);
+    uint64_t next;
+    do
+    {
+        s->next.store( uint32_t(head), std::memory_order_release );
+        next = ( ((head >> 32) + 1) << 32 ) | (idx + 1);
+    } while( !m_free.compare_exchange_weak( head, next,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire ) );
+}
 
-    m_fileVec[fd].clear();
-    m_freeStore.push_back(fd);
+FileMap::FilePtr_t FileMap::operator[]( Handle_t handle )
+{
+    uint32_t idx = uint32_t(handle);
+    uint32_t gen = uint32_t(handle >> 32);
+    if( !(gen & 1) )
+        return FilePtr_t();
+
+    Slot* s = slot(idx);
+    if( !s || s->gen.load(std::memory_order_acquire) != gen )
+        return FilePtr_t();
+
+    // fuse doesn't release a handle while other requests on it are in
+    // flight, so the table's reference can't be dropped underneath us
+    // here. The second check catches a handle that is being released
+    // anyway.
+    FilePtr_t file( s->file.load(std::memory_order_acquire) );
+    if( s->gen.load(std::memory_order_acquire) != gen )
+        return FilePtr_t();
+
+    return file;
 }
 
+FileMap::Handle_t FileMap::registerFile( const Path_t& path, int os_fd )
+{
+    uint32_t idx;
+    if( !pop(idx) )
+        idx = m_used.fetch_add(1);
+    Slot* s = allocSlot(idx);
+
+    // the slot holds it's own reference
+    FilePtr_t file = FileContext::create(m_backend,path,os_fd);
+    file->reference();
+    s->file.store(file.subvert(),std::memory_order_release);
+
+    uint32_t gen = s->gen.load(std::memory_order_relaxed) + 1;
+    s->gen.store(gen,std::memory_order_release);
+
+    return ( Handle_t(gen) << 32 ) | idx;
+}
 
+void FileMap::unregisterFile( Handle_t handle )
+{
+    uint32_t idx = uint32_t(handle);
+    uint32_t gen = uint32_t(handle >> 32);
+    if( !(gen & 1) )
+        return;
+
+    Slot* s = slot(idx);
+    if( !s )
+        return;
+
+    // only one caller can free a handle
+    uint32_t expected = gen;
+    if( !s->gen.compare_exchange_strong( expected, gen+1,
+                                          std::memory_order_acq_rel ) )
+        return;
+
+    FilePtr_t file( s->file.exchange(0,std::memory_order_acq_rel) );
+    if( file )
+        file->dereference();
+    push(idx);
+
+    // if this was the last reference then the file is closed here, as
+    // file goes out of scope
+}
 
 
 
@@ -27,7 +27,9 @@
 #ifndef OPENBOOK_FS_FILECONTEXT_H_
 #define OPENBOOK_FS_FILECONTEXT_H_
 
-#include <vector>
+#include <atomic>
+#include <ctime>
+#include <stdint.h>
 #include <boost/filesystem.hpp>
 #include <cpp-pthreads.h>
 
@@ -50,7 +52,14 @@ class FileContext:
         Backend*    m_backend;
         Path_t      m_path;
         int         m_fd;       ///< os file descriptor
-        bool        m_changed;  ///< set to true if there is a write
+
+        /// set to true if there is a write, writes may come from several
+        /// fuse threads at once
+        std::atomic<bool>   m_changed;
+
+        /// time of the last read or write through the handle, reported to
+        /// the cache manager when the file is closed
+        std::atomic<int64_t>    m_atime;
 
         /// create a file context for file-descriptor based operations
         FileContext( Backend* backend, const Path_t& path, int fd );
@@ -59,43 +68,104 @@ class FileContext:
         /// closes the file, increments parent directory meta data if changed
         ~FileContext();
         int       fd()  { return m_fd; }
-        void      mark(){ m_changed = true; }
+
+        /// the path of the file in the database
+        const Path_t& path() const { return m_path; }
+
+        /// mark the file as changed, the version is incremented when the
+        /// file is closed
+        void      mark();
+
+        /// record a read or write through the handle
+        void      access() { m_atime.store( time(0),
+                                            std::memory_order_relaxed ); }
+
+        /// time of the last read or write through the handle
+        int64_t   atime() const { return m_atime; }
 
         static RefPtr<FileContext> create( Backend* backend, const Path_t& path, int fd );
 };
 
-/// maps file descriptors to FileContext structures
+/// maps file handles to FileContext structures
 /**
- *  note these file descriptors are not OS file descriptors, but are specific
+ *  note these file handles are not OS file descriptors, but are specific
  *  to the openbook filesystem
+ *
+ *  Slots are stored in segments which double in size, segments are only
+ *  ever added, so a slot never moves once it exists and lookup is wait
+ *  free: it doesn't take a lock or retry. Each slot carries a generation
+ *  which is odd while the slot is in use and incremented when it is
+ *  freed. A handle is the generation in the high 32 bits and the slot
+ *  index in the low 32 bits, so a handle that has already been released
+ *  (or that was never issued) is detected rather than aliasing whichever
+ *  file now occupies the slot. Since live generations are odd a handle is
+ *  never 0, which fuse operations use to mean that there is no open file.
+ *
+ *  Free slots are kept on a lock free stack. The only lock is taken when a
+ *  new segment is allocated.
  */
 class FileMap
 {
     public:
         typedef boost::filesystem::path     Path_t;
         typedef RefPtr<FileContext>         FilePtr_t;
-        typedef std::vector<FilePtr_t>      FileVec_t;
-        typedef std::vector<int>            IdxVec_t;
+        typedef uint64_t                    Handle_t;
+
+        /// the first segment has 2^SEGMENT_BITS slots
+        static const int SEGMENT_BITS = 6;
+
+        /// maximum number of segments, there is room for about 10^9 open
+        /// files
+        static const int MAX_SEGMENTS = 24;
 
     private:
-        Backend*        m_backend;
-        pthreads::Mutex m_mutex;
-        FileVec_t       m_fileVec;      ///< pointers to allocated FileContexts
-        IdxVec_t        m_freeStore;    ///< list of unused file descriptors
+        struct Slot
+        {
+            std::atomic<uint32_t>       gen;    ///< odd if in use
+            std::atomic<FileContext*>   file;   ///< holds one reference
+            std::atomic<uint32_t>       next;   ///< next free index + 1
+        };
+
+        Backend*                m_backend;
+        pthreads::Mutex         m_growMutex;    ///< locks segment allocation
+        std::atomic<Slot*>      m_segments[MAX_SEGMENTS];
+
+        /// number of slots that have ever been used, slots past this have
+        /// never been handed out
+        std::atomic<uint32_t>   m_used;
+
+        /// top of the free stack, the low 32 bits are the index + 1 (zero
+        /// if the stack is empty) and the high 32 bits count pops, so that
+        /// a stale compare-and-swap fails
+        std::atomic<uint64_t>   m_free;
+
+        /// return the slot at @p idx, or 0 if it's segment hasn't been
+        /// allocated
+        Slot* slot( uint32_t idx );
+
+        /// return the slot at @p idx, allocating it's segment if needed
+        Slot* allocSlot( uint32_t idx );
+
+        /// take a free slot, returns false if there are none
+        bool pop( uint32_t& idx );
+
+        /// return a slot to the free stack
+        void push( uint32_t idx );
 
     public:
-        FileMap( Backend* backend, int size = 100 );
+        FileMap( Backend* backend );
         ~FileMap();
 
-        /// retrieve a FileContext from it's file descriptor
-        FilePtr_t operator[](int i);
+        /// retrieve a FileContext from it's handle, returns an empty
+        /// pointer if the handle isn't open
+        FilePtr_t operator[]( Handle_t handle );
 
         /// create a new FileContext for an opened file and return the
-        /// file descriptor
-        int registerFile( const Path_t& path, int os_fd );
+        /// handle
+        Handle_t registerFile( const Path_t& path, int os_fd );
 
-        /// unreference a FileContext and free the file descriptor
-        void unregisterFile( int fd );
+        /// unreference a FileContext and free the handle
+        void unregisterFile( Handle_t handle );
 
 };
 
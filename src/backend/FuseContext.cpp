@@ -26,10 +26,13 @@
 
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <dirent.h>
 #include <sys/time.h>
@@ -50,8 +53,72 @@
 namespace   openbook {
 namespace filesystem {
 
+/// fill @p out with the attributes of a file that only peers have
+static void remoteStat( const Database::Metadata& meta, struct stat* out )
+{
+    // if we only know the type of the node then it is readable by us
+    int mode = meta.mode ? meta.mode : S_IFREG;
+    if( !(mode & ~S_IFMT) )
+        mode |= S_ISDIR(mode) ? S_IRWXU : (S_IRUSR | S_IWUSR);
+
+    memset( out, 0, sizeof(struct stat) );
+    out->st_mode  = mode;
+    out->st_nlink = 1;
+    out->st_uid   = getuid();
+    out->st_gid   = getgid();
+    out->st_size  = meta.size;
+    out->st_atime = meta.mtime;
+    out->st_mtime = meta.mtime;
+    out->st_ctime = meta.ctime;
+}
+
+/// state of a FuseContext::readdirPlus() listing
+struct ListContext
+{
+    Backend*            backend;
+    FuseContext::Path_t dbDir;  ///< the directory, relative to the root
+    int                 dirfd;  ///< the backing directory, if it exists
+    void*               buf;
+    fuse_fill_dir_t     filler;
+};
+
+/// Database::ListFiller_t which stats each entry and forwards it to fuse
+static int fillPlus( void* vp_ctx, const Database::ListEntry& entry,
+                        off_t offset )
+{
+    ListContext* ctx = static_cast<ListContext*>(vp_ctx);
+    FuseContext::Path_t dbPath = ctx->dbDir / entry.name;
+
+    struct stat st;
+    bool known = true;
+    if( !entry.meta.subscribed )
+        remoteStat( entry.meta, &st );
+    else if( ctx->dirfd < 0 || ::fstatat( ctx->dirfd, entry.name.c_str(),
+                                        &st, AT_SYMLINK_NOFOLLOW ) < 0 )
+        known = false;
+
+    if( known )
+        ctx->backend->attrCache().put( dbPath, st );
+    else
+    {
+        // let getattr() work out what happened to it
+        memset( &st, 0, sizeof(st) );
+    }
+
+    st.st_ino = entry.id;
+    return ctx->filler( ctx->buf, entry.name.c_str(), &st, offset );
+}
+
 
 
+void FuseContext::invalidate( const char* path, bool parent )
+{
+    Path_t dbPath = toDbPath(path);
+    m_backend->attrCache().invalidate( dbPath );
+    if( parent )
+        m_backend->attrCache().invalidate( dbPath.parent_path() );
+}
+
 int FuseContext::result_or_errno(int result)
 {
     if(result < 0)
@@ -70,6 +137,31 @@ FuseContext::FuseContext(Backend* backend, const std::string& relpath):
         m_realRoot = backend->realRoot() / relpath;
     else
         m_realRoot = backend->realRoot();
+
+    // "/" / "/foo" is "//foo" so the database root is kept as a string
+    // that a fuse path can be appended to
+    m_dbRoot = relpath;
+    while( !m_dbRoot.empty() && m_dbRoot[m_dbRoot.size()-1] == '/' )
+        m_dbRoot.erase( m_dbRoot.size()-1 );
+    if( !m_dbRoot.empty() && m_dbRoot[0] != '/' )
+        m_dbRoot.insert( 0, "/" );
+}
+
+FuseContext::Path_t FuseContext::toDbPath( const char* path ) const
+{
+    // the root of the mount is the root directory of m_dbRoot, which is
+    // stored as "/" if it is the root of the whole tree
+    std::string dbPath = m_dbRoot;
+    if( path[0] && std::strcmp( path, "/" ) != 0 )
+    {
+        if( path[0] != '/' )
+            dbPath += '/';
+        dbPath += path;
+    }
+
+    if( dbPath.empty() )
+        dbPath = "/";
+    return Path_t( dbPath );
 }
 
 
@@ -79,6 +171,11 @@ FuseContext::~FuseContext()
 {
 }
 
+FuseStats& FuseContext::stats()
+{
+    return m_backend->fuseStats();
+}
+
 
 
 
@@ -101,6 +198,7 @@ int FuseContext::mknod (const char *path, mode_t mode, dev_t dev)
 
     // create the local version of the file
     int result = ::mknod( wrapped.c_str(), mode, 0 );
+    invalidate( path, true );
     if( result )
         return -errno;
 
@@ -109,7 +207,7 @@ int FuseContext::mknod (const char *path, mode_t mode, dev_t dev)
     {
         mode_t modeMask = 0777;
         mode_t typeMask = ~modeMask;
-        m_backend->db().mknod( Path_t(path) );
+        m_backend->db().mknod( toDbPath(path) );
     }
     catch( const std::exception& ex )
     {
@@ -143,23 +241,24 @@ int FuseContext::create (const char *path,
 
     // create the local version of the file
     int result = ::creat( wrapped.c_str(), mode );
+    invalidate( path, true );
     if( result < 0 )
         return -errno;
 
     // create a file descriptor for the opened file
     int os_fd = result;
-    int my_fd = -1;
+    uint64_t my_fd = 0;
     try
     {
         // add an entry to the directory listing
-        m_backend->db().mknod( Path_t(path) );
+        m_backend->db().mknod( toDbPath(path) );
 
-        my_fd   = m_openedFiles.registerFile( Path_t(path) ,os_fd);
+        my_fd   = m_openedFiles.registerFile( toDbPath(path) ,os_fd);
         result  = 0;
     }
     catch( const std::exception& ex )
     {
-        my_fd   = -1;
+        my_fd   = 0;
         result  = -EIO;
         ::close(os_fd);
 
@@ -178,6 +277,68 @@ int FuseContext::create (const char *path,
 
 
 int FuseContext::open (const char *path, struct fuse_file_info *fi)
+{
+    // pin the file so that the cache manager doesn't release it while it
+    // is open, it is unpinned in release()
+    m_backend->cache().pin( toDbPath(path) );
+
+    int result = openPinned( path, fi );
+    if( result < 0 )
+        m_backend->cache().unpin( toDbPath(path) );
+    return result;
+}
+
+int FuseContext::open (const char *path,
+                        int64_t fileId,
+                        struct fuse_file_info *fi)
+{
+    Path_t dbPath = toDbPath(path);
+    m_backend->cache().pin( dbPath );
+
+    Path_t wrapped = m_realRoot / path;
+    int os_fd  = ::open( wrapped.c_str(), fi->flags );
+    int result = 0;
+    if( os_fd < 0 )
+    {
+        // without a local copy reads are served from a peer's, if one has
+        // told us about the file, and there is nothing to write to
+        Database::Metadata meta;
+        int64_t size, mtime;
+        if( errno != ENOENT )
+            result = -errno;
+        else if( !m_backend->db().getMetadata( fileId, meta )
+                || meta.subscribed
+                || !m_backend->fetcher().stat( fileId, size, mtime ) )
+            result = -ENOENT;
+        else if( (fi->flags & O_ACCMODE) != O_RDONLY )
+            result = -EROFS;
+    }
+
+    if( result >= 0 )
+    {
+        try
+        {
+            fi->fh = m_openedFiles.registerFile( dbPath, os_fd );
+            return 0;
+        }
+        catch( const std::exception& ex )
+        {
+            result = -ENOMEM;
+            if( os_fd >= 0 )
+                ::close(os_fd);
+
+            std::cerr << "FuseContext::open"
+                      << "\n path: " << path
+                      << "\n real: " << wrapped
+                      << "\n  err: " << ex.what();
+        }
+    }
+
+    m_backend->cache().unpin( dbPath );
+    return result;
+}
+
+int FuseContext::openPinned (const char *path, struct fuse_file_info *fi)
 {
     namespace fs = boost::filesystem;
     Path_t wrapped = m_realRoot / path;
@@ -189,6 +350,32 @@ int FuseContext::open (const char *path, struct fuse_file_info *fi)
     if( !fs::exists(parent) )
       return -ENOENT;
 
+    // if the file is unsubscribed but a peer has a copy then reads are
+    // served from that copy, and there is no local file to write to
+    if( !fs::exists(wrapped)
+            && !m_backend->db().isSubscribed( toDbPath(path) ) )
+    {
+        int64_t size, mtime;
+        if( m_backend->fetcher().stat( toDbPath(path), size, mtime ) )
+        {
+            if( (fi->flags & O_ACCMODE) != O_RDONLY )
+                return -EROFS;
+
+            try
+            {
+                fi->fh = m_openedFiles.registerFile( toDbPath(path), -1 );
+                return 0;
+            }
+            catch( const std::exception& ex )
+            {
+                std::cerr << "FuseContext::open"
+                          << "\n path: " << path
+                          << "\n  err: " << ex.what();
+                return -ENOMEM;
+            }
+        }
+    }
+
     // make sure that the file exists, if it doesn't exist check for the
     // O_CREAT flag
     if( !fs::exists(wrapped) )
@@ -206,15 +393,15 @@ int FuseContext::open (const char *path, struct fuse_file_info *fi)
 
     // create a file descriptor for the opened file
     int os_fd = result;
-    int my_fd = -1;
+    uint64_t my_fd = 0;
     try
     {
-        my_fd   = m_openedFiles.registerFile( Path_t(path) ,os_fd);
+        my_fd   = m_openedFiles.registerFile( toDbPath(path) ,os_fd);
         result  = 0;
     }
     catch( const std::exception& ex )
     {
-        my_fd   = -1;
+        my_fd   = 0;
         result  = -ENOMEM;
         ::close(os_fd);
 
@@ -238,15 +425,20 @@ int FuseContext::read (const char *path,
                         off_t offset,
                         struct fuse_file_info *fi)
 {
-    namespace fs = boost::filesystem;
-    Path_t wrapped = (m_realRoot / path);
-
-    // if fi has a file handle then we simply read from the file handle
+    // if fi has a file handle then we simply read from the file handle,
+    // which knows it's own path so @p path isn't needed
     if( fi->fh )
     {
         RefPtr<FileContext> file = m_openedFiles[fi->fh];
         if(file)
         {
+            file->access();
+
+            // files without a local copy are fetched from a peer
+            if( file->fd() < 0 )
+                return m_backend->fetcher().read(
+                                    file->path(), buf, bufsize, offset );
+
             int result = ::pread(file->fd(),buf,bufsize,offset);
             if( result < 0 )
                 return -errno;
@@ -259,7 +451,10 @@ int FuseContext::read (const char *path,
     // otherwise we open the file and perform the read
     else
     {
+        m_backend->cache().touch( toDbPath(path) );
+
         // open the local version of the file
+        Path_t wrapped = m_realRoot / path;
         int result = ::open( wrapped.c_str(), O_RDONLY );
         if( result < 0 )
             return -errno;
@@ -299,12 +494,14 @@ int FuseContext::write (const char *path,
         RefPtr<FileContext> file = m_openedFiles[fi->fh];
         if(file)
         {
+            file->access();
             int result = ::pwrite(file->fd(),buf,bufsize,offset);
             if( result < 0 )
                 return -errno;
             else
             {
                 file->mark();
+                invalidate( path );
                 return result;
             }
         }
@@ -313,6 +510,8 @@ int FuseContext::write (const char *path,
     }
     else
     {
+        m_backend->cache().touch( toDbPath(path) );
+
         // otherwise open the file
         int result = ::open( wrapped.c_str(), O_WRONLY );
         if( result < 0 )
@@ -326,16 +525,188 @@ int FuseContext::write (const char *path,
 
         // close the file
         ::close(fh);
+        invalidate( path );
 
         // check for error
         if( result < 0 )
             return -errno;
 
         // increment the version
-        m_backend->db().incrementVersion( Path_t(path) );
+        m_backend->db().incrementVersion( toDbPath(path) );
+
+        return result;
+    }
+}
+
+
+
+
+#if FUSE_VERSION >= 29
+int FuseContext::read_buf (const char *path,
+                        struct fuse_bufvec **bufp,
+                        size_t bufsize,
+                        off_t offset,
+                        struct fuse_file_info *fi)
+{
+    struct fuse_bufvec* bufv =
+            static_cast<fuse_bufvec*>( ::malloc(sizeof(fuse_bufvec)) );
+    if( !bufv )
+        return -ENOMEM;
+
+    bufv->count     = 1;
+    bufv->idx       = 0;
+    bufv->off       = 0;
+    bufv->buf[0].size   = bufsize;
+    bufv->buf[0].flags  = static_cast<fuse_buf_flags>(0);
+    bufv->buf[0].mem    = 0;
+    bufv->buf[0].fd     = -1;
+    bufv->buf[0].pos    = 0;
+
+    // if there is a local copy behind the handle then hand fuse the
+    // descriptor and let it splice the data into the reply
+    if( fi->fh )
+    {
+        RefPtr<FileContext> file = m_openedFiles[fi->fh];
+        if( !file )
+        {
+            ::free(bufv);
+            return -EBADF;
+        }
+
+        if( file->fd() >= 0 )
+        {
+            // fuse replies with no more than what's left of the file, so
+            // that is the size of the buffer, and what's counted as read
+            struct stat fileStat;
+            if( ::fstat( file->fd(), &fileStat ) < 0 )
+            {
+                int err = errno;
+                ::free(bufv);
+                return -err;
+            }
+            int64_t left = std::max( (int64_t)fileStat.st_size - offset,
+                                     (int64_t)0 );
+
+            file->access();
+            bufv->buf[0].size   = std::min( (int64_t)bufsize, left );
+            bufv->buf[0].flags  = static_cast<fuse_buf_flags>(
+                                    FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK );
+            bufv->buf[0].fd     = file->fd();
+            bufv->buf[0].pos    = offset;
+            *bufp = bufv;
+            return 0;
+        }
+    }
+
+    // otherwise the data is fetched into memory by read()
+    void* mem = ::malloc(bufsize);
+    if( !mem )
+    {
+        ::free(bufv);
+        return -ENOMEM;
+    }
 
+    int result = this->read( path, static_cast<char*>(mem),
+                             bufsize, offset, fi );
+    if( result < 0 )
+    {
+        ::free(mem);
+        ::free(bufv);
         return result;
     }
+
+    bufv->buf[0].mem    = mem;
+    bufv->buf[0].size   = result;
+    *bufp = bufv;
+    return 0;
+}
+
+
+
+int FuseContext::write_buf (const char *path,
+                        struct fuse_bufvec *buf,
+                        off_t offset,
+                        struct fuse_file_info *fi)
+{
+    size_t bufsize = fuse_buf_size(buf);
+
+    if( fi->fh )
+    {
+        RefPtr<FileContext> file = m_openedFiles[fi->fh];
+        if( !file )
+            return -EBADF;
+
+        // splice (or copy) straight from the request into the backing file
+        if( file->fd() >= 0 )
+        {
+            file->access();
+
+            struct fuse_bufvec dst;
+            dst.count   = 1;
+            dst.idx     = 0;
+            dst.off     = 0;
+            dst.buf[0].size     = bufsize;
+            dst.buf[0].flags    = static_cast<fuse_buf_flags>(
+                                    FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK );
+            dst.buf[0].mem      = 0;
+            dst.buf[0].fd       = file->fd();
+            dst.buf[0].pos      = offset;
+
+            ssize_t result = fuse_buf_copy( &dst, buf,
+                                            FUSE_BUF_SPLICE_NONBLOCK );
+            if( result < 0 )
+                return result;
+
+            file->mark();
+            invalidate( path );
+            return result;
+        }
+    }
+
+    // otherwise gather the data into memory and write() it
+    std::vector<char> mem(bufsize);
+
+    struct fuse_bufvec dst;
+    dst.count   = 1;
+    dst.idx     = 0;
+    dst.off     = 0;
+    dst.buf[0].size     = bufsize;
+    dst.buf[0].flags    = static_cast<fuse_buf_flags>(0);
+    dst.buf[0].mem      = mem.empty() ? 0 : &mem[0];
+    dst.buf[0].fd       = -1;
+    dst.buf[0].pos      = 0;
+
+    ssize_t copied = fuse_buf_copy( &dst, buf,
+                                    static_cast<fuse_buf_copy_flags>(0) );
+    if( copied < 0 )
+        return copied;
+
+    return this->write( path, mem.data(), copied, offset, fi );
+}
+#endif
+
+
+
+
+void FuseContext::init (struct fuse_conn_info *conn)
+{
+#ifdef FUSE_CAP_SPLICE_READ
+    conn->want |= conn->capable & FUSE_CAP_SPLICE_READ;
+#endif
+#ifdef FUSE_CAP_SPLICE_WRITE
+    conn->want |= conn->capable & FUSE_CAP_SPLICE_WRITE;
+#endif
+#ifdef FUSE_CAP_SPLICE_MOVE
+    conn->want |= conn->capable & FUSE_CAP_SPLICE_MOVE;
+#endif
+#ifdef FUSE_CAP_BIG_WRITES
+    conn->want |= conn->capable & FUSE_CAP_BIG_WRITES;
+#endif
+
+    // the kernel offers the largest write it supports, don't ask for more
+    // than we want to take in one request
+    if( conn->max_write > MAX_WRITE )
+        conn->max_write = MAX_WRITE;
 }
 
 
@@ -346,11 +717,12 @@ int FuseContext::truncate (const char *path, off_t length)
     namespace fs = boost::filesystem;
     Path_t wrapped = (m_realRoot / path).string();
     int result = ::truncate( wrapped.c_str(), length  );
+    invalidate( path );
     if( result <  0 )
         return -errno;
 
     // update metadata
-    m_backend->db().incrementVersion( Path_t(path) );
+    m_backend->db().incrementVersion( toDbPath(path) );
 
     return result;
 }
@@ -371,6 +743,7 @@ int FuseContext::ftruncate (const char *path,
         if(file)
         {
             int result = ::ftruncate(file->fd(), length);
+            invalidate( path );
             if( result < 0 )
                 return -errno;
 
@@ -397,6 +770,10 @@ int FuseContext::fsync (const char *path,
         RefPtr<FileContext> file = m_openedFiles[fi->fh];
         if( file )
         {
+            // a file fetched from a peer has nothing of ours to sync
+            if( file->fd() < 0 )
+                return 0;
+
             if(datasync)
                 return result_or_errno( ::fdatasync(file->fd()) );
             else
@@ -421,6 +798,12 @@ int FuseContext::flush (const char *path, struct fuse_file_info *fi)
 
 int FuseContext::release (const char *path, struct fuse_file_info *fi)
 {
+    // the handle knows when the file was last read or written
+    RefPtr<FileContext> file;
+    if(fi->fh)
+        file = m_openedFiles[fi->fh];
+    m_backend->cache().unpin( toDbPath(path), file ? file->atime() : 0 );
+
     if(fi->fh)
         m_openedFiles.unregisterFile(fi->fh);
     else
@@ -447,6 +830,11 @@ int FuseContext::getattr (const char *path, struct stat *out)
 {
     namespace fs = boost::filesystem;
     Path_t wrapped = m_realRoot / path;
+    Path_t dbPath  = toDbPath(path);
+
+    int error = 0;
+    if( m_backend->attrCache().get( dbPath, *out, error ) )
+        return -error;
 
     int result = ::lstat( wrapped.c_str(), out );
 
@@ -454,29 +842,54 @@ int FuseContext::getattr (const char *path, struct stat *out)
     // file is unsubscribed
     if( result < 0 )
     {
-        if( m_backend->db().isSubscribed( m_relDir / path ) )
-            return -errno;
+        // a file that we're subscribed to, or that no peer has told us
+        // about, really doesn't exist
+        error = errno;
+        Database::Metadata meta;
+        if( !m_backend->db().getMetadata( dbPath, meta ) || meta.subscribed )
+        {
+            m_backend->attrCache().putError( dbPath, error );
+            return -error;
+        }
         else
         {
-            out->st_mode  = S_IFREG | S_IRUSR | S_IWUSR;
-            out->st_nlink = 0;
-            out->st_uid   = getuid();
-            out->st_gid   = getgid();
-            out->st_size  = 0;
-            out->st_atime = 0;
-            out->st_mtime = 0;
-            out->st_ctime = 0;
-
+            // if a peer has told us about the file then report their
+            // copy, it will be fetched when it is read
+            remoteStat( meta, out );
+            m_backend->attrCache().put( dbPath, *out );
             return 0;
         }
     }
 
+    m_backend->attrCache().put( dbPath, *out );
     return result;
 }
 
 
 
 
+int FuseContext::getattr (const char *path,
+                            int64_t fileId,
+                            struct stat *out)
+{
+    Path_t wrapped = m_realRoot / path;
+    if( ::lstat( wrapped.c_str(), out ) == 0 )
+        return 0;
+
+    // a file that we're subscribed to, or that no peer has told us
+    // about, really doesn't exist
+    int error = errno;
+    Database::Metadata meta;
+    if( !m_backend->db().getMetadata( fileId, meta ) || meta.subscribed )
+        return -error;
+
+    remoteStat( meta, out );
+    return 0;
+}
+
+
+
+
 int FuseContext::fgetattr (const char *path,
                             struct stat *out,
                             struct fuse_file_info *fi)
@@ -489,6 +902,10 @@ int FuseContext::fgetattr (const char *path,
         RefPtr<FileContext> file = m_openedFiles[fi->fh];
         if(file)
         {
+            // files without a local copy report the peer's copy
+            if( file->fd() < 0 )
+                return getattr( path, out );
+
             int result = ::fstat(file->fd(),out);
             if( result < 0 )
                 return -errno;
@@ -521,11 +938,12 @@ int FuseContext::unlink (const char *path)
     // unlink the directory holding the file contents, the meta file,
     // and the staged file
     fs::remove_all( wrapped );
+    invalidate( path, true );
 
     // remove the entry from the parent
     try
     {
-        m_backend->db().unlink( Path_t(path) );
+        m_backend->db().unlink( toDbPath(path) );
     }
     catch( const std::exception& ex )
     {
@@ -559,7 +977,7 @@ int FuseContext::mkdir (const char *path, mode_t mode)
 
     try
     {
-        m_backend->db().mknod( Path_t(path) );
+        m_backend->db().mknod( toDbPath(path) );
     }
     catch( const std::exception& ex )
     {
@@ -573,6 +991,7 @@ int FuseContext::mkdir (const char *path, mode_t mode)
 
     // create the directory
     int result = ::mkdir( wrapped.c_str(), mode );
+    invalidate( path, true );
     if( result )
         return -errno;
 
@@ -587,8 +1006,7 @@ int FuseContext::opendir (const char *path, struct fuse_file_info *fi)
     Path_t wrapped = m_realRoot / path;
     try
     {
-        int fd = m_openedFiles.registerFile( Path_t(path), -1 );
-        fi->fh = fd;
+        fi->fh = m_openedFiles.registerFile( toDbPath(path), -1 );
     }
     catch( const std::exception& ex )
     {
@@ -629,9 +1047,37 @@ int FuseContext::readdir (const char *path,
             return -EBADF;
     }
     else
-        file = FileContext::create(m_backend,Path_t(path),-1);
+        file = FileContext::create(m_backend,toDbPath(path),-1);
+
+    return readdirPlus( path, m_backend->db().getFileId( toDbPath(path) ),
+                        buf, filler, offset );
+}
+
+
+
+int FuseContext::readdirPlus (const char *path,
+                        int64_t dirId,
+                        void *buf,
+                        fuse_fill_dir_t filler,
+                        off_t offset)
+{
+    if( dirId < 0 )
+        return -ENOENT;
+
+    // the subscribed entries are stat'ed relative to the backing
+    // directory, which doesn't exist if nothing in it is subscribed
+    Path_t wrapped = m_realRoot / path;
+    ListContext ctx;
+    ctx.backend = m_backend;
+    ctx.dbDir   = toDbPath(path);
+    ctx.dirfd   = ::open( wrapped.c_str(), O_RDONLY | O_DIRECTORY );
+    ctx.buf     = buf;
+    ctx.filler  = filler;
 
-    m_backend->db().readdir( Path_t(path), buf, filler, offset );
+    m_backend->db().readdir( dirId, &ctx, fillPlus, offset );
+
+    if( ctx.dirfd >= 0 )
+        ::close( ctx.dirfd );
     return 0;
 }
 
@@ -680,11 +1126,12 @@ int FuseContext::rmdir (const char *path)
     // unlink the directory holding the file contents, the meta file,
     // and the staged file
     fs::remove_all( wrapped );
+    invalidate( path, true );
 
     try
     {
         // remove the entry from the parent
-        m_backend->db().unlink( Path_t(path) );
+        m_backend->db().unlink( toDbPath(path) );
     }
     catch( const std::exception& ex )
     {
@@ -706,6 +1153,7 @@ int FuseContext::symlink (const char *oldpath, const char *newpath)
     Path_t newwrap = m_realRoot / newpath;
 
     int result = ::symlink( oldwrap.c_str(), newwrap.c_str() );
+    invalidate( newpath, true );
     if( result < 0 )
         return -errno;
 
@@ -734,6 +1182,8 @@ int FuseContext::link (const char *oldpath, const char *newpath)
     Path_t newwrap = m_realRoot / newpath;
 
     int result = ::link( oldwrap.c_str(), newwrap.c_str() );
+    invalidate( oldpath );
+    invalidate( newpath, true );
     if( result < 0 )
         return -errno;
 
@@ -755,22 +1205,26 @@ int FuseContext::rename (const char *oldpath, const char *newpath)
     {
         // perform the move
         int result = ::rename( oldwrap.c_str(), newwrap.c_str() );
+        invalidate( oldpath, true );
+        invalidate( newpath, true );
         if( result < 0 )
             return -errno;
 
-        m_backend->db().incrementVersion( Path_t(newpath) );
-        m_backend->db().unlink( Path_t(oldpath) );
+        m_backend->db().incrementVersion( toDbPath(newpath) );
+        m_backend->db().unlink( toDbPath(oldpath) );
 
         return result;
     }
     else
     {
         int result = ::rename( oldwrap.c_str(), newwrap.c_str() );
+        invalidate( oldpath, true );
+        invalidate( newpath, true );
         if( result < 0 )
             return -errno;
 
-        m_backend->db().mknod( Path_t(newpath) );
-        m_backend->db().unlink( Path_t(oldpath) );
+        m_backend->db().mknod( toDbPath(newpath) );
+        m_backend->db().unlink( toDbPath(oldpath) );
 
         return result;
     }
@@ -785,6 +1239,7 @@ int FuseContext::chmod (const char *path, mode_t mode)
 
     // if it's not a directory
     int result = ::chmod( wrapped.c_str(), mode );
+    invalidate( path );
     if( result < 0 )
         return -errno;
 
@@ -799,6 +1254,7 @@ int FuseContext::chown (const char *path, uid_t owner, gid_t group)
     Path_t wrapped = (m_realRoot / path);
 
     int result = ::chown( wrapped.c_str(), owner, group);
+    invalidate( path );
     if( result < 0 )
         return -errno;
 
@@ -838,7 +1294,11 @@ int FuseContext::lock (const char *path,
         RefPtr<FileContext> file = m_openedFiles[fi->fh];
         if(file)
         {
-            int result = fcntl(fi->fh,cmd,fl);
+            // there is no local file to hold the lock on
+            if( file->fd() < 0 )
+                return -ENOLCK;
+
+            int result = fcntl(file->fd(),cmd,fl);
             if( result < 0 )
                 return -errno;
             return result;
@@ -864,6 +1324,7 @@ int FuseContext::utimens (const char *path, const struct timespec tv[2])
     }
 
     int result = ::utimes( wrapped.c_str(), times );
+    invalidate( path );
     if( result < 0 )
         return -errno;
 
@@ -933,7 +1394,7 @@ int FuseContext::getxattr (const char *path,
         report << "FuseContext::getxattr : intercepted checkout hook for"
                << path <<"\n";
         std::cout << report.str();
-        m_backend->checkout( m_relDir / path );
+        m_backend->checkout( toDbPath(path) );
         return 0;
     }
     else if( attr == "obfs:release" )
@@ -942,7 +1403,7 @@ int FuseContext::getxattr (const char *path,
         report << "FuseContext::getxattr : intercepted release hook for"
                << path <<"\n";
         std::cout << report.str();
-        m_backend->release( m_relDir / path );
+        m_backend->release( toDbPath(path) );
         return 0;
     }
     else
@@ -1018,6 +1479,39 @@ int FuseContext::poll ( const char *, struct fuse_file_info *,
 
 
 
+#if FUSE_VERSION >= 29
+int FuseContext::fallocate (const char *path,
+                            int mode,
+                            off_t offset,
+                            off_t length,
+                            struct fuse_file_info *fi)
+{
+    if( !fi || !fi->fh )
+        return -EBADF;
+
+    RefPtr<FileContext> file = m_openedFiles[fi->fh];
+    if( !file )
+        return -EBADF;
+
+    // files which are fetched from a peer can't be written
+    if( file->fd() < 0 )
+        return -EROFS;
+
+    file->access();
+
+    int result = ::fallocate( file->fd(), mode, offset, length );
+    if( result < 0 )
+        return -errno;
+
+    // the version is bumped once, when the file is closed
+    file->mark();
+    invalidate( path );
+    return result;
+}
+#endif
+
+
+
 } // namespace filesystem
 } // namespace openbook
 
@@ -32,6 +32,7 @@
 #include <boost/filesystem.hpp>
 #include "fuse_include.h"
 #include "FileContext.h"
+#include "FuseStats.h"
 
 
 
@@ -56,15 +57,37 @@ class FuseContext
         Path_t      m_dataDir;
         Path_t      m_relDir;
         Path_t      m_realRoot;
+
+        /// m_relDir as it is stored in the database, without a trailing
+        /// separator, empty if we serve the whole tree
+        std::string m_dbRoot;
         FileMap     m_openedFiles;
 
         int  result_or_errno(int result);
 
+        /// drop the cached attributes of @p path after a change, and of
+        /// it's directory if @p parent is true (i.e. it was created or
+        /// removed)
+        void invalidate(const char *path, bool parent=false);
+
+        /// open() once the file is pinned in the cache
+        int  openPinned(const char *path, struct fuse_file_info *fi);
+
     public:
+        /// largest write the kernel is asked to send at once
+        static const unsigned int MAX_WRITE = 128*1024;
+
         FuseContext(Backend*, const std::string& relpath );
 
         ~FuseContext();
 
+        /// return the counters of the fuse calls
+        FuseStats& stats();
+
+        /// map a path that fuse gave us to the path of the file in the
+        /// database (i.e. the way Database::mknod() stores it)
+        Path_t toDbPath( const char* path ) const;
+
         /// Create a file node
         /**
          *
@@ -137,6 +160,11 @@ class FuseContext
          */
         int open (const char *, struct fuse_file_info *);
 
+        /// open() of a file whose id in the files table is already known,
+        /// as it is to the low level frontend, so that finding out
+        /// whether a peer has a copy doesn't need the path
+        int open (const char *, int64_t fileId, struct fuse_file_info *);
+
         /// Read data from an open file
         /**
          * Read should return exactly the number of bytes requested except
@@ -151,6 +179,35 @@ class FuseContext
         int read (const char *, char *, size_t, off_t,
                  struct fuse_file_info *);
 
+#if FUSE_VERSION >= 29
+        /// Read data from an open file into a buffer vector
+        /**
+         * Similar to read() except that the data may be returned as a
+         * file descriptor, from which fuse splices it into the reply
+         * without copying it through user space. The buffer vector is
+         * allocated here and freed by fuse.
+         *
+         * Introduced in version 2.9
+         *
+         * OpenbookFS returns the descriptor of the backing file. Files
+         * which are fetched from a peer (or reads without a handle) go
+         * through read() into memory.
+         */
+        int read_buf (const char *, struct fuse_bufvec **bufp,
+                      size_t size, off_t off, struct fuse_file_info *);
+
+        /// Write the contents of a buffer vector to an open file
+        /**
+         * Similar to write() except that the data may be a descriptor (the
+         * fuse device), in which case it is spliced straight into the
+         * backing file.
+         *
+         * Introduced in version 2.9
+         */
+        int write_buf (const char *, struct fuse_bufvec *buf, off_t off,
+                       struct fuse_file_info *);
+#endif
+
         /// Write data to an open file
         /**
          * Write should return exactly the number of bytes requested
@@ -168,6 +225,14 @@ class FuseContext
         /// Change the size of a file
         int truncate (const char *, off_t);
 
+        /// Negotiate capabilities with the kernel when the filesystem is
+        /// mounted
+        /**
+         * OpenbookFS asks for splice on reads and writes, and for writes
+         * larger than a page, up to MAX_WRITE bytes.
+         */
+        void init (struct fuse_conn_info *conn);
+
         /// Change the size of an open file
         /**
          * This method is called instead of the truncate() method if the
@@ -247,6 +312,12 @@ class FuseContext
          */
         int getattr (const char *, struct stat *);
 
+        /// getattr() of a file whose id in the files table is already
+        /// known. The metadata of an unsubscribed file is looked up by
+        /// the id, and the attribute cache isn't used since the low level
+        /// frontend lets the kernel cache the attributes instead.
+        int getattr (const char *, int64_t fileId, struct stat *);
+
         /**
          * Get attributes from an open file
          *
@@ -313,6 +384,18 @@ class FuseContext
         int readdir (const char *, void *, fuse_fill_dir_t, off_t,
                 struct fuse_file_info *);
 
+        /// Read the directory with id @p dirId, passing the attributes of
+        /// each entry to the filler
+        /**
+         * The attributes come from one query of the files table and an
+         * fstatat() of each subscribed entry in the backing directory.
+         * They are also put in the attribute cache so that the getattr()
+         * calls which follow a listing (i.e. ls -l) don't have to touch
+         * the disk or the database. The st_ino of each entry is it's id.
+         */
+        int readdirPlus (const char *, int64_t dirId, void *,
+                fuse_fill_dir_t, off_t);
+
         /** Release directory
          *
          * Introduced in version 2.3
@@ -497,6 +580,24 @@ class FuseContext
          */
         int poll (const char *, struct fuse_file_info *,
                  struct fuse_pollhandle *ph, unsigned *reventsp);
+
+#if FUSE_VERSION >= 29
+        /**
+         * Allocates space for an open file
+         *
+         * This function ensures that required space is allocated for
+         * specified file.  If this function returns success then any
+         * subsequent write request to specified range is guaranteed not
+         * to fail because of lack of space on the file system media.
+         *
+         * Introduced in version 2.9.1
+         *
+         * OpenbookFS passes it to the backing file, so punching holes
+         * keeps files sparse.
+         */
+        int fallocate (const char *, int mode, off_t offset, off_t length,
+                      struct fuse_file_info *);
+#endif
 };
 
 
@@ -0,0 +1,1048 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/FuseLowLevel.cpp
+ *
+ *  @brief  
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <vector>
+
+#include <sys/statvfs.h>
+
+#include "Backend.h"
+#include "FuseContext.h"
+#include "FuseLowLevel.h"
+
+
+namespace   openbook {
+namespace filesystem {
+namespace    ll_ops {
+
+inline FuseLowLevel* get( fuse_req_t req )
+{
+    return static_cast<FuseLowLevel*>( fuse_req_userdata(req) );
+}
+
+void init(void *userdata, struct fuse_conn_info *conn)
+{
+    static_cast<FuseLowLevel*>(userdata)->init(conn);
+}
+
+void lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::LOOKUP );
+    get(req)->lookup(req,parent,name);
+}
+
+void forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::FORGET );
+    get(req)->forget(req,ino,nlookup);
+}
+
+void getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::GETATTR );
+    get(req)->getattr(req,ino,fi);
+}
+
+void setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                int toSet, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::SETATTR );
+    get(req)->setattr(req,ino,attr,toSet,fi);
+}
+
+void readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::READLINK );
+    get(req)->readlink(req,ino);
+}
+
+void mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
+                mode_t mode, dev_t rdev)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::MKNOD );
+    get(req)->mknod(req,parent,name,mode,rdev);
+}
+
+void mkdir(fuse_req_t req, fuse_ino_t parent, const char *name,
+                mode_t mode)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::MKDIR );
+    get(req)->mkdir(req,parent,name,mode);
+}
+
+void unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::UNLINK );
+    get(req)->unlink(req,parent,name);
+}
+
+void rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::RMDIR );
+    get(req)->rmdir(req,parent,name);
+}
+
+void symlink(fuse_req_t req, const char *link, fuse_ino_t parent,
+                const char *name)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::SYMLINK );
+    get(req)->symlink(req,link,parent,name);
+}
+
+void rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                fuse_ino_t newparent, const char *newname)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::RENAME );
+    get(req)->rename(req,parent,name,newparent,newname);
+}
+
+void link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent,
+                const char *newname)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::LINK );
+    get(req)->link(req,ino,newparent,newname);
+}
+
+void open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::OPEN );
+    get(req)->open(req,ino,fi);
+}
+
+void read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::READ );
+    get(req)->read(req,ino,size,off,fi);
+}
+
+void write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                off_t off, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::WRITE );
+    get(req)->write(req,ino,buf,size,off,fi);
+}
+
+#if FUSE_VERSION >= 29
+void write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
+                off_t off, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::WRITE );
+    get(req)->write_buf(req,ino,bufv,off,fi);
+}
+#endif
+
+void flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::FLUSH );
+    get(req)->flush(req,ino,fi);
+}
+
+void release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::RELEASE );
+    get(req)->release(req,ino,fi);
+}
+
+void fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::FSYNC );
+    get(req)->fsync(req,ino,datasync,fi);
+}
+
+void opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::OPENDIR );
+    get(req)->opendir(req,ino,fi);
+}
+
+void readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::READDIR );
+    get(req)->readdir(req,ino,size,off,fi);
+}
+
+void releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::RELEASEDIR );
+    get(req)->releasedir(req,ino,fi);
+}
+
+void fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync,
+                struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::FSYNCDIR );
+    get(req)->fsyncdir(req,ino,datasync,fi);
+}
+
+void statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::STATFS );
+    get(req)->statfs(req,ino);
+}
+
+void setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                const char *value, size_t size, int flags)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::SETXATTR );
+    get(req)->setxattr(req,ino,name,value,size,flags);
+}
+
+void getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                size_t size)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::GETXATTR );
+    get(req)->getxattr(req,ino,name,size);
+}
+
+void listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::LISTXATTR );
+    get(req)->listxattr(req,ino,size);
+}
+
+void removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::REMOVEXATTR );
+    get(req)->removexattr(req,ino,name);
+}
+
+void access(fuse_req_t req, fuse_ino_t ino, int mask)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::ACCESS );
+    get(req)->access(req,ino,mask);
+}
+
+void create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                mode_t mode, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::CREATE );
+    get(req)->create(req,parent,name,mode,fi);
+}
+
+#if FUSE_VERSION >= 29
+void fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset,
+                off_t length, struct fuse_file_info *fi)
+{
+    FuseStats::Timer timer( get(req)->stats(), FuseStats::FALLOCATE );
+    get(req)->fallocate(req,ino,mode,offset,length,fi);
+}
+#endif
+
+/// adapts the fuse_fill_dir_t interface of Database::readdir() to a low
+/// level reply buffer
+struct DirBuf
+{
+    fuse_req_t  req;
+    char*       buf;
+    size_t      size;
+    size_t      used;
+};
+
+int fillDir( void* vp_buf, const char* name, const struct stat* st,
+                off_t off )
+{
+    DirBuf* dir   = static_cast<DirBuf*>(vp_buf);
+    size_t  avail = dir->size - dir->used;
+    size_t  len   = fuse_add_direntry( dir->req, dir->buf + dir->used,
+                                        avail, name, st, off );
+    if( len > avail )
+        return 1;
+
+    dir->used += len;
+    return 0;
+}
+
+} //< namespace ll_ops
+
+
+
+
+const double FuseLowLevel::TIMEOUT = AttrCache::TIMEOUT;
+
+FuseLowLevel::FuseLowLevel( Backend* backend, FuseContext* fs,
+                            const std::string& relDir ):
+    m_backend(backend),
+    m_fs(fs),
+    m_relDir(relDir.empty() ? "/" : relDir),
+    m_chan(0)
+{
+    m_rootId = m_backend->db().getFileId( m_relDir );
+    if( m_rootId < 0 )
+        m_rootId = FUSE_ROOT_ID;
+}
+
+FuseLowLevel::~FuseLowLevel()
+{
+    if( m_chan )
+        m_backend->attrCache().removeListener(this);
+    delete m_fs;
+}
+
+void FuseLowLevel::replyErr( fuse_req_t req, int err )
+{
+    if( err )
+        FuseStats::error();
+    fuse_reply_err(req,err);
+}
+
+void FuseLowLevel::replyWrite( fuse_req_t req, size_t count )
+{
+    FuseStats::bytes(count);
+    fuse_reply_write(req,count);
+}
+
+void FuseLowLevel::setChannel( fuse_chan* chan )
+{
+    m_chan = chan;
+    m_backend->attrCache().addListener(this);
+}
+
+void FuseLowLevel::invalidate( const Path_t& path, bool data )
+{
+    // map the path to one relative to the mount
+    std::string relPath = path.string();
+    std::string relDir  = m_relDir.string();
+    if( relDir != "/" )
+    {
+        if( relPath.compare( 0, relDir.size(), relDir ) != 0 )
+            return;
+        relPath = relPath.substr( relDir.size() );
+        if( !relPath.empty() && relPath[0] != '/' )
+            return;
+    }
+
+    fuse_ino_t  parent;
+    fuse_ino_t  ino;
+    std::string name;
+    m_inodes.resolve( relPath, parent, name, ino );
+
+    // a negative offset keeps the cached pages and drops only the
+    // attributes
+    if( ino )
+        fuse_lowlevel_notify_inval_inode( m_chan, ino, data ? 0 : -1, 0 );
+    if( parent )
+        fuse_lowlevel_notify_inval_entry( m_chan, parent,
+                                          name.c_str(), name.size() );
+}
+
+void FuseLowLevel::setOps( fuse_lowlevel_ops& ops )
+{
+    memset(&ops,0,sizeof(fuse_lowlevel_ops));
+
+    ops.init        = ll_ops::init;
+    ops.lookup      = ll_ops::lookup;
+    ops.forget      = ll_ops::forget;
+    ops.getattr     = ll_ops::getattr;
+    ops.setattr     = ll_ops::setattr;
+    ops.readlink    = ll_ops::readlink;
+    ops.mknod       = ll_ops::mknod;
+    ops.mkdir       = ll_ops::mkdir;
+    ops.unlink      = ll_ops::unlink;
+    ops.rmdir       = ll_ops::rmdir;
+    ops.symlink     = ll_ops::symlink;
+    ops.rename      = ll_ops::rename;
+    ops.link        = ll_ops::link;
+    ops.open        = ll_ops::open;
+    ops.read        = ll_ops::read;
+    ops.write       = ll_ops::write;
+#if FUSE_VERSION >= 29
+    ops.write_buf   = ll_ops::write_buf;
+#endif
+    ops.flush       = ll_ops::flush;
+    ops.release     = ll_ops::release;
+    ops.fsync       = ll_ops::fsync;
+    ops.opendir     = ll_ops::opendir;
+    ops.readdir     = ll_ops::readdir;
+    ops.releasedir  = ll_ops::releasedir;
+    ops.fsyncdir    = ll_ops::fsyncdir;
+    ops.statfs      = ll_ops::statfs;
+#ifdef HAVE_SETXATTR
+    ops.setxattr    = ll_ops::setxattr;
+    ops.getxattr    = ll_ops::getxattr;
+    ops.listxattr   = ll_ops::listxattr;
+    ops.removexattr = ll_ops::removexattr;
+#endif
+    ops.access      = ll_ops::access;
+    ops.create      = ll_ops::create;
+#if FUSE_VERSION >= 29
+    ops.fallocate   = ll_ops::fallocate;
+#endif
+}
+
+void FuseLowLevel::init( fuse_conn_info* conn )
+{
+    m_fs->init(conn);
+}
+
+fuse_ino_t FuseLowLevel::toIno( int64_t fileId )
+{
+    if( fileId == m_rootId )
+        return FUSE_ROOT_ID;
+    return fileId;
+}
+
+int64_t FuseLowLevel::toFileId( fuse_ino_t ino )
+{
+    if( ino == FUSE_ROOT_ID )
+        return m_rootId;
+    return ino;
+}
+
+int FuseLowLevel::entry( fuse_ino_t parent, const char* name,
+                         fuse_entry_param& e )
+{
+    std::string path;
+    if( !m_inodes.childPath(parent,name,path) )
+        return -ESTALE;
+
+    // only go to the database if the kernel has forgotten this entry, and
+    // then by the id of the directory rather than the path
+    fuse_ino_t ino = m_inodes.find(parent,name);
+    if( !ino )
+    {
+        int64_t fileId = m_backend->db().getChildId( toFileId(parent), name );
+        if( fileId < 0 )
+            return -ENOENT;
+        ino = toIno(fileId);
+    }
+
+    memset( &e, 0, sizeof(e) );
+    int result = m_fs->getattr( path.c_str(), toFileId(ino), &e.attr );
+    if( result < 0 )
+        return result;
+
+    m_inodes.add(parent,name,ino,path);
+
+    e.ino           = ino;
+    e.attr.st_ino   = ino;
+    e.attr_timeout  = TIMEOUT;
+    e.entry_timeout = TIMEOUT;
+    return 0;
+}
+
+void FuseLowLevel::replyEntry( fuse_req_t req, int result,
+                               fuse_ino_t parent, const char* name )
+{
+    fuse_entry_param e;
+    if( result >= 0 )
+        result = entry(parent,name,e);
+
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+        fuse_reply_entry(req,&e);
+}
+
+void FuseLowLevel::lookup( fuse_req_t req, fuse_ino_t parent,
+                            const char* name )
+{
+    fuse_entry_param e;
+    int result = entry(parent,name,e);
+
+    // a zero inode is a negative entry, the kernel remembers that the
+    // file doesn't exist until it times out or we invalidate it
+    if( result == -ENOENT )
+    {
+        memset( &e, 0, sizeof(e) );
+        e.entry_timeout = TIMEOUT;
+        fuse_reply_entry(req,&e);
+    }
+    else if( result < 0 )
+        replyErr(req,-result);
+    else
+        fuse_reply_entry(req,&e);
+}
+
+void FuseLowLevel::forget( fuse_req_t req, fuse_ino_t ino,
+                            unsigned long nlookup )
+{
+    m_inodes.forget(ino,nlookup);
+    fuse_reply_none(req);
+}
+
+void FuseLowLevel::getattr( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    struct stat attr;
+    memset( &attr, 0, sizeof(attr) );
+    int result = fi ? m_fs->fgetattr( path.c_str(), &attr, fi )
+                    : m_fs->getattr( path.c_str(), toFileId(ino), &attr );
+    if( result < 0 )
+    {
+        replyErr(req,-result);
+        return;
+    }
+
+    attr.st_ino = ino;
+    fuse_reply_attr(req,&attr,TIMEOUT);
+}
+
+void FuseLowLevel::setattr( fuse_req_t req, fuse_ino_t ino,
+                            struct stat* attr, int toSet,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = 0;
+    if( toSet & FUSE_SET_ATTR_MODE )
+        result = m_fs->chmod( path.c_str(), attr->st_mode );
+
+    if( result >= 0 && ( toSet & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID) ) )
+    {
+        uid_t uid = ( toSet & FUSE_SET_ATTR_UID ) ? attr->st_uid : -1;
+        gid_t gid = ( toSet & FUSE_SET_ATTR_GID ) ? attr->st_gid : -1;
+        result = m_fs->chown( path.c_str(), uid, gid );
+    }
+
+    if( result >= 0 && ( toSet & FUSE_SET_ATTR_SIZE ) )
+    {
+        result = fi ? m_fs->ftruncate( path.c_str(), attr->st_size, fi )
+                    : m_fs->truncate( path.c_str(), attr->st_size );
+    }
+
+    if( result >= 0 && ( toSet & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME) ) )
+    {
+        // utimens() can't leave one of the times alone, so fill in
+        // whichever one isn't being set from the current attributes
+        struct stat current;
+        result = m_fs->getattr( path.c_str(), &current );
+
+        timespec now;
+        clock_gettime( CLOCK_REALTIME, &now );
+
+        timespec tv[2];
+        tv[0] = current.st_atim;
+        tv[1] = current.st_mtim;
+        if( toSet & FUSE_SET_ATTR_ATIME_NOW )
+            tv[0] = now;
+        else if( toSet & FUSE_SET_ATTR_ATIME )
+            tv[0] = attr->st_atim;
+        if( toSet & FUSE_SET_ATTR_MTIME_NOW )
+            tv[1] = now;
+        else if( toSet & FUSE_SET_ATTR_MTIME )
+            tv[1] = attr->st_mtim;
+
+        if( result >= 0 )
+            result = m_fs->utimens( path.c_str(), tv );
+    }
+
+    if( result < 0 )
+    {
+        replyErr(req,-result);
+        return;
+    }
+
+    getattr(req,ino,fi);
+}
+
+void FuseLowLevel::readlink( fuse_req_t req, fuse_ino_t ino )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    char buf[PATH_MAX+1];
+    int result = m_fs->readlink( path.c_str(), buf, sizeof(buf) );
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+        fuse_reply_readlink(req,buf);
+}
+
+void FuseLowLevel::mknod( fuse_req_t req, fuse_ino_t parent,
+                            const char* name, mode_t mode, dev_t rdev )
+{
+    std::string path;
+    if( !m_inodes.childPath(parent,name,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    replyEntry( req, m_fs->mknod( path.c_str(), mode, rdev ), parent, name );
+}
+
+void FuseLowLevel::mkdir( fuse_req_t req, fuse_ino_t parent,
+                            const char* name, mode_t mode )
+{
+    std::string path;
+    if( !m_inodes.childPath(parent,name,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    replyEntry( req, m_fs->mkdir( path.c_str(), mode ), parent, name );
+}
+
+void FuseLowLevel::unlink( fuse_req_t req, fuse_ino_t parent,
+                            const char* name )
+{
+    std::string path;
+    if( !m_inodes.childPath(parent,name,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->unlink( path.c_str() );
+    if( result >= 0 )
+        m_inodes.remove(parent,name);
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::rmdir( fuse_req_t req, fuse_ino_t parent,
+                            const char* name )
+{
+    std::string path;
+    if( !m_inodes.childPath(parent,name,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->rmdir( path.c_str() );
+    if( result >= 0 )
+        m_inodes.remove(parent,name);
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::symlink( fuse_req_t req, const char* link,
+                            fuse_ino_t parent, const char* name )
+{
+    std::string path;
+    if( !m_inodes.childPath(parent,name,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    replyEntry( req, m_fs->symlink( link, path.c_str() ), parent, name );
+}
+
+void FuseLowLevel::rename( fuse_req_t req, fuse_ino_t parent,
+                            const char* name, fuse_ino_t newparent,
+                            const char* newname )
+{
+    std::string oldpath, newpath;
+    if( !m_inodes.childPath(parent,name,oldpath)
+            || !m_inodes.childPath(newparent,newname,newpath) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->rename( oldpath.c_str(), newpath.c_str() );
+    if( result >= 0 )
+        m_inodes.rename(parent,name,newparent,newname);
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::link( fuse_req_t req, fuse_ino_t ino,
+                            fuse_ino_t newparent, const char* newname )
+{
+    std::string oldpath, newpath;
+    if( !m_inodes.path(ino,oldpath)
+            || !m_inodes.childPath(newparent,newname,newpath) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    replyEntry( req, m_fs->link( oldpath.c_str(), newpath.c_str() ),
+                newparent, newname );
+}
+
+void FuseLowLevel::open( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->open( path.c_str(), toFileId(ino), fi );
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+        fuse_reply_open(req,fi);
+}
+
+void FuseLowLevel::read( fuse_req_t req, fuse_ino_t ino, size_t size,
+                            off_t off, fuse_file_info* fi )
+{
+    // an open handle already knows it's file, so the path is only needed
+    // for a read without one
+    std::string path;
+    if( !fi->fh && !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+#if FUSE_VERSION >= 29
+    fuse_bufvec* bufv = 0;
+    int result = m_fs->read_buf( path.c_str(), &bufv, size, off, fi );
+    if( result < 0 )
+    {
+        replyErr(req,-result);
+        return;
+    }
+
+    // if the buffer is the backing file then fuse splices from it. The
+    // buffer is sized to what the reply holds, and the call's latency
+    // includes the reply.
+    if( fuse_reply_data(req,bufv,FUSE_BUF_SPLICE_MOVE) == 0 )
+        FuseStats::bytes( fuse_buf_size(bufv) );
+
+    for( size_t i=0; i < bufv->count; i++ )
+        if( !(bufv->buf[i].flags & FUSE_BUF_IS_FD) )
+            free( bufv->buf[i].mem );
+    free( bufv );
+#else
+    std::vector<char> buf(size);
+    int result = m_fs->read( path.c_str(), buf.data(), size, off, fi );
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+    {
+        FuseStats::bytes(result);
+        fuse_reply_buf(req,buf.data(),result);
+    }
+#endif
+}
+
+void FuseLowLevel::write( fuse_req_t req, fuse_ino_t ino, const char* buf,
+                            size_t size, off_t off, fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->write( path.c_str(), buf, size, off, fi );
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+        replyWrite(req,result);
+}
+
+#if FUSE_VERSION >= 29
+void FuseLowLevel::write_buf( fuse_req_t req, fuse_ino_t ino,
+                            fuse_bufvec* bufv, off_t off,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->write_buf( path.c_str(), bufv, off, fi );
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+        replyWrite(req,result);
+}
+#endif
+
+void FuseLowLevel::flush( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->flush( path.c_str(), fi );
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::release( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->release( path.c_str(), fi );
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::fsync( fuse_req_t req, fuse_ino_t ino, int datasync,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->fsync( path.c_str(), datasync, fi );
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::opendir( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->opendir( path.c_str(), fi );
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+        fuse_reply_open(req,fi);
+}
+
+void FuseLowLevel::readdir( fuse_req_t req, fuse_ino_t ino, size_t size,
+                            off_t off, fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    // the listing comes straight from the directory's id, the path is
+    // only needed to stat the entries
+    std::vector<char> buf(size);
+    ll_ops::DirBuf dir = { req, buf.data(), size, 0 };
+    int result = m_fs->readdirPlus( path.c_str(), toFileId(ino),
+                                    &dir, ll_ops::fillDir, off );
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+        fuse_reply_buf(req,buf.data(),dir.used);
+}
+
+void FuseLowLevel::releasedir( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->releasedir( path.c_str(), fi );
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::fsyncdir( fuse_req_t req, fuse_ino_t ino, int datasync,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->fsyncdir( path.c_str(), datasync, fi );
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::statfs( fuse_req_t req, fuse_ino_t ino )
+{
+    struct statvfs buf;
+    int result = m_fs->statfs( "/", &buf );
+    if( result < 0 )
+        replyErr(req,-result);
+    else
+        fuse_reply_statfs(req,&buf);
+}
+
+void FuseLowLevel::setxattr( fuse_req_t req, fuse_ino_t ino,
+                            const char* name, const char* value,
+                            size_t size, int flags )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->setxattr( path.c_str(), name, value, size, flags );
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::getxattr( fuse_req_t req, fuse_ino_t ino,
+                            const char* name, size_t size )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    // a size of zero is a query for the size of the value
+    std::vector<char> buf(size);
+    int result = m_fs->getxattr( path.c_str(), name, buf.data(), size );
+    if( result < 0 )
+        replyErr(req,-result);
+    else if( size == 0 )
+        fuse_reply_xattr(req,result);
+    else
+        fuse_reply_buf(req,buf.data(),result);
+}
+
+void FuseLowLevel::listxattr( fuse_req_t req, fuse_ino_t ino, size_t size )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    std::vector<char> buf(size);
+    int result = m_fs->listxattr( path.c_str(), buf.data(), size );
+    if( result < 0 )
+        replyErr(req,-result);
+    else if( size == 0 )
+        fuse_reply_xattr(req,result);
+    else
+        fuse_reply_buf(req,buf.data(),result);
+}
+
+void FuseLowLevel::removexattr( fuse_req_t req, fuse_ino_t ino,
+                            const char* name )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->removexattr( path.c_str(), name );
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::access( fuse_req_t req, fuse_ino_t ino, int mask )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->access( path.c_str(), mask );
+    replyErr(req, result < 0 ? -result : 0);
+}
+
+void FuseLowLevel::create( fuse_req_t req, fuse_ino_t parent,
+                            const char* name, mode_t mode,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.childPath(parent,name,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->create( path.c_str(), mode, fi );
+    if( result < 0 )
+    {
+        replyErr(req,-result);
+        return;
+    }
+
+    fuse_entry_param e;
+    result = entry(parent,name,e);
+    if( result < 0 )
+    {
+        m_fs->release( path.c_str(), fi );
+        replyErr(req,-result);
+        return;
+    }
+
+    fuse_reply_create(req,&e,fi);
+}
+
+
+#if FUSE_VERSION >= 29
+void FuseLowLevel::fallocate( fuse_req_t req, fuse_ino_t ino, int mode,
+                            off_t offset, off_t length,
+                            fuse_file_info* fi )
+{
+    std::string path;
+    if( !m_inodes.path(ino,path) )
+    {
+        replyErr(req,ESTALE);
+        return;
+    }
+
+    int result = m_fs->fallocate( path.c_str(), mode, offset, length, fi );
+    replyErr(req, result < 0 ? -result : 0);
+}
+#endif
+
+} //< namespace filesystem
+} //< namespace openbook
@@ -0,0 +1,194 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/FuseLowLevel.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_FUSELOWLEVEL_H_
+#define OPENBOOK_FS_FUSELOWLEVEL_H_
+
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "fuse_include.h"
+#include "AttrCache.h"
+#include "InodeTable.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+class Backend;
+class FuseContext;
+
+/// frontend for the fuse low level api
+/**
+ *  The low level api addresses files by inode number rather than by path.
+ *  We use the id of the file in the files table as it's inode number, and
+ *  keep the inodes the kernel has looked up in an InodeTable. Lookups
+ *  find a child by the id of it's directory, getattr and open go to the
+ *  database by id rather than by path, and reads and writes through an
+ *  open handle don't need the path at all. Other operations map their
+ *  inode back to a path with a single table lookup and then forward to the
+ *  same FuseContext methods that the high level frontend uses.
+ *
+ *  The kernel is allowed to cache attributes and entries (including
+ *  negative ones) for a long time. When a peer changes a file we are told
+ *  through the AttrCache::Listener interface, and tell the kernel to drop
+ *  it's copy.
+ */
+class FuseLowLevel:
+    public AttrCache::Listener
+{
+    public:
+        typedef boost::filesystem::path Path_t;
+
+        /// how long the kernel may cache attributes and entries (seconds)
+        static const double TIMEOUT;
+
+    private:
+        Backend*        m_backend;
+        FuseContext*    m_fs;       ///< does the actual work
+        Path_t          m_relDir;   ///< where we serve files from
+        InodeTable      m_inodes;   ///< inodes that the kernel knows about
+        fuse_chan*      m_chan;     ///< for sending invalidations
+
+        /// the id of the directory we serve, which is the fuse root
+        int64_t         m_rootId;
+
+        /// map a files table id to the inode we give the kernel
+        fuse_ino_t      toIno( int64_t fileId );
+
+        /// map an inode to the id in the files table
+        int64_t         toFileId( fuse_ino_t ino );
+
+        /// fill an entry for @p name in @p parent and record the lookup,
+        /// returns 0 or a negative error
+        int  entry( fuse_ino_t parent, const char* name,
+                    fuse_entry_param& e );
+
+        /// reply to an operation that creates @p name in @p parent
+        void replyEntry( fuse_req_t req, int result,
+                         fuse_ino_t parent, const char* name );
+
+        /// reply with an error (or success if @p err is zero) and count
+        /// it in the statistics of the call
+        static void replyErr( fuse_req_t req, int err );
+
+        /// reply to a write and count the bytes in the statistics
+        static void replyWrite( fuse_req_t req, size_t count );
+
+    public:
+        /// takes ownership of @p fs
+        FuseLowLevel( Backend* backend, FuseContext* fs,
+                      const std::string& relDir );
+        ~FuseLowLevel();
+
+        /// start sending invalidations to the kernel over @p chan
+        void setChannel( fuse_chan* chan );
+
+        /// return the counters of the fuse calls
+        FuseStats& stats(){ return m_fs->stats(); }
+
+        /// tell the kernel that a path (relative to the real root) and
+        /// anything beneath it have changed, or only their attributes if
+        /// @p data is false
+        void invalidate( const Path_t& path, bool data );
+
+        /// fill the operations table with our trampolines, the userdata
+        /// given to fuse_lowlevel_new() must be a FuseLowLevel
+        static void setOps( fuse_lowlevel_ops& ops );
+
+        void init       ( fuse_conn_info* conn );
+        void lookup     ( fuse_req_t req, fuse_ino_t parent,
+                            const char* name );
+        void forget     ( fuse_req_t req, fuse_ino_t ino,
+                            unsigned long nlookup );
+        void getattr    ( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi );
+        void setattr    ( fuse_req_t req, fuse_ino_t ino,
+                            struct stat* attr, int toSet,
+                            fuse_file_info* fi );
+        void readlink   ( fuse_req_t req, fuse_ino_t ino );
+        void mknod      ( fuse_req_t req, fuse_ino_t parent,
+                            const char* name, mode_t mode, dev_t rdev );
+        void mkdir      ( fuse_req_t req, fuse_ino_t parent,
+                            const char* name, mode_t mode );
+        void unlink     ( fuse_req_t req, fuse_ino_t parent,
+                            const char* name );
+        void rmdir      ( fuse_req_t req, fuse_ino_t parent,
+                            const char* name );
+        void symlink    ( fuse_req_t req, const char* link,
+                            fuse_ino_t parent, const char* name );
+        void rename     ( fuse_req_t req, fuse_ino_t parent,
+                            const char* name, fuse_ino_t newparent,
+                            const char* newname );
+        void link       ( fuse_req_t req, fuse_ino_t ino,
+                            fuse_ino_t newparent, const char* newname );
+        void open       ( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi );
+        void read       ( fuse_req_t req, fuse_ino_t ino, size_t size,
+                            off_t off, fuse_file_info* fi );
+        void write      ( fuse_req_t req, fuse_ino_t ino, const char* buf,
+                            size_t size, off_t off, fuse_file_info* fi );
+#if FUSE_VERSION >= 29
+        void write_buf  ( fuse_req_t req, fuse_ino_t ino, fuse_bufvec* bufv,
+                            off_t off, fuse_file_info* fi );
+#endif
+        void flush      ( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi );
+        void release    ( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi );
+        void fsync      ( fuse_req_t req, fuse_ino_t ino, int datasync,
+                            fuse_file_info* fi );
+        void opendir    ( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi );
+        void readdir    ( fuse_req_t req, fuse_ino_t ino, size_t size,
+                            off_t off, fuse_file_info* fi );
+        void releasedir ( fuse_req_t req, fuse_ino_t ino,
+                            fuse_file_info* fi );
+        void fsyncdir   ( fuse_req_t req, fuse_ino_t ino, int datasync,
+                            fuse_file_info* fi );
+        void statfs     ( fuse_req_t req, fuse_ino_t ino );
+        void setxattr   ( fuse_req_t req, fuse_ino_t ino, const char* name,
+                            const char* value, size_t size, int flags );
+        void getxattr   ( fuse_req_t req, fuse_ino_t ino, const char* name,
+                            size_t size );
+        void listxattr  ( fuse_req_t req, fuse_ino_t ino, size_t size );
+        void removexattr( fuse_req_t req, fuse_ino_t ino,
+                            const char* name );
+        void access     ( fuse_req_t req, fuse_ino_t ino, int mask );
+        void create     ( fuse_req_t req, fuse_ino_t parent,
+                            const char* name, mode_t mode,
+                            fuse_file_info* fi );
+#if FUSE_VERSION >= 29
+        void fallocate  ( fuse_req_t req, fuse_ino_t ino, int mode,
+                            off_t offset, off_t length,
+                            fuse_file_info* fi );
+#endif
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // FUSELOWLEVEL_H_
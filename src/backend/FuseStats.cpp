@@ -0,0 +1,252 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/FuseStats.cpp
+ *
+ *  @brief  
+ */
+
+#include <algorithm>
+
+#include "FuseStats.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+const int FuseStats::NUM_BUCKETS;
+
+/// the innermost live timer of the calling thread
+static __thread FuseStats::Timer* s_current = 0;
+
+static int64_t elapsedUs( const timespec& start )
+{
+    timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (now.tv_sec  - start.tv_sec)  * 1000000L
+         + (now.tv_nsec - start.tv_nsec) / 1000L;
+}
+
+/// only the owning thread writes to a counter, so there is no need for a
+/// locked read-modify-write, readers just need to see whole values
+static void add( std::atomic<int64_t>& counter, int64_t value )
+{
+    counter.store( counter.load(std::memory_order_relaxed) + value,
+                    std::memory_order_relaxed );
+}
+
+FuseStats::Timer::Timer( FuseStats& stats, Op op ):
+    m_stats(&stats),
+    m_op(op),
+    m_error(false),
+    m_bytes(0),
+    m_outer(s_current)
+{
+    clock_gettime( CLOCK_MONOTONIC, &m_start );
+    s_current = this;
+}
+
+FuseStats::Timer::~Timer()
+{
+    s_current = m_outer;
+    m_stats->record( m_op, elapsedUs(m_start), m_error, m_bytes );
+}
+
+FuseStats::FuseStats():
+    m_blocks(0)
+{
+    m_mutex.init();
+    pthread_key_create( &m_key, &FuseStats::releaseBlock );
+}
+
+FuseStats::~FuseStats()
+{
+    pthread_key_delete( m_key );
+    while( m_blocks )
+    {
+        Block* block = m_blocks;
+        m_blocks = block->next;
+        delete block;
+    }
+    m_mutex.destroy();
+}
+
+void FuseStats::releaseBlock( void* ptr )
+{
+    Block* block = static_cast<Block*>(ptr);
+    pthreads::ScopedLock lock( block->owner->m_mutex );
+    block->inUse = false;
+}
+
+FuseStats::Block* FuseStats::block()
+{
+    Block* block = static_cast<Block*>( pthread_getspecific(m_key) );
+    if( block )
+        return block;
+
+    {
+        pthreads::ScopedLock lock(m_mutex);
+
+        // take over the counters of a thread that has exited
+        for( block = m_blocks; block; block = block->next )
+            if( !block->inUse )
+                break;
+
+        if( !block )
+        {
+            block        = new Block();
+            block->owner = this;
+            block->next  = m_blocks;
+            m_blocks     = block;
+        }
+        block->inUse = true;
+    }
+
+    pthread_setspecific( m_key, block );
+    return block;
+}
+
+void FuseStats::record( Op op, int64_t us, bool error, int64_t bytes )
+{
+    Counters& counters = block()->ops[op];
+
+    int bucket = 0;
+    if( us > 0 )
+        bucket = std::min<int>( NUM_BUCKETS-1,
+                    64 - __builtin_clzll( (unsigned long long)us ) );
+
+    add( counters.calls,   1 );
+    add( counters.totalUs, us );
+    add( counters.latency[bucket], 1 );
+    if( error )
+        add( counters.errors, 1 );
+    if( bytes )
+        add( counters.bytes, bytes );
+}
+
+const char* FuseStats::name( Op op )
+{
+    static const char* names[NUM_OPS] =
+    {
+        "lookup",
+        "forget",
+        "getattr",
+        "setattr",
+        "readlink",
+        "mknod",
+        "mkdir",
+        "unlink",
+        "rmdir",
+        "symlink",
+        "rename",
+        "link",
+        "chmod",
+        "chown",
+        "truncate",
+        "open",
+        "read",
+        "write",
+        "statfs",
+        "flush",
+        "release",
+        "fsync",
+        "setxattr",
+        "getxattr",
+        "listxattr",
+        "removexattr",
+        "opendir",
+        "readdir",
+        "releasedir",
+        "fsyncdir",
+        "access",
+        "create",
+        "ftruncate",
+        "fgetattr",
+        "lock",
+        "utimens",
+        "fallocate",
+    };
+
+    if( op < 0 || op >= NUM_OPS )
+        return "unknown";
+    return names[op];
+}
+
+void FuseStats::error()
+{
+    if( s_current )
+        s_current->m_error = true;
+}
+
+void FuseStats::bytes( int64_t count )
+{
+    if( s_current && count > 0 )
+        s_current->m_bytes += count;
+}
+
+void FuseStats::fill( messages::FuseStatList* msg )
+{
+    int64_t calls  [NUM_OPS] = {0};
+    int64_t errors [NUM_OPS] = {0};
+    int64_t bytes  [NUM_OPS] = {0};
+    int64_t totalUs[NUM_OPS] = {0};
+    int64_t latency[NUM_OPS][NUM_BUCKETS] = {{0}};
+
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        for( Block* block = m_blocks; block; block = block->next )
+        {
+            for( int i=0; i < NUM_OPS; i++ )
+            {
+                Counters& counters = block->ops[i];
+                calls[i]   += counters.calls.load(std::memory_order_relaxed);
+                errors[i]  += counters.errors.load(std::memory_order_relaxed);
+                bytes[i]   += counters.bytes.load(std::memory_order_relaxed);
+                totalUs[i] += counters.totalUs.load(std::memory_order_relaxed);
+                for( int j=0; j < NUM_BUCKETS; j++ )
+                    latency[i][j] +=
+                        counters.latency[j].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    for( int i=0; i < NUM_OPS; i++ )
+    {
+        if( !calls[i] )
+            continue;
+
+        messages::FuseOpStats* stats = msg->add_ops();
+        stats->set_op( name( (Op)i ) );
+        stats->set_calls(calls[i]);
+        stats->set_errors(errors[i]);
+        stats->set_bytes(bytes[i]);
+        stats->set_totalus(totalUs[i]);
+
+        // drop the empty tail of the histogram
+        int last = NUM_BUCKETS;
+        while( last > 0 && !latency[i][last-1] )
+            last--;
+        for( int j=0; j < last; j++ )
+            stats->add_latency(latency[i][j]);
+    }
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
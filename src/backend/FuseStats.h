@@ -0,0 +1,203 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/FuseStats.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_FUSESTATS_H_
+#define OPENBOOK_FS_FUSESTATS_H_
+
+#include <atomic>
+#include <ctime>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <cpp-pthreads.h>
+
+#include "messages.pb.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+/// call counts, error counts, bytes transferred and latency histograms of
+/// the fuse operations, over all mount points
+/**
+ *  Every thread which dispatches fuse requests gets it's own block of
+ *  counters, so recording a call is a handful of uncontended stores and
+ *  never takes a lock. fill() sums the blocks of all threads. The blocks of
+ *  threads that exit are kept (and reused by new threads) so nothing that
+ *  was recorded is lost.
+ */
+class FuseStats
+{
+    public:
+        /// the operations that are counted
+        enum Op
+        {
+            LOOKUP,
+            FORGET,
+            GETATTR,
+            SETATTR,
+            READLINK,
+            MKNOD,
+            MKDIR,
+            UNLINK,
+            RMDIR,
+            SYMLINK,
+            RENAME,
+            LINK,
+            CHMOD,
+            CHOWN,
+            TRUNCATE,
+            OPEN,
+            READ,
+            WRITE,
+            STATFS,
+            FLUSH,
+            RELEASE,
+            FSYNC,
+            SETXATTR,
+            GETXATTR,
+            LISTXATTR,
+            REMOVEXATTR,
+            OPENDIR,
+            READDIR,
+            RELEASEDIR,
+            FSYNCDIR,
+            ACCESS,
+            CREATE,
+            FTRUNCATE,
+            FGETATTR,
+            LOCK,
+            UTIMENS,
+            FALLOCATE,
+            NUM_OPS
+        };
+
+        /// latencies are counted in buckets of powers of two microseconds,
+        /// bucket 0 is under 1us and bucket i is [2^(i-1),2^i) us. The
+        /// last one also holds everything slower.
+        static const int NUM_BUCKETS = 32;
+
+        /// measures one call, from construction to destruction
+        /**
+         *  While it is alive it is the current call of the thread, so
+         *  that code further down (i.e. a low level reply) can add errors
+         *  and bytes to it with FuseStats::error() and FuseStats::bytes()
+         */
+        class Timer
+        {
+            private:
+                FuseStats*  m_stats;
+                Op          m_op;
+                timespec    m_start;
+                bool        m_error;
+                int64_t     m_bytes;
+                Timer*      m_outer;    ///< the thread's previous timer
+
+            public:
+                Timer( FuseStats& stats, Op op );
+                ~Timer();
+
+                /// record the result of the call, negative is an error
+                template <typename T>
+                T done( T result )
+                {
+                    if( result < 0 )
+                        m_error = true;
+                    return result;
+                }
+
+                /// record the result of a read or write, which is the
+                /// number of bytes transferred
+                template <typename T>
+                T transferred( T result )
+                {
+                    if( result < 0 )
+                        m_error = true;
+                    else
+                        m_bytes += result;
+                    return result;
+                }
+
+                friend class FuseStats;
+        };
+
+    private:
+        /// counters of one operation, only ever written by one thread
+        struct Counters
+        {
+            std::atomic<int64_t>    calls;
+            std::atomic<int64_t>    errors;
+            std::atomic<int64_t>    bytes;
+            std::atomic<int64_t>    totalUs;
+            std::atomic<int64_t>    latency[NUM_BUCKETS];
+        };
+
+        /// the counters of one thread
+        struct Block
+        {
+            FuseStats*  owner;
+            Counters    ops[NUM_OPS];
+            bool        inUse;  ///< a live thread owns it
+            Block*      next;
+        };
+
+        pthread_key_t   m_key;      ///< the calling thread's Block
+        pthreads::Mutex m_mutex;    ///< locks the list of blocks
+        Block*          m_blocks;   ///< blocks of all threads, ever
+
+        /// return the block of the calling thread, assigning one if it
+        /// doesn't have one yet
+        Block* block();
+
+        /// record a call
+        void record( Op op, int64_t us, bool error, int64_t bytes );
+
+        /// destructor of m_key, frees the block for another thread
+        static void releaseBlock( void* block );
+
+    public:
+        FuseStats();
+        ~FuseStats();
+
+        /// return the name of an operation
+        static const char* name( Op op );
+
+        /// count an error in the current call of this thread, if any
+        static void error();
+
+        /// count bytes transferred by the current call of this thread, if
+        /// any
+        static void bytes( int64_t count );
+
+        /// sum the counters of all threads into a message, operations
+        /// which have never been called are left out
+        void fill( messages::FuseStatList* msg );
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // FUSESTATS_H_
@@ -0,0 +1,216 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/InodeTable.cpp
+ *
+ *  @brief  
+ */
+
+#include <vector>
+
+#include "InodeTable.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+InodeTable::InodeTable()
+{
+    m_mutex.init();
+
+    // the root is never forgotten
+    Inode& root  = m_inodes[FUSE_ROOT_ID];
+    root.path    = "/";
+    root.parent  = 0;
+    root.nlookup = 1;
+}
+
+InodeTable::~InodeTable()
+{
+    m_mutex.destroy();
+}
+
+bool InodeTable::path( fuse_ino_t ino, std::string& path )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    InodeMap_t::iterator it = m_inodes.find(ino);
+    if( it == m_inodes.end() )
+        return false;
+
+    path = it->second.path;
+    return true;
+}
+
+bool InodeTable::childPath( fuse_ino_t parent, const char* name,
+                            std::string& path )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    InodeMap_t::iterator it = m_inodes.find(parent);
+    if( it == m_inodes.end() )
+        return false;
+
+    if( parent == FUSE_ROOT_ID )
+        path = "/";
+    else
+        path = it->second.path + "/";
+    path += name;
+    return true;
+}
+
+fuse_ino_t InodeTable::find( fuse_ino_t parent, const char* name )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    ChildMap_t::iterator it = m_children.find( ChildKey_t(parent,name) );
+    if( it == m_children.end() )
+        return 0;
+    return it->second;
+}
+
+void InodeTable::add( fuse_ino_t parent, const char* name, fuse_ino_t ino,
+                      const std::string& path )
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    Inode& inode = m_inodes[ino];
+    if( inode.nlookup == 0 )
+    {
+        inode.path   = path;
+        inode.name   = name;
+        inode.parent = parent;
+    }
+    inode.nlookup++;
+
+    m_children[ ChildKey_t(parent,name) ] = ino;
+}
+
+void InodeTable::forget( fuse_ino_t ino, uint64_t nlookup )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    InodeMap_t::iterator it = m_inodes.find(ino);
+    if( it == m_inodes.end() || ino == FUSE_ROOT_ID )
+        return;
+
+    Inode& inode = it->second;
+    if( inode.nlookup > nlookup )
+    {
+        inode.nlookup -= nlookup;
+        return;
+    }
+
+    // only drop the child index if it still points at this inode
+    ChildMap_t::iterator child =
+            m_children.find( ChildKey_t(inode.parent,inode.name) );
+    if( child != m_children.end() && child->second == ino )
+        m_children.erase(child);
+
+    m_inodes.erase(it);
+}
+
+void InodeTable::remove( fuse_ino_t parent, const char* name )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    m_children.erase( ChildKey_t(parent,name) );
+}
+
+void InodeTable::resolve( const std::string& path, fuse_ino_t& parent,
+                          std::string& name, fuse_ino_t& ino )
+{
+    std::vector<std::string> parts;
+    size_t begin = 0;
+    while( begin < path.size() )
+    {
+        size_t end = path.find( '/', begin );
+        if( end == std::string::npos )
+            end = path.size();
+        if( end > begin )
+            parts.push_back( path.substr( begin, end-begin ) );
+        begin = end+1;
+    }
+
+    parent = 0;
+    ino    = FUSE_ROOT_ID;
+    name.clear();
+    if( parts.empty() )
+        return;
+
+    pthreads::ScopedLock lock(m_mutex);
+
+    fuse_ino_t dir = FUSE_ROOT_ID;
+    for( unsigned int i=0; i+1 < parts.size() && dir; i++ )
+    {
+        ChildMap_t::iterator child =
+                m_children.find( ChildKey_t(dir,parts[i]) );
+        dir = ( child == m_children.end() ) ? 0 : child->second;
+    }
+
+    parent = dir;
+    name   = parts.back();
+    ino    = 0;
+    if( parent )
+    {
+        ChildMap_t::iterator child =
+                m_children.find( ChildKey_t(parent,name) );
+        if( child != m_children.end() )
+            ino = child->second;
+    }
+}
+
+void InodeTable::rename( fuse_ino_t parent, const char* name,
+                         fuse_ino_t newparent, const char* newname )
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    // anything that was at the destination is replaced
+    m_children.erase( ChildKey_t(newparent,newname) );
+
+    ChildMap_t::iterator child = m_children.find( ChildKey_t(parent,name) );
+    if( child == m_children.end() )
+        return;
+
+    fuse_ino_t ino = child->second;
+    m_children.erase(child);
+    m_children[ ChildKey_t(newparent,newname) ] = ino;
+
+    InodeMap_t::iterator iparent = m_inodes.find(newparent);
+    InodeMap_t::iterator inode   = m_inodes.find(ino);
+    if( iparent == m_inodes.end() || inode == m_inodes.end() )
+        return;
+
+    std::string oldPath = inode->second.path;
+    std::string newPath = ( newparent == FUSE_ROOT_ID )
+                            ? "/" : iparent->second.path + "/";
+    newPath += newname;
+
+    inode->second.path   = newPath;
+    inode->second.name   = newname;
+    inode->second.parent = newparent;
+
+    // if it is a directory then everything beneath it moved too
+    std::string prefix = oldPath + "/";
+    for( auto& pair : m_inodes )
+    {
+        std::string& path = pair.second.path;
+        if( path.compare( 0, prefix.size(), prefix ) == 0 )
+            path = newPath + path.substr( oldPath.size() );
+    }
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
@@ -0,0 +1,115 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/InodeTable.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_INODETABLE_H_
+#define OPENBOOK_FS_INODETABLE_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <stdint.h>
+
+#include <cpp-pthreads.h>
+
+#include "fuse_include.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+/// the inodes that the kernel knows about, for the low level fuse frontend
+/**
+ *  Inode numbers are the ids of the files table, so they are stable for
+ *  the life of the database. Each inode remembers it's path (relative to
+ *  the mount) and how many lookups the kernel holds on it. An entry is
+ *  dropped once the kernel forgets all of them. Children are indexed by
+ *  (parent, name) so that repeated lookups don't go to the database.
+ */
+class InodeTable
+{
+    private:
+        struct Inode
+        {
+            std::string     path;       ///< path relative to the mount
+            std::string     name;       ///< name in the parent directory
+            fuse_ino_t      parent;     ///< parent inode
+            uint64_t        nlookup;    ///< lookups the kernel holds
+        };
+
+        typedef std::map<fuse_ino_t,Inode>                      InodeMap_t;
+        typedef std::pair<fuse_ino_t,std::string>               ChildKey_t;
+        typedef std::map<ChildKey_t,fuse_ino_t>                 ChildMap_t;
+
+        pthreads::Mutex m_mutex;    ///< locks everything below
+        InodeMap_t      m_inodes;   ///< inodes by number
+        ChildMap_t      m_children; ///< inodes by (parent,name)
+
+    public:
+        InodeTable();
+        ~InodeTable();
+
+        /// get the path of an inode, returns false if the kernel has
+        /// forgotten it
+        bool path( fuse_ino_t ino, std::string& path );
+
+        /// get the path of an entry in a directory, returns false if the
+        /// directory isn't known
+        bool childPath( fuse_ino_t parent, const char* name,
+                        std::string& path );
+
+        /// return the inode of an entry in a directory if it is in the
+        /// table, or 0 if it isn't
+        fuse_ino_t find( fuse_ino_t parent, const char* name );
+
+        /// record a lookup of an entry (the kernel now holds one more
+        /// reference to @p ino)
+        void add( fuse_ino_t parent, const char* name, fuse_ino_t ino,
+                  const std::string& path );
+
+        /// drop @p nlookup references to an inode
+        void forget( fuse_ino_t ino, uint64_t nlookup );
+
+        /// an entry has been removed from a directory, the inode stays
+        /// valid until it is forgotten
+        void remove( fuse_ino_t parent, const char* name );
+
+        /// find the inodes of a path (relative to the mount) by walking
+        /// it's components. @p parent is set to the inode of it's
+        /// directory and @p ino to it's own inode, either is 0 if the
+        /// kernel doesn't know it. @p name is set to the last component.
+        void resolve( const std::string& path, fuse_ino_t& parent,
+                      std::string& name, fuse_ino_t& ino );
+
+        /// an entry has been moved, paths of it and anything beneath it
+        /// are updated
+        void rename( fuse_ino_t parent, const char* name,
+                     fuse_ino_t newparent, const char* newname );
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // INODETABLE_H_
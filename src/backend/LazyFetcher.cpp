@@ -0,0 +1,879 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/LazyFetcher.cpp
+ *
+ *  @brief  
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "LazyFetcher.h"
+#include "Backend.h"
+#include "ExceptionStream.h"
+#include "messages.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+const int64_t LazyFetcher::BLOCK_SIZE;
+const int64_t LazyFetcher::MAP_HEADER;
+const int64_t LazyFetcher::REQUEST_TIMEOUT_MS;
+
+static inline bool testBit( const LazyFetcher::Bitmap_t& bits, int64_t i )
+{
+    return bits[i/8] & ( 1 << (i%8) );
+}
+
+static inline void setBit( LazyFetcher::Bitmap_t& bits, int64_t i, bool val )
+{
+    if( val )
+        bits[i/8] |=  ( 1 << (i%8) );
+    else
+        bits[i/8] &= ~( 1 << (i%8) );
+}
+
+/// number of blocks in a file of @p size bytes
+static inline int64_t numBlocks( int64_t size )
+{
+    return ( size + LazyFetcher::BLOCK_SIZE - 1 ) / LazyFetcher::BLOCK_SIZE;
+}
+
+LazyFetcher::LazyFetcher( Backend* backend ):
+    m_backend(backend),
+    m_nextRequest(0),
+    m_quota(1024*1024*1024),
+    m_fds(16)
+{
+    m_mapMutex.init();
+    m_mutex.init();
+    m_cond.init();
+}
+
+LazyFetcher::~LazyFetcher()
+{
+    m_mapMutex.destroy();
+    m_mutex.destroy();
+    m_cond.destroy();
+}
+
+LazyFetcher::Path_t LazyFetcher::cachePath( int64_t fileId )
+{
+    std::stringstream name;
+    name << fileId;
+    return m_cacheDir / name.str();
+}
+
+LazyFetcher::Path_t LazyFetcher::mapPath( int64_t fileId )
+{
+    std::stringstream name;
+    name << fileId << ".map";
+    return m_cacheDir / name.str();
+}
+
+bool LazyFetcher::lockless_load( int64_t fileId, CachedFile& file )
+{
+    namespace fs = boost::filesystem;
+
+    Path_t dataPath = cachePath(fileId);
+    if( !fs::exists(dataPath) )
+        return false;
+
+    std::ifstream in( mapPath(fileId).string().c_str(), std::ios::binary );
+    int64_t header[2];
+    in.read( (char*)header, MAP_HEADER );
+    if( !in || header[0] < 0 )
+        return false;
+
+    // if the cache file was truncated the map is meaningless
+    if( (int64_t)fs::file_size(dataPath) != header[0] )
+        return false;
+
+    file.peer  = -1;
+    file.size  = header[0];
+    file.mtime = header[1];
+    file.failed.clear();
+    file.present.assign( (numBlocks(file.size) + 7)/8, 0 );
+    file.pending.assign( file.present.size(), 0 );
+
+    if( file.present.size() > 0 )
+        in.read( (char*)&file.present[0], file.present.size() );
+    return (bool)in;
+}
+
+void LazyFetcher::lockless_reset( int64_t fileId, CachedFile& file,
+                                  int64_t size, int64_t mtime )
+{
+    // forget any blocks we had
+    int64_t nBlocks = 8*file.present.size();
+    for( int64_t i=0; i < nBlocks; i++ )
+    {
+        LruMap_t::iterator it = m_lruMap.find( BlockId_t(fileId,i) );
+        if( it != m_lruMap.end() )
+        {
+            m_lru.erase( it->second );
+            m_lruMap.erase( it );
+        }
+    }
+
+    file.size  = size;
+    file.mtime = mtime;
+    file.failed.clear();
+    file.present.assign( (numBlocks(size) + 7)/8, 0 );
+    file.pending.assign( file.present.size(), 0 );
+
+    // create an empty sparse file of the right size. The old files are
+    // unlinked rather than truncated, so that a write which is still in
+    // flight without the lock lands in the file it was meant for.
+    Path_t dataPath = cachePath(fileId);
+    Path_t mapFile  = mapPath(fileId);
+    m_fds.evict( dataPath.string() );
+    m_fds.evict( mapFile.string() );
+    ::unlink( dataPath.c_str() );
+    ::unlink( mapFile.c_str() );
+
+    int fd = ::open( dataPath.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0600 );
+    if( fd < 0 )
+        codedExcept(errno)() << "LazyFetcher: failed to create " << dataPath;
+    int result = ::ftruncate( fd, size );
+    ::close(fd);
+    if( result < 0 )
+        codedExcept(errno)() << "LazyFetcher: failed to size " << dataPath;
+
+    // and a map with no blocks present
+    std::ofstream out( mapFile.string().c_str(),
+                       std::ios::binary | std::ios::trunc );
+    int64_t header[2] = { size, mtime };
+    out.write( (const char*)header, MAP_HEADER );
+    if( file.present.size() > 0 )
+        out.write( (const char*)&file.present[0], file.present.size() );
+    if( !out )
+        ex()() << "LazyFetcher: failed to write " << mapFile;
+}
+
+void LazyFetcher::lockless_setPresent( int64_t fileId, CachedFile& file,
+                                       int64_t block, bool present )
+{
+    setBit( file.present, block, present );
+    m_dirtyMaps.insert( fileId );
+
+    if( present )
+        lockless_touch( fileId, block );
+    else
+    {
+        LruMap_t::iterator it = m_lruMap.find( BlockId_t(fileId,block) );
+        if( it != m_lruMap.end() )
+        {
+            m_lru.erase( it->second );
+            m_lruMap.erase( it );
+        }
+    }
+}
+
+void LazyFetcher::flushMaps()
+{
+    // the bitmaps are copied and written in the same order, so the last
+    // write of a map file is of the newest bitmap
+    pthreads::ScopedLock mapLock(m_mapMutex);
+
+    typedef std::pair<FdCache::FdPtr_t,Bitmap_t> MapWrite_t;
+    std::vector<MapWrite_t> writes;
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        for( int64_t fileId : m_dirtyMaps )
+        {
+            CacheMap_t::iterator ifile = m_files.find( fileId );
+            if( ifile == m_files.end() || ifile->second.present.empty() )
+                continue;
+
+            // if the file is reset before we write, the write goes to the
+            // map file that was unlinked
+            writes.push_back( MapWrite_t(
+                    m_fds.get( mapPath(fileId).string(), O_RDWR ),
+                    ifile->second.present ) );
+        }
+        m_dirtyMaps.clear();
+    }
+
+    for( auto& write : writes )
+    {
+        if( ::pwrite( *write.first, &write.second[0], write.second.size(),
+                      MAP_HEADER ) < 0 )
+            codedExcept(errno)() << "LazyFetcher: failed to write map file";
+    }
+}
+
+void LazyFetcher::lockless_touch( int64_t fileId, int64_t block )
+{
+    BlockId_t id(fileId,block);
+    LruMap_t::iterator it = m_lruMap.find(id);
+    if( it != m_lruMap.end() )
+        m_lru.erase( it->second );
+
+    m_lru.push_front(id);
+    m_lruMap[id] = m_lru.begin();
+}
+
+void LazyFetcher::lockless_evict( PunchList_t& punches )
+{
+    while( !m_lru.empty() && (int64_t)m_lru.size() * BLOCK_SIZE > m_quota )
+    {
+        BlockId_t id = m_lru.back();
+        CacheMap_t::iterator ifile = m_files.find( id.first );
+        if( ifile == m_files.end() )
+        {
+            m_lruMap.erase(id);
+            m_lru.pop_back();
+            continue;
+        }
+
+        CachedFile& file = ifile->second;
+        Punch punch;
+        punch.fd     = m_fds.get( cachePath(id.first).string(), O_RDWR );
+        punch.fileId = id.first;
+        punch.block  = id.second;
+        punch.size   = file.size;
+        punch.mtime  = file.mtime;
+        punches.push_back( punch );
+
+        lockless_setPresent( id.first, file, id.second, false );
+        setBit( file.pending, id.second, true );
+    }
+}
+
+void LazyFetcher::punch( PunchList_t& punches )
+{
+    if( punches.empty() )
+        return;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // give the blocks' disk space back, if the filesystem can't punch
+    // holes the space is reclaimed when the file is reset
+    for( auto& punch : punches )
+    {
+        if( fallocate( *punch.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                       punch.block * BLOCK_SIZE, BLOCK_SIZE ) < 0
+                && errno != EOPNOTSUPP )
+        {
+            std::cerr << "LazyFetcher: failed to punch block " << punch.block
+                      << " of file " << punch.fileId << ", errno " << errno
+                      << "\n";
+        }
+    }
+#endif
+
+    // the blocks may be requested again, unless the file was reset in the
+    // mean time and they're something else now
+    pthreads::ScopedLock lock(m_mutex);
+    for( auto& punch : punches )
+    {
+        CacheMap_t::iterator ifile = m_files.find( punch.fileId );
+        if( ifile != m_files.end()
+                && ifile->second.size  == punch.size
+                && ifile->second.mtime == punch.mtime )
+            setBit( ifile->second.pending, punch.block, false );
+    }
+    punches.clear();
+    m_cond.broadcast();
+}
+
+void LazyFetcher::setCacheDir( const Path_t& dir )
+{
+    namespace fs = boost::filesystem;
+
+    PunchList_t punches;
+    {
+        pthreads::ScopedLock lock(m_mutex);
+
+        m_fds.clear();
+        m_files.clear();
+        m_requests.clear();
+        m_lru.clear();
+        m_lruMap.clear();
+        m_dirtyMaps.clear();
+        m_cacheDir = dir;
+
+        if( !fs::exists(m_cacheDir) )
+        {
+            std::cout << "creating cache directory: "
+                      << fs::absolute( m_cacheDir )
+                      << std::endl;
+            if( !fs::create_directories( m_cacheDir ) )
+                ex()() << "failed to create cache directory: " << m_cacheDir;
+            return;
+        }
+
+        // load the maps of everything that is cached, we don't know the
+        // order in which the blocks were read so they are all equally old
+        std::vector<Path_t> orphans;
+        for( fs::directory_iterator it(m_cacheDir), end; it != end; ++it )
+        {
+            Path_t path = it->path();
+            if( path.extension() != ".map" )
+            {
+                if( !fs::exists( Path_t(path.string() + ".map") ) )
+                    orphans.push_back(path);
+                continue;
+            }
+
+            char* numEnd = 0;
+            std::string stem = path.stem().string();
+            int64_t fileId = strtoll( stem.c_str(), &numEnd, 10 );
+
+            CachedFile file;
+            if( stem.empty() || *numEnd != '\0'
+                    || !lockless_load( fileId, file ) )
+            {
+                orphans.push_back(path);
+                orphans.push_back( cachePath(fileId) );
+                continue;
+            }
+
+            int64_t nBlocks = numBlocks(file.size);
+            for( int64_t i=0; i < nBlocks; i++ )
+            {
+                if( testBit(file.present,i) )
+                {
+                    m_lru.push_back( BlockId_t(fileId,i) );
+                    m_lruMap[ m_lru.back() ] = --m_lru.end();
+                }
+            }
+            m_files[fileId] = file;
+        }
+
+        for( auto& path : orphans )
+            fs::remove( path );
+
+        std::cout << "LazyFetcher: " << m_files.size() << " files, "
+                  << m_lru.size() << " blocks in cache\n";
+        lockless_evict( punches );
+    }
+
+    punch( punches );
+    flushMaps();
+}
+
+void LazyFetcher::setQuota( int64_t bytes )
+{
+    PunchList_t punches;
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        std::cout << "LazyFetcher: cache quota: " << bytes << "\n";
+        m_quota = bytes;
+        lockless_evict( punches );
+    }
+
+    punch( punches );
+    flushMaps();
+}
+
+int64_t LazyFetcher::quota()
+{
+    pthreads::ScopedLock lock(m_mutex);
+    return m_quota;
+}
+
+LazyFetcher::CachedFile& LazyFetcher::lockless_getFile(
+        const Path_t& path, int64_t fileId, int64_t peer,
+        int64_t size, int64_t mtime )
+{
+    CacheMap_t::iterator it = m_files.find( fileId );
+    if( it != m_files.end()
+            && it->second.size  == size
+            && it->second.mtime == mtime )
+    {
+        // blocks that are still pending from another peer would never be
+        // requested from this one
+        CachedFile& file = it->second;
+        if( file.peer != peer )
+        {
+            RequestMap_t::iterator ireq = m_requests.begin();
+            while( ireq != m_requests.end() )
+            {
+                if( ireq->second.fileId == fileId
+                        && ireq->second.peer != peer )
+                {
+                    setBit( file.pending, ireq->second.block, false );
+                    m_requests.erase( ireq++ );
+                }
+                else
+                    ++ireq;
+            }
+            file.peer = peer;
+
+            // readers waiting on the dropped requests have to make them
+            // again
+            m_cond.broadcast();
+        }
+        return file;
+    }
+
+    if( it == m_files.end() )
+        it = m_files.insert( CacheMap_t::value_type(fileId,
+                                                    CachedFile()) ).first;
+
+    // the remote file has changed (or is new) so anything we have or
+    // have asked for is stale
+    RequestMap_t::iterator ireq = m_requests.begin();
+    while( ireq != m_requests.end() )
+    {
+        if( ireq->second.fileId == fileId )
+            m_requests.erase( ireq++ );
+        else
+            ++ireq;
+    }
+
+    CachedFile& file = it->second;
+    lockless_reset( fileId, file, size, mtime );
+    file.peer = peer;
+    return file;
+}
+
+bool LazyFetcher::lockless_pickSource(
+        const std::vector<Database::RemoteFile>& sources,
+        Database::RemoteFile& source )
+{
+    for( auto& candidate : sources )
+    {
+        // a failure only counts against the version it happened with
+        CacheMap_t::iterator ifile = m_files.find( candidate.fileId );
+        if( ifile != m_files.end()
+                && ifile->second.size  == candidate.size
+                && ifile->second.mtime == candidate.mtime
+                && ifile->second.failed.count( candidate.peer ) )
+            continue;
+
+        source = candidate;
+        return true;
+    }
+    return false;
+}
+
+void LazyFetcher::lockless_fail( int64_t fileId, CachedFile& file )
+{
+    file.failed.insert( file.peer );
+    m_cond.broadcast();
+
+    RequestMap_t::iterator ireq = m_requests.begin();
+    while( ireq != m_requests.end() )
+    {
+        if( ireq->second.fileId == fileId && ireq->second.peer == file.peer )
+        {
+            setBit( file.pending, ireq->second.block, false );
+            m_requests.erase( ireq++ );
+        }
+        else
+            ++ireq;
+    }
+}
+
+void LazyFetcher::lockless_request( const Path_t& path, int64_t fileId,
+                                    CachedFile& file,
+                                    int64_t first, int64_t last,
+                                    Outbox_t& outbox )
+{
+    for( int64_t i = first; i <= last; i++ )
+    {
+        if( testBit(file.present,i) || testBit(file.pending,i) )
+            continue;
+
+        Request req;
+        req.path     = path.string();
+        req.fileId   = fileId;
+        req.peer     = file.peer;
+        req.block    = i;
+        req.received = 0;
+        req.sent     = JobWorker::clock();
+
+        int64_t begin = i*BLOCK_SIZE;
+        messages::RequestFile* msg = new messages::RequestFile();
+        msg->set_path( req.path );
+        msg->set_offset( begin );
+        msg->set_length( std::min( BLOCK_SIZE, file.size - begin ) );
+        msg->set_request( m_nextRequest );
+        outbox.push_back( Outgoing_t(file.peer,msg) );
+
+        m_requests[ m_nextRequest++ ] = req;
+        setBit( file.pending, i, true );
+    }
+}
+
+bool LazyFetcher::send( Outbox_t& outbox )
+{
+    bool sent = true;
+    for( auto& out : outbox )
+    {
+        if( !m_backend->sendMessage( out.first, out.second, PRIO_SYNC ) )
+        {
+            delete out.second;
+            sent = false;
+        }
+    }
+    outbox.clear();
+    return sent;
+}
+
+bool LazyFetcher::stat( const Path_t& path, int64_t& size, int64_t& mtime )
+{
+    std::vector<Database::RemoteFile> sources;
+    m_backend->db().getRemoteFiles( path, sources );
+    if( sources.empty() )
+        return false;
+
+    size  = sources[0].size;
+    mtime = sources[0].mtime;
+    return true;
+}
+
+bool LazyFetcher::stat( int64_t fileId, int64_t& size, int64_t& mtime )
+{
+    std::vector<Database::RemoteFile> sources;
+    m_backend->db().getRemoteFiles( fileId, sources );
+    if( sources.empty() )
+        return false;
+
+    size  = sources[0].size;
+    mtime = sources[0].mtime;
+    return true;
+}
+
+int LazyFetcher::read( const Path_t& path, char* buf, size_t bufsize,
+                        off_t offset )
+{
+    // find the peers to fetch from, preferring connected ones
+    std::vector<Database::RemoteFile> sources;
+    m_backend->db().getRemoteFiles( path, sources );
+    if( sources.empty() )
+        return -ENOENT;
+
+    std::vector<Database::RemoteFile> ordered;
+    for( auto& candidate : sources )
+        if( m_backend->isConnected( candidate.peer ) )
+            ordered.push_back( candidate );
+    for( auto& candidate : sources )
+        if( !m_backend->isConnected( candidate.peer ) )
+            ordered.push_back( candidate );
+
+    // only fail over to peers with the same version, so a read never
+    // mixes the contents of two versions
+    std::vector<Database::RemoteFile> same;
+    for( auto& candidate : ordered )
+        if( candidate.size  == ordered[0].size
+                && candidate.mtime == ordered[0].mtime )
+            same.push_back( candidate );
+    ordered.swap(same);
+
+    Database::RemoteFile source;
+
+    try
+    {
+        while( true )
+        {
+            int64_t  end, first, last;
+            bool     ready = false;
+            Outbox_t outbox;
+            {
+                pthreads::ScopedLock lock(m_mutex);
+
+                if( !lockless_pickSource( ordered, source ) )
+                {
+                    std::cerr << "LazyFetcher: no peer can serve " << path
+                              << "\n";
+                    return -EIO;
+                }
+
+                CachedFile& file = lockless_getFile( path, source.fileId,
+                                                 source.peer, source.size,
+                                                 source.mtime );
+                if( offset >= file.size )
+                    return 0;
+
+                end   = std::min( (int64_t)(offset + bufsize), file.size );
+                first = offset / BLOCK_SIZE;
+                last  = (end - 1) / BLOCK_SIZE;
+
+                // request what we don't have of the blocks the read
+                // covers, or if it's all been requested then wait until
+                // data arrives or the source fails (see expire())
+                int64_t missing = first;
+                while( missing <= last && testBit(file.present,missing) )
+                    missing++;
+
+                if( missing > last )
+                {
+                    for( int64_t i = first; i <= last; i++ )
+                        lockless_touch( source.fileId, i );
+                    ready = true;
+                }
+                else
+                {
+                    lockless_request( path, source.fileId, file,
+                                      missing, last, outbox );
+                    if( outbox.empty() )
+                        m_cond.wait(m_mutex);
+                }
+            }
+
+            // requests are sent without the lock, if they can't be then
+            // try the next peer with the same version
+            if( !send(outbox) )
+            {
+                std::cerr << "LazyFetcher: can't fetch " << path
+                          << " from peer " << source.peer << "\n";
+
+                pthreads::ScopedLock lock(m_mutex);
+                CacheMap_t::iterator ifile = m_files.find( source.fileId );
+                if( ifile != m_files.end()
+                        && ifile->second.peer == source.peer )
+                    lockless_fail( source.fileId, ifile->second );
+                continue;
+            }
+
+            if( !ready )
+                continue;
+
+            Path_t dataPath = cachePath( source.fileId );
+            FdCache::FdPtr_t fd = m_fds.get( dataPath.string(), O_RDWR );
+            int result = ::pread( *fd, buf, end - offset, offset );
+            if( result < 0 )
+                return -errno;
+
+            // if a block was evicted while we were reading it, read again
+            pthreads::ScopedLock lock(m_mutex);
+            CacheMap_t::iterator ifile = m_files.find( source.fileId );
+            bool intact = ( ifile != m_files.end() );
+            for( int64_t i = first; i <= last && intact; i++ )
+                intact = ( i < numBlocks(ifile->second.size) )
+                            && testBit(ifile->second.present,i);
+            if( intact )
+                return result;
+        }
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "LazyFetcher::read(" << path << ") failed: "
+                  << ex.what() << "\n";
+        return -EIO;
+    }
+}
+
+bool LazyFetcher::merge( int peer, messages::FileChunk* chunk )
+{
+    if( !chunk->has_request() )
+        return false;
+
+    std::string         path;
+    int64_t             begin, end;
+    FdCache::FdPtr_t    fd;
+    try
+    {
+        pthreads::ScopedLock lock(m_mutex);
+
+        // the request may have been superseded
+        RequestMap_t::iterator ireq = m_requests.find( chunk->request() );
+        if( ireq == m_requests.end() || ireq->second.peer != peer )
+            return true;
+
+        Request& req = ireq->second;
+        CacheMap_t::iterator ifile = m_files.find( req.fileId );
+        if( ifile == m_files.end() )
+        {
+            m_requests.erase(ireq);
+            return true;
+        }
+        CachedFile& file = ifile->second;
+
+        int64_t blockBegin = req.block * BLOCK_SIZE;
+        int64_t blockEnd   = std::min( blockBegin + BLOCK_SIZE, file.size );
+
+        // an error means the peer can't serve the file at all, and an
+        // empty chunk short of the end of the block means the peer's copy
+        // is shorter than we thought, so it has changed
+        if( chunk->error()
+                || ( chunk->data().size() == 0
+                        && chunk->offset() < blockEnd ) )
+        {
+            std::cerr << "LazyFetcher: peer " << peer << " can't serve "
+                      << req.path << ", it's copy has changed or is gone\n";
+            if( file.peer == peer )
+                lockless_fail( req.fileId, file );
+            else
+            {
+                setBit( file.pending, req.block, false );
+                m_requests.erase(ireq);
+            }
+            m_cond.broadcast();
+            return true;
+        }
+
+        path  = req.path;
+        begin = std::max( chunk->offset(), blockBegin );
+        end   = std::min( chunk->offset() + (int64_t)chunk->data().size(),
+                          blockEnd );
+        if( end > begin )
+            fd = m_fds.get( cachePath( req.fileId ).string(), O_RDWR );
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "LazyFetcher::merge(" << chunk->path() << ") failed: "
+                  << ex.what() << "\n";
+        return true;
+    }
+
+    // the data is written without the lock. If the request is dropped in
+    // the mean time and made again of another peer, that peer has the
+    // same version so it sends the same bytes. If the file is reset then
+    // the write lands in the cache file that was unlinked.
+    int64_t written = 0;
+    if( fd )
+    {
+        written = ::pwrite( *fd, &chunk->data()[begin - chunk->offset()],
+                            end - begin, begin );
+        if( written < 0 )
+        {
+            std::cerr << "LazyFetcher::merge(" << path << ") failed to "
+                         "write the cache file, errno " << errno << "\n";
+            return true;
+        }
+    }
+
+    PunchList_t punches;
+    try
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        m_cond.broadcast();
+
+        RequestMap_t::iterator ireq = m_requests.find( chunk->request() );
+        CacheMap_t::iterator   ifile;
+        if( ireq != m_requests.end()
+                && ( ifile = m_files.find( ireq->second.fileId ) )
+                        != m_files.end() )
+        {
+            Request&    req  = ireq->second;
+            CachedFile& file = ifile->second;
+            int64_t blockBegin = req.block * BLOCK_SIZE;
+            int64_t blockEnd   = std::min( blockBegin + BLOCK_SIZE,
+                                           file.size );
+
+            // if the whole block has arrived then it is done
+            req.received += written;
+            if( req.received >= blockEnd - blockBegin )
+            {
+                setBit( file.pending, req.block, false );
+                lockless_setPresent( req.fileId, file, req.block, true );
+                m_requests.erase(ireq);
+                lockless_evict( punches );
+            }
+        }
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "LazyFetcher::merge(" << path << ") failed: "
+                  << ex.what() << "\n";
+    }
+
+    try
+    {
+        punch( punches );
+        flushMaps();
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "LazyFetcher::merge(" << path << ") failed: "
+                  << ex.what() << "\n";
+    }
+
+    return true;
+}
+
+void LazyFetcher::peerLost( int peer )
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    RequestMap_t::iterator ireq = m_requests.begin();
+    while( ireq != m_requests.end() )
+    {
+        if( ireq->second.peer == peer )
+        {
+            CacheMap_t::iterator ifile = m_files.find( ireq->second.fileId );
+            if( ifile != m_files.end() )
+                setBit( ifile->second.pending, ireq->second.block, false );
+            m_requests.erase( ireq++ );
+        }
+        else
+            ++ireq;
+    }
+
+    m_cond.broadcast();
+}
+
+
+void LazyFetcher::expire()
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    // (fileId, peer) of the late requests, collected first because
+    // failing a source drops it's other requests too
+    typedef std::pair<int64_t,int64_t> SourceId_t;
+    std::set<SourceId_t> late;
+
+    int64_t now = JobWorker::clock();
+    RequestMap_t::iterator ireq = m_requests.begin();
+    while( ireq != m_requests.end() )
+    {
+        const Request& req = ireq->second;
+        if( now - req.sent <= REQUEST_TIMEOUT_MS*1000 )
+        {
+            ++ireq;
+            continue;
+        }
+
+        CacheMap_t::iterator ifile = m_files.find( req.fileId );
+        if( ifile != m_files.end() && ifile->second.peer == req.peer )
+        {
+            late.insert( SourceId_t(req.fileId,req.peer) );
+            ++ireq;
+        }
+        else
+            m_requests.erase( ireq++ );
+    }
+
+    for( auto& id : late )
+    {
+        std::cerr << "LazyFetcher: peer " << id.second
+                  << " didn't answer for file " << id.first << "\n";
+        lockless_fail( id.first, m_files[id.first] );
+    }
+
+    if( !late.empty() )
+        m_cond.broadcast();
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
@@ -0,0 +1,260 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/LazyFetcher.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_LAZYFETCHER_H_
+#define OPENBOOK_FS_LAZYFETCHER_H_
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <boost/filesystem.hpp>
+#include <cpp-pthreads.h>
+
+#include "Database.h"
+#include "FdCache.h"
+#include "messages.pb.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+class Backend;
+
+/// serves reads of files that we are not subscribed to by fetching the
+/// blocks they cover from a peer that has the file
+/**
+ *  Fetched data is kept in a sparse cache file per remote file, named by
+ *  the file's id, in the cache directory. Next to it is a map file
+ *  holding the size and mtime of the remote copy and a bitmap of which
+ *  BLOCK_SIZE blocks are in the cache file, so the cache survives a
+ *  restart.
+ *
+ *  A read blocks until the blocks it covers have arrived. Each missing
+ *  block is requested with a RequestFile message and the peer answers
+ *  with FileChunk messages carrying the request id. If the peer can't
+ *  serve the request, answers with an error, or doesn't answer within
+ *  REQUEST_TIMEOUT_MS (see expire()), then the read moves on to another
+ *  peer with the same version of the file. When the cache holds more than
+ *  the quota, least recently read blocks are punched out of their cache
+ *  files.
+ *
+ *  The cache and map files are written, and requests are sent, without
+ *  holding the lock so that a slow disk doesn't hold up readers of blocks
+ *  that are already cached.
+ */
+class LazyFetcher
+{
+    public:
+        typedef boost::filesystem::path     Path_t;
+        typedef std::vector<uint8_t>        Bitmap_t;
+
+        /// files are cached and fetched in blocks of this many bytes, no
+        /// single request is for more than one block
+        static const int64_t BLOCK_SIZE = 256*1024;
+
+        /// size of the map file header (remote size and mtime)
+        static const int64_t MAP_HEADER = 2*sizeof(int64_t);
+
+        /// a request that hasn't been answered after this long fails
+        static const int64_t REQUEST_TIMEOUT_MS = 10000;
+
+    private:
+        /// a remote file that is (partially) cached
+        struct CachedFile
+        {
+            int64_t     peer;       ///< peer we're fetching from
+            int64_t     size;       ///< size of the remote file
+            int64_t     mtime;      ///< modification time of the remote file
+            Bitmap_t    present;    ///< blocks in the cache file
+            Bitmap_t    pending;    ///< blocks requested but not received
+            std::set<int64_t> failed;   ///< peers which couldn't serve
+                                        ///  this version of the file
+        };
+
+        /// an outstanding RequestFile, for one block
+        struct Request
+        {
+            std::string path;       ///< the file requested
+            int64_t     fileId;     ///< our id for the file
+            int64_t     peer;       ///< who it was requested from
+            int64_t     block;      ///< the block requested
+            int64_t     received;   ///< bytes of the block received so far
+            int64_t     sent;       ///< JobWorker::clock() when requested
+        };
+
+        /// a cached block, (fileId, block)
+        typedef std::pair<int64_t,int64_t>              BlockId_t;
+        typedef std::list<BlockId_t>                    LruList_t;
+        typedef std::map<BlockId_t,LruList_t::iterator> LruMap_t;
+
+        /// a block that was evicted but is still to be punched out of
+        /// it's cache file, it's pending until then so that it isn't
+        /// requested again
+        struct Punch
+        {
+            FdCache::FdPtr_t    fd;     ///< the cache file
+            int64_t     fileId;     ///< our id for the file
+            int64_t     block;      ///< the block evicted
+            int64_t     size;       ///< size of the file when evicted
+            int64_t     mtime;      ///< mtime of the file when evicted
+        };
+
+        typedef std::map<int64_t,CachedFile>        CacheMap_t;
+        typedef std::map<int64_t,Request>           RequestMap_t;
+        typedef std::vector<Punch>                  PunchList_t;
+        typedef std::pair<int64_t,messages::RequestFile*> Outgoing_t;
+        typedef std::vector<Outgoing_t>             Outbox_t;
+
+        Backend*            m_backend;
+        Path_t              m_cacheDir;     ///< where cache files live
+        pthreads::Mutex     m_mapMutex;     ///< serializes flushMaps(), is
+                                            ///  taken before m_mutex
+        pthreads::Mutex     m_mutex;        ///< locks everything below
+        pthreads::Condition m_cond;         ///< signalled when data arrives
+        CacheMap_t          m_files;        ///< cached files by id
+        RequestMap_t        m_requests;     ///< outstanding requests by id
+        int64_t             m_nextRequest;  ///< id of the next request
+        int64_t             m_quota;        ///< max bytes of cached blocks
+        LruList_t           m_lru;          ///< cached blocks, most
+                                            ///  recently read first
+        LruMap_t            m_lruMap;       ///< position of blocks in m_lru
+        FdCache             m_fds;          ///< open cache files
+        std::set<int64_t>   m_dirtyMaps;    ///< files whose map file is
+                                            ///  behind their bitmap
+
+        /// path to the cache file for a file id
+        Path_t cachePath( int64_t fileId );
+
+        /// path to the map file for a file id
+        Path_t mapPath( int64_t fileId );
+
+        /// read the map file of a file id, returns false if it is missing
+        /// or doesn't match the cache file
+        bool lockless_load( int64_t fileId, CachedFile& file );
+
+        /// discard the cached contents of a file and start an empty cache
+        /// file and map of the given size
+        void lockless_reset( int64_t fileId, CachedFile& file,
+                             int64_t size, int64_t mtime );
+
+        /// mark a block as present or not, the map file is written by the
+        /// next flushMaps()
+        void lockless_setPresent( int64_t fileId, CachedFile& file,
+                                  int64_t block, bool present );
+
+        /// write the bitmaps which have changed to their map files, must
+        /// be called without the lock
+        void flushMaps();
+
+        /// move a block to the front of the eviction order
+        void lockless_touch( int64_t fileId, int64_t block );
+
+        /// evict least recently read blocks until the cache is within
+        /// the quota, they are added to @p punches to be punched out of
+        /// their cache files once the lock is released
+        void lockless_evict( PunchList_t& punches );
+
+        /// punch evicted blocks out of their cache files, must be called
+        /// without the lock
+        void punch( PunchList_t& punches );
+
+        /// find the cache entry for a file, creating it or discarding
+        /// stale contents if the remote file has changed
+        CachedFile& lockless_getFile( const Path_t& path, int64_t fileId,
+                                      int64_t peer, int64_t size,
+                                      int64_t mtime );
+
+        /// choose the first of @p sources (which are in order of
+        /// preference) that hasn't failed to serve the version we have
+        /// cached, returns false if they all have
+        bool lockless_pickSource(
+                const std::vector<Database::RemoteFile>& sources,
+                Database::RemoteFile& source );
+
+        /// give up on the current source of a file, outstanding requests
+        /// to it are dropped and waiting readers move on to another peer
+        void lockless_fail( int64_t fileId, CachedFile& file );
+
+        /// request the blocks in [first,last] of a file which are neither
+        /// present nor pending, messages are added to @p outbox to be sent
+        /// once the lock is released
+        void lockless_request( const Path_t& path, int64_t fileId,
+                               CachedFile& file,
+                               int64_t first, int64_t last,
+                               Outbox_t& outbox );
+
+        /// send requests, returns false if any of them couldn't be sent
+        bool send( Outbox_t& outbox );
+
+    public:
+        LazyFetcher( Backend* backend );
+        ~LazyFetcher();
+
+        /// set the directory where cache files are stored and load the
+        /// maps of files cached there
+        void setCacheDir( const Path_t& dir );
+
+        /// set the maximum number of bytes of cached blocks
+        void setQuota( int64_t bytes );
+
+        /// return the maximum number of bytes of cached blocks
+        int64_t quota();
+
+        /// get the size and modification time of an unsubscribed file
+        /// from one of it's remote sources, returns false if no peer
+        /// has told us about it
+        bool stat( const Path_t& path, int64_t& size, int64_t& mtime );
+
+        /// stat() of a file by it's id in the files table
+        bool stat( int64_t fileId, int64_t& size, int64_t& mtime );
+
+        /// read from an unsubscribed file, blocking until the requested
+        /// range has been fetched. Returns the number of bytes read or
+        /// -errno
+        int read( const Path_t& path, char* buf, size_t bufsize, off_t offset );
+
+        /// store a file chunk that was sent in response to a RequestFile,
+        /// returns false if @p chunk isn't such a chunk
+        bool merge( int peer, messages::FileChunk* chunk );
+
+        /// forget about requests made to a peer which has disconnected,
+        /// readers waiting on them fail and later reads go to another peer
+        void peerLost( int peer );
+
+        /// fail requests that have been outstanding for longer than
+        /// REQUEST_TIMEOUT_MS, called periodically by jobs::ExpireFetches
+        void expire();
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // LAZYFETCHER_H_
@@ -24,14 +24,32 @@
  *  @brief  
  */
 
+#include <algorithm>
 #include <iostream>
+#include <ctime>
+#include <unistd.h>
 #include "LongJob.h"
+#include "SelectSpec.h"
 
 
 namespace   openbook {
 namespace filesystem {
 
-JobWorker::JobWorker()
+/// cpu-bound jobs get at most one worker per core
+static int cpuSlots( int nWorkers )
+{
+    int nCores = sysconf( _SC_NPROCESSORS_ONLN );
+    if( nCores < 1 )
+        nCores = 1;
+    return std::min( nWorkers, nCores );
+}
+
+JobWorker::JobWorker():
+    m_nWorkers(4),
+    m_nQuit(0),
+    m_cpuSlots(cpuSlots(4)),
+    m_cpuBusy(0),
+    m_running(false)
 {
     m_mutex.init();
     m_cond.init();
@@ -46,23 +64,422 @@ JobWorker::~JobWorker()
 void JobWorker::enqueue( JobPtr_t job )
 {
     pthreads::ScopedLock lock(m_mutex);
-    std::cout << "JobWorker: Enqueing job\n";
+    lockless_enqueue(job);
+}
+
+void JobWorker::lockless_enqueue( JobPtr_t job )
+{
+    std::cout << "JobWorker: Enqueing job for peer " << job->peerId() << "\n";
 
-    if( m_last )
-        m_last->next = job;
+    JobList* queue = &m_urgent;
+    if( !job->urgent() )
+    {
+        queue = &m_queues[ job->peerId() ];
+        if( !queue->first )
+            m_active.push_back( job->peerId() );
+    }
+
+    if( queue->last )
+        queue->last->next = job;
     else
-        m_first = job;
-    m_last = job;
+        queue->first = job;
+    queue->last = job;
 
     m_cond.signal();
 }
 
+void JobWorker::schedule( JobPtr_t job, int64_t delayMs )
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    int64_t deadline = clock() + delayMs*1000;
+
+    // if this job is due before anything else then the timer thread has
+    // to recompute it's timeout
+    bool isFirst = m_timers.empty() || deadline < m_timers.begin()->first;
+    m_timers.insert( TimerMap_t::value_type(deadline,job) );
+    if( isFirst )
+        m_timerNote.notify();
+}
+
+template <class Match_t>
+void JobWorker::unlink( JobList& queue, Match_t match )
+{
+    JobPtr_t prev;
+    JobPtr_t job = queue.first;
+    while( job )
+    {
+        JobPtr_t next = job->next;
+        if( match(job.subvert()) )
+        {
+            job->cancel();
+            job->next.clear();
+            if( prev )
+                prev->next = next;
+            else
+                queue.first = next;
+            if( queue.last == job )
+                queue.last = prev;
+        }
+        else
+            prev = job;
+        job = next;
+    }
+}
+
+template <class Match_t>
+void JobWorker::lockless_cancel( Match_t match )
+{
+    // running jobs are flagged and will stop at their next check
+    for( LongJob* job : m_working )
+    {
+        if( match(job) )
+            job->cancel();
+    }
+
+    // queued jobs are unlinked from their queue
+    unlink( m_urgent, match );
+    QueueMap_t::iterator iqueue = m_queues.begin();
+    while( iqueue != m_queues.end() )
+    {
+        JobList& queue = iqueue->second;
+        unlink( queue, match );
+        if( !queue.first )
+        {
+            m_active.remove( iqueue->first );
+            m_queues.erase( iqueue++ );
+        }
+        else
+            ++iqueue;
+    }
+
+    // scheduled jobs are simply dropped
+    TimerMap_t::iterator itimer = m_timers.begin();
+    while( itimer != m_timers.end() )
+    {
+        if( match(itimer->second.subvert()) )
+        {
+            itimer->second->cancel();
+            m_timers.erase( itimer++ );
+        }
+        else
+            ++itimer;
+    }
+}
+
+namespace {
+
+/// matches all jobs for a peer
+struct PeerMatch
+{
+    int peerId;
+
+    bool operator()( LongJob* job ) const
+    {
+        return job->peerId() == peerId;
+    }
+};
+
+/// matches jobs for a peer and path from older transactions
+struct PathMatch
+{
+    int                 peerId;
+    const std::string&  path;
+    int64_t             tx;
+
+    bool operator()( LongJob* job ) const
+    {
+        return job->peerId() == peerId
+                && job->path() == path
+                && ( tx < 0 || job->tx() < tx );
+    }
+};
+
+/// matches jobs for one piece of a transaction
+struct PieceMatch
+{
+    int                 peerId;
+    const std::string&  path;
+    int64_t             tx;
+    int64_t             piece;
+
+    bool operator()( LongJob* job ) const
+    {
+        return job->peerId() == peerId
+                && job->path() == path
+                && job->tx() == tx
+                && job->piece() == piece;
+    }
+};
+
+}
+
+void JobWorker::cancel( int peerId )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    std::cout << "JobWorker: cancelling jobs for peer " << peerId << "\n";
+
+    PeerMatch match = { peerId };
+    lockless_cancel( match );
+}
+
+void JobWorker::cancel( int peerId, const std::string& path, int64_t tx )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    std::cout << "JobWorker: cancelling jobs for peer " << peerId
+              << " on " << path << " older than tx " << tx << "\n";
+
+    PathMatch match = { peerId, path, tx };
+    lockless_cancel( match );
+}
+
+void JobWorker::cancel( int peerId, const std::string& path,
+                        int64_t tx, int64_t piece )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    std::cout << "JobWorker: cancelling piece " << piece << " of tx " << tx
+              << " on " << path << " for peer " << peerId << "\n";
+
+    PieceMatch match = { peerId, path, tx, piece };
+    lockless_cancel( match );
+}
+
+int64_t JobWorker::clock()
+{
+    timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return int64_t(now.tv_sec)*1000000 + now.tv_nsec/1000;
+}
+
+void JobWorker::setNumWorkers( int nWorkers )
+{
+    pthreads::ScopedLock lock(m_mutex);
+
+    if( nWorkers < 1 )
+        nWorkers = 1;
+
+    std::cout << "JobWorker: setting pool size to " << nWorkers << "\n";
+
+    m_cpuSlots = cpuSlots( nWorkers );
+
+    if( m_running )
+    {
+        // start any new workers that are needed
+        for( int i = m_nWorkers; i < nWorkers; i++ )
+            launchWorker();
+
+        // and retire any extra
+        if( nWorkers < m_nWorkers )
+        {
+            m_nQuit += m_nWorkers - nWorkers;
+            m_cond.broadcast();
+        }
+    }
+
+    m_nWorkers = nWorkers;
+}
+
+int JobWorker::numWorkers()
+{
+    pthreads::ScopedLock lock(m_mutex);
+    return m_nWorkers;
+}
+
+int JobWorker::reserveCpu( int wanted )
+{
+    pthreads::ScopedLock lock(m_mutex);
+    int count = std::max( 0, std::min( wanted, m_cpuSlots - m_cpuBusy ) );
+    m_cpuBusy += count;
+    return count;
+}
+
+void JobWorker::releaseCpu( int count )
+{
+    if( count < 1 )
+        return;
+
+    // a cpu job may be waiting for one of the slots
+    pthreads::ScopedLock lock(m_mutex);
+    m_cpuBusy -= count;
+    m_cond.broadcast();
+}
+
+void JobWorker::start()
+{
+    pthreads::ScopedLock lock(m_mutex);
+    if( m_running )
+        return;
+
+    m_running = true;
+    for( int i=0; i < m_nWorkers; i++ )
+        launchWorker();
+
+    m_timerThread.launch( dispatch_timer, this );
+}
+
+void JobWorker::stop()
+{
+    // signal all the workers to quit
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        m_running = false;
+        m_cond.broadcast();
+        m_timerNote.notify();
+    }
+    m_timerThread.join();
+
+    // wait for them to finish their current job, we only ever add threads
+    // to the list while running so it is safe to walk it now
+    for( auto& thread : m_threads )
+        thread.join();
+
+    std::cout << "JobWorker " << (void*)this
+              << " destroying queued jobs\n";
+
+    pthreads::ScopedLock lock(m_mutex);
+    m_threads.clear();
+    m_nQuit = 0;
+    for( auto& pair : m_queues )
+    {
+        JobList& queue = pair.second;
+        queue.last.clear();
+        while(queue.first)
+        {
+            JobPtr_t next = queue.first->next;
+            queue.first->next.clear();
+            queue.first = next;
+        }
+    }
+    m_urgent.last.clear();
+    while(m_urgent.first)
+    {
+        JobPtr_t next = m_urgent.first->next;
+        m_urgent.first->next.clear();
+        m_urgent.first = next;
+    }
+    m_queues.clear();
+    m_active.clear();
+    m_timers.clear();
+}
+
+void JobWorker::launchWorker()
+{
+    m_threads.push_back( pthreads::Thread() );
+    int result = m_threads.back().launch( dispatch_main, this );
+    if( result )
+    {
+        m_threads.pop_back();
+        std::cerr << "JobWorker: failed to launch worker thread, errno "
+                  << result << "\n";
+    }
+}
+
+JobWorker::JobPtr_t JobWorker::dequeue()
+{
+    // urgent jobs go first, unless they have to wait for a cpu slot
+    JobPtr_t urgent = m_urgent.first;
+    if( urgent && !( urgent->jobClass() == JOB_CPU
+                        && m_cpuBusy >= m_cpuSlots ) )
+    {
+        m_urgent.first = urgent->next;
+        if( !m_urgent.first )
+            m_urgent.last.clear();
+        urgent->next.clear();
+        return urgent;
+    }
+
+    std::list<int>::iterator ipeer;
+    for( ipeer = m_active.begin(); ipeer != m_active.end(); ++ipeer )
+    {
+        JobList& queue = m_queues[*ipeer];
+        JobPtr_t job   = queue.first;
+
+        // if all the cpu slots are taken then this peer will have to wait
+        // its turn
+        if( job->jobClass() == JOB_CPU && m_cpuBusy >= m_cpuSlots )
+            continue;
+
+        // pop the job from the peer's queue
+        if( queue.first == queue.last )
+        {
+            queue.first.clear();
+            queue.last.clear();
+        }
+        else
+        {
+            queue.first = job->next;
+            job->next.clear();
+        }
+
+        // move the peer to the back of the line if it still has work,
+        // otherwise forget about it
+        int peerId = *ipeer;
+        m_active.erase(ipeer);
+        if( queue.first )
+            m_active.push_back(peerId);
+        else
+            m_queues.erase(peerId);
+
+        return job;
+    }
+
+    return JobPtr_t();
+}
+
 void* JobWorker::dispatch_main( void* vp_worker )
 {
     static_cast<JobWorker*>(vp_worker)->main();
     return vp_worker;
 }
 
+void* JobWorker::dispatch_timer( void* vp_worker )
+{
+    static_cast<JobWorker*>(vp_worker)->timerMain();
+    return vp_worker;
+}
+
+void JobWorker::timerMain()
+{
+    SelectSpec selectme;
+    while(true)
+    {
+        bool    hasTimeout = false;
+        int64_t timeout    = 0;
+
+        // lock scope
+        {
+            pthreads::ScopedLock lock(m_mutex);
+            if( !m_running )
+                break;
+
+            // move everything that is due into the job queues
+            int64_t now = clock();
+            while( !m_timers.empty() && m_timers.begin()->first <= now )
+            {
+                lockless_enqueue( m_timers.begin()->second );
+                m_timers.erase( m_timers.begin() );
+            }
+
+            if( !m_timers.empty() )
+            {
+                hasTimeout = true;
+                timeout    = m_timers.begin()->first - now;
+            }
+        }
+
+        // wait for the next deadline, or for a new timer to be scheduled
+        selectme.reset();
+        selectme.gen()
+                ( m_timerNote.readFd(), select_spec::READ )
+                ( TimeVal( timeout / 1000000, timeout % 1000000 ) );
+        selectme.wait( hasTimeout );
+        m_timerNote.clear();
+    }
+
+    std::cout << "JobWorker " << (void*)this
+              << " timer exiting main loop\n";
+}
+
 void JobWorker::main()
 {
     while(true)
@@ -74,32 +491,36 @@ void JobWorker::main()
             pthreads::ScopedLock lock(m_mutex);
 
             // wait until there is something to do
-            while(!m_first)
+            while(true)
             {
-                std::cout << "JobWorker: No jobs, waiting\n";
+                if( !m_running )
+                    break;
+
+                if( m_nQuit > 0 )
+                {
+                    m_nQuit--;
+                    break;
+                }
+
+                job = dequeue();
+                if( job )
+                    break;
+
                 m_cond.wait(m_mutex);
             }
 
-            // now that m_first is not null we can do the job
-            job = m_first;
+            if( !job )
+                break;
+
+            if( job->jobClass() == JOB_CPU )
+                m_cpuBusy++;
+            m_working.insert( job.subvert() );
 
-            // if this is the last job then erase both end points
-            if( m_first == m_last )
-            {
-                m_first.clear();
-                m_last.clear();
-            }
-            // otherwise advance first
-            else
-            {
-                JobPtr_t next = m_first->next;
-                m_first->next.clear();
-                m_first = next;
-            }
         // release the lock so that other threads can add jobs while
         // we're working
         }
 
+        bool quit = false;
         try
         {
             // do the job
@@ -108,31 +529,32 @@ void JobWorker::main()
         }
         catch (const JobQuitException& ex )
         {
-            std::cout << "JobWorker " << (void*)this
-                      << " shutting down\n";
-            break;
+            quit = true;
         }
         catch (const std::exception& ex)
         {
             std::cerr << "Job worker caught an exception: "
                       << ex.what() << "\n";
         }
-    }
-    std::cout << "JobWorker " << (void*)this
-              << " destroying queued jobs\n";
 
-    pthreads::ScopedLock lock(m_mutex);
-    m_last.clear();
-    while(m_first)
-    {
-        JobPtr_t next = m_first->next;
-        m_first->next.clear();
-        m_first.clear();
-        m_first = next;
+        // release the cpu slot, which may make a job runnable for a
+        // waiting worker
+        {
+            pthreads::ScopedLock lock(m_mutex);
+            m_working.erase( job.subvert() );
+            if( job->jobClass() == JOB_CPU )
+            {
+                m_cpuBusy--;
+                m_cond.broadcast();
+            }
+        }
+
+        if( quit )
+            break;
     }
 
     std::cout << "JobWorker " << (void*)this
-              << " exiting main loop\n";
+              << " worker exiting main loop\n";
 }
 
 
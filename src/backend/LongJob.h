@@ -27,9 +27,15 @@
 #ifndef OPENBOOK_FS_LONGJOB_H_
 #define OPENBOOK_FS_LONGJOB_H_
 
+#include <atomic>
 #include <exception>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
 #include <cpp-pthreads.h>
 #include "ReferenceCounted.h"
+#include "NotifyPipe.h"
 #include "Queue.h"
 
 
@@ -48,20 +54,66 @@ struct JobQuitException:
     }
 };
 
+/// what resource a job spends most of it's time waiting on
+enum JobClass
+{
+    JOB_IO,     ///< mostly waits on disk or network, many may run at once
+    JOB_CPU,    ///< mostly computes, at most one per core is run at once
+};
+
 /// interface for long job objects
 class LongJob:
     public ReferenceCounted
 {
     private:
-        RefPtr<LongJob> next;   ///< for use only by JobWorker
+        RefPtr<LongJob>     next;       ///< for use only by JobWorker
+        std::atomic<bool>   m_cancelled;///< set when the job is obsolete
         friend class JobWorker;
 
     public:
+        /// peer id used for jobs which are not done on behalf of any
+        /// particular peer
+        static const int NO_PEER = -1;
+
+        LongJob():
+            m_cancelled(false)
+        {}
+
         /// needs a v-table
         virtual ~LongJob(){}
 
+        /// flag the job as obsolete, a running job should check
+        /// isCancelled() at convenient points and return early
+        void cancel(){ m_cancelled = true; }
+
+        /// true if the job has been cancelled
+        bool isCancelled() const { return m_cancelled; }
+
         /// do the job
         virtual void go()=0;
+
+        /// the peer on who's behalf this job is done, jobs are scheduled
+        /// round-robin between peers so that one peer's jobs cannot starve
+        /// another's
+        virtual int peerId() const { return NO_PEER; }
+
+        /// whether this job is cpu-bound or io-bound
+        virtual JobClass jobClass() const { return JOB_IO; }
+
+        /// the file this job works on, if any, together with peerId() and
+        /// tx() this identifies the job for cancellation
+        virtual std::string path() const { return std::string(); }
+
+        /// the transaction this job belongs to, if any
+        virtual int64_t tx() const { return -1; }
+
+        /// the part of the transaction this job does, if any, which may be
+        /// cancelled by itself
+        virtual int64_t piece() const { return -1; }
+
+        /// short jobs that someone is waiting on return true, they are run
+        /// ahead of every peer's queue
+        virtual bool urgent() const { return false; }
 };
 
 /// special job which simply signals a shutdown for the worker
@@ -73,18 +125,53 @@ struct JobKiller:
 };
 
 
-/// maintains a queue of long jobs and has a thread which continuously
-/// works on that queue
+/// maintains per-peer queues of long jobs and a pool of threads which
+/// continuously work on those queues
+/**
+ *  Each peer gets it's own FIFO sub-queue and idle workers take the next
+ *  job from the peers in round-robin order, so a peer with a long queue of
+ *  file transfers cannot starve the jobs of another peer. Any idle worker
+ *  may take a job from any peer's queue. Urgent jobs skip the peer queues
+ *  and are taken by the next idle worker. CPU-bound jobs are limited to one
+ *  per core, while io-bound jobs may occupy every worker. A job that
+ *  computes on several threads borrows the slots that are idle with
+ *  reserveCpu(), so it stays within the same limit.
+ */
 class JobWorker
 {
     public:
         typedef RefPtr<LongJob>    JobPtr_t;
 
     private:
+        /// a FIFO linked list of jobs
+        struct JobList
+        {
+            JobPtr_t    first;
+            JobPtr_t    last;
+        };
+
+        typedef std::map<int,JobList>           QueueMap_t;
+        typedef std::list<pthreads::Thread>     ThreadList_t;
+        typedef std::multimap<int64_t,JobPtr_t> TimerMap_t;
+        typedef std::set<LongJob*>              JobSet_t;
+
         pthreads::Mutex     m_mutex;
         pthreads::Condition m_cond;
-        JobPtr_t            m_first;
-        JobPtr_t            m_last;
+        QueueMap_t          m_queues;   ///< per-peer job queues
+        JobList             m_urgent;   ///< urgent jobs of every peer
+        std::list<int>      m_active;   ///< peers with queued jobs, in the
+                                        ///  order they will be served
+        ThreadList_t        m_threads;  ///< worker threads
+        int                 m_nWorkers; ///< requested number of workers
+        int                 m_nQuit;    ///< number of workers to retire
+        int                 m_cpuSlots; ///< max concurrent cpu-bound jobs
+        int                 m_cpuBusy;  ///< number of running cpu jobs
+        bool                m_running;  ///< true between start() and stop()
+        JobSet_t            m_working;  ///< jobs currently being run
+
+        TimerMap_t          m_timers;       ///< delayed jobs by deadline
+        pthreads::Thread    m_timerThread;  ///< moves due jobs to the queue
+        NotifyPipe          m_timerNote;    ///< wakes the timer thread
 
     public:
         JobWorker();
@@ -93,11 +180,101 @@ class JobWorker
         /// add a job to the queue
         void enqueue( JobPtr_t job );
 
+        /// add a job to the queue after @p delayMs milliseconds have
+        /// elapsed, the job does not occupy a worker while it waits
+        void schedule( JobPtr_t job, int64_t delayMs );
+
+        /// cancel all queued, scheduled, and running jobs for a peer
+        void cancel( int peerId );
+
+        /// cancel all queued, scheduled, and running jobs for @p path on
+        /// behalf of @p peerId which belong to a transaction older than
+        /// @p tx, pass a negative @p tx to cancel regardless of transaction
+        void cancel( int peerId, const std::string& path, int64_t tx=-1 );
+
+        /// cancel the jobs for @p piece of transaction @p tx on @p path on
+        /// behalf of @p peerId
+        void cancel( int peerId, const std::string& path,
+                     int64_t tx, int64_t piece );
+
+        /// current value of the monotonic clock used for scheduling, in
+        /// microseconds
+        static int64_t clock();
+
+        /// set the number of worker threads, if the pool is already running
+        /// then threads are started or retired to match
+        void setNumWorkers( int nWorkers );
+
+        /// return the number of worker threads
+        int numWorkers();
+
+        /// take up to @p wanted cpu slots that are idle, without waiting,
+        /// for a job that spreads it's work over threads of it's own.
+        /// Returns the number taken, which must be given back with
+        /// releaseCpu()
+        int reserveCpu( int wanted );
+
+        /// give back cpu slots taken with reserveCpu()
+        void releaseCpu( int count );
+
+        /// holds cpu slots taken with reserveCpu() for it's lifetime
+        class CpuReservation
+        {
+            private:
+                JobWorker*  m_worker;
+                int         m_count;
+
+            public:
+                CpuReservation( JobWorker* worker, int wanted ):
+                    m_worker(worker),
+                    m_count(worker->reserveCpu(wanted))
+                {}
+
+                ~CpuReservation(){ m_worker->releaseCpu(m_count); }
+
+                /// the number of slots held
+                int count() const { return m_count; }
+        };
+
+        /// start the worker threads
+        void start();
+
+        /// signal all workers to quit, wait for them to finish their
+        /// current job, and destroy any jobs still in the queue
+        void stop();
+
         /// pthread-callable function
         static void* dispatch_main( void* vp_worker );
 
+        /// pthread-callable function for the timer thread
+        static void* dispatch_timer( void* vp_worker );
+
     private:
+        /// add a job to the queue, must be called with the lock held
+        void lockless_enqueue( JobPtr_t job );
+
+        /// launch a single worker thread, must be called with the lock held
+        void launchWorker();
+
+        /// cancel and remove all queued, scheduled, and running jobs for
+        /// which @p match( job ) returns true, must be called with the
+        /// lock held
+        template <class Match_t>
+        void lockless_cancel( Match_t match );
+
+        /// cancel and remove the jobs of @p queue for which @p match( job )
+        /// returns true
+        template <class Match_t>
+        static void unlink( JobList& queue, Match_t match );
+
+        /// remove the next job to run from the queues, must be called with
+        /// the lock held, returns a null pointer if nothing is runnable
+        JobPtr_t dequeue();
+
         void main();
+
+        /// waits for the next deadline and moves due jobs into the queues
+        void timerMain();
 };
 
 
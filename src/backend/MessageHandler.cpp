@@ -26,6 +26,7 @@
 
 
 #include <iostream>
+#include <vector>
 #include <boost/format.hpp>
 #include "Backend.h"
 #include "MessageHandler.h"
@@ -34,6 +35,7 @@
 #include "jobs/PingJob.h"
 #include "jobs/SendTree.h"
 #include "jobs/SendFile.h"
+#include "jobs/SendRange.h"
 
 
 namespace   openbook {
@@ -67,6 +69,7 @@ void MessageHandler::go( int peerId, MsgQueue_t* in, MsgQueue_t* out )
     m_outboundQueue = out;
     m_peerId        = peerId;
     m_shouldQuit    = false;
+    m_peerMap.clear();
     main();
 }
 
@@ -93,19 +96,22 @@ void MessageHandler::main()
 
 void MessageHandler::mapVersion( const VersionVector& v_in, VersionVector& v_out )
 {
-    std::stringstream report;
-    report << "MessageHandler::mapVersion():\n";
     for( auto& pair : v_in )
     {
+        // drop entries for peers that weren't in the id map, they can't
+        // be compared to anything we have
+        if( pair.first < 0 || pair.first >= (int64_t)m_peerMap.size()
+                || m_peerMap[pair.first] < 0 )
+        {
+            std::cerr << "MessageHandler::mapVersion(): peer " << m_peerId
+                      << " sent version for unmapped id " << pair.first
+                      << ", ignoring\n";
+            continue;
+        }
         v_out[ m_peerMap[pair.first] ] = pair.second;
-        report << boost::format("   %d -> %d : %d\n")
-                    % pair.first
-                    % m_peerMap[pair.first]
-                    % pair.second;
     }
     if( v_out.find(0) == v_out.end() )
         v_out[0] = 0;
-    std::cout << report.str();
 }
 
 
@@ -120,6 +126,7 @@ void MessageHandler::handleMessage( messages::AuthResult* msg )         { except
 void MessageHandler::handleMessage( messages::UserInterfaceReply*  msg) { exceptMessage(msg); }
 void MessageHandler::handleMessage( messages::PeerList* msg )           { exceptMessage(msg); }
 void MessageHandler::handleMessage( messages::MountList*  msg)          { exceptMessage(msg); }
+void MessageHandler::handleMessage( messages::FuseStatList* msg )       { exceptMessage(msg); }
 
 void MessageHandler::handleMessage( messages::SetDisplayName* msg)
 {
@@ -345,6 +352,16 @@ void MessageHandler::handleMessage( messages::GetBackendInfo* msg)
             break;
         }
 
+        case FUSE_STATS:
+        {
+            messages::FuseStatList* reply =
+                    new messages::FuseStatList();
+            m_backend->getFuseStats(reply);
+            std::cout << "MessageHandler: queueing FuseStatList\n";
+            m_outboundQueue->insert( new AutoMessage(reply) );
+            break;
+        }
+
         default:
         {
             messages::UserInterfaceReply* reply =
@@ -393,15 +410,35 @@ void MessageHandler::handleMessage( messages::Quit* msg )
 void MessageHandler::handleMessage( messages::Ping* msg )
 {
     std::cout << "Handling PING\n";
-    jobs::Pong* pong = new jobs::Pong(m_backend,m_peerId);
-    m_backend->jobs()->enqueue(pong);
+
+    // reply right away so that the peer's round trip time measurement
+    // doesn't include our job queue
+    messages::Pong* pong = new messages::Pong();
+    pong->set_payload( msg->payload() );
+    pong->set_sent( msg->sent() );
+    m_outboundQueue->insert( new AutoMessage(pong), PRIO_NOW );
 }
 
 void MessageHandler::handleMessage( messages::Pong* msg )
 {
     std::cout << "Handling PONG\n";
-    jobs::Pong* pong = new jobs::Pong(m_backend,m_peerId);
-    m_backend->jobs()->enqueue(pong);
+    if( !msg->has_sent() )
+        return;
+
+    int32_t cookie = msg->payload();
+    int64_t rtt    = JobWorker::clock() - msg->sent();
+
+    // only the answer to the outstanding ping continues the chain
+    if( !m_backend->pongReceived( m_peerId, cookie, msg->sent(), rtt ) )
+        return;
+
+    std::cout << "MessageHandler: rtt to peer " << m_peerId << " is "
+              << rtt << "us\n";
+
+    // schedule the next ping
+    m_backend->jobs()->schedule(
+            new jobs::Ping(m_backend,m_peerId,cookie),
+            jobs::Ping::INTERVAL_MS );
 }
 
 
@@ -418,103 +455,159 @@ void MessageHandler::handleMessage( messages::Unsubscribe* msg )
 
 void MessageHandler::handleMessage( messages::IdMap* msg )
 {
-    for( int i=0; i < msg->peermap_size(); i++ )
-        m_backend->mapPeer( msg->peermap(i), m_peerMap );
+    m_backend->mapPeer( *msg, m_peerMap );
+    if( m_peerMap.empty() )
+        m_peerMap.resize(1);
     m_peerMap[0] = m_peerId;
 
     std::stringstream report;
     report << "MessageHandler: built id map: \n";
 
-
-    for( PeerMap_t::iterator it = m_peerMap.begin();
-            it != m_peerMap.end(); ++it )
+    for( unsigned int i=0; i < m_peerMap.size(); i++ )
     {
+        if( m_peerMap[i] < 0 )
+            continue;
         report << boost::format("   %5d -> %-5d\n")
-                    % it->first
-                    % it->second;
+                    % i
+                    % m_peerMap[i];
     }
     std::cout << report.str();
 }
 
 void MessageHandler::handleMessage( messages::NodeInfo* msg )
 {
-    std::stringstream report;
-    report << "MessageHandler: received node info: \n"
-           << "    path: " << msg->parent() << "/" << msg->path() << "\n";
-    std::cout << report.str();
+    std::vector<const messages::NodeInfo*> nodes;
+    nodes.push_back(msg);
+    syncNodes(nodes);
+}
 
-    // first check to see if the file is currently checked out
+void MessageHandler::handleMessage( messages::NodeInfoBatch* msg )
+{
+    std::vector<const messages::NodeInfo*> nodes;
+    nodes.reserve( msg->node_size() );
+    for( int i=0; i < msg->node_size(); i++ )
+        nodes.push_back( &msg->node(i) );
+    syncNodes(nodes);
+}
+
+void MessageHandler::syncNodes(
+        const std::vector<const messages::NodeInfo*>& nodes )
+{
     namespace fs = boost::filesystem;
 
-    try
+    std::stringstream report;
+    report << "MessageHandler: received node info for "
+           << nodes.size() << " files\n";
+    std::cout << report.str();
+
+    // build the batch query
+    std::vector<Database::SyncEntry> entries( nodes.size() );
+    for( unsigned int i=0; i < nodes.size(); i++ )
     {
+        const messages::NodeInfo* msg = nodes[i];
+
         // decompose the path into a directory and file part
-        fs::path root    = m_backend->realRoot();
         fs::path relpath = fs::path(msg->parent()) / msg->path();
         if( msg->parent() == "/" )
             relpath = "/" + msg->path();
-
-        // check if we are subscribed
-        if( !m_backend->db().isSubscribed(relpath) )
-            ex()() << "Not subscribed to " << relpath;
+        entries[i].path = relpath;
 
         // create a version vector from the message
         VersionVector v_recv;
-        for(int i=0; i < msg->version_size(); i++)
+        for(int j=0; j < msg->version_size(); j++)
         {
-            const messages::VersionEntry& entry = msg->version(i);
+            const messages::VersionEntry& entry = msg->version(j);
             v_recv[ entry.client() ] = entry.version();
         }
 
         // map version keys
-        VersionVector v_theirs;
-        mapVersion( v_recv, v_theirs );
+        mapVersion( v_recv, entries[i].theirs );
+
+        entries[i].size  = msg->size();
+        entries[i].mode  = Database::toMode( msg->type(), msg->mode() );
+        entries[i].ctime = msg->ctime();
+        entries[i].mtime = msg->mtime();
+    }
 
-        // assimilate version keys so that future file changes notify
-        // connected peers
-        m_backend->db().assimilateKeys( relpath, v_theirs );
+    // assimilate version keys and retrieve our versions for the whole
+    // batch at once
+    m_backend->db().syncVersions( m_peerId, entries );
 
-        // retrieve my version
-        VersionVector v_mine;
-        m_backend->db().getVersion( relpath, v_mine );
+    for( unsigned int i=0; i < nodes.size(); i++ )
+    {
+        const messages::NodeInfo* msg      = nodes[i];
+        const fs::path&           relpath  = entries[i].path;
+        const VersionVector&      v_theirs = entries[i].theirs;
+        const VersionVector&      v_mine   = entries[i].mine;
 
-        // compare version vectors, if their version is strictly newer then
-        // we register it for download
-        if( v_mine < v_theirs )
+        try
         {
-            std::cout << "MessageHandler::(NodeInfo)  : "
-                      << " version is strictly greater, adding download\n";
-            m_backend->addDownload(m_peerId,relpath,msg->size(),v_theirs);
+            // check if we are subscribed, if we aren't then the attributes
+            // that the mounts report come from the peer's copy and may
+            // have just changed
+            if( !entries[i].subscribed )
+            {
+                if( entries[i].attrChanged )
+                    m_backend->attrCache().notify( relpath,
+                                                   entries[i].dataChanged );
+                ex()() << "Not subscribed to " << relpath;
+            }
 
-            messages::SendFile* sendFile = new messages::SendFile();
-            sendFile->set_path(relpath.string());
-            sendFile->set_tx(0);
+            // compare version vectors, if their version is strictly newer
+            // then we register it for download
+            if( v_mine < v_theirs )
+            {
+                std::cout << "MessageHandler::(NodeInfo)  : " << relpath
+                          << " version is strictly greater, adding download\n";
 
-            for( auto& pair : v_theirs )
+                // if other peers have the same version then the file is
+                // downloaded from all of them at once
+                m_backend->swarm().offer( m_peerId, relpath, msg->size(),
+                                          v_theirs );
+            }
+            // if the versions are concurrent but the contents are identical
+            // (i.e. both sides made the same change) then there is no
+            // conflict and nothing to transfer, we just adopt the merged
+            // version
+            else if( !(v_theirs <= v_mine) && msg->has_hash()
+                    && msg->hash() == entries[i].hash )
             {
-                messages::VersionEntry* entry = sendFile->add_version();
-                entry->set_client(pair.first);
-                entry->set_version(pair.second);
+                VersionVector v_merged = v_mine;
+                for( auto& pair : v_theirs )
+                    v_merged[pair.first] =
+                            std::max( v_merged[pair.first], pair.second );
+
+                std::cout << "MessageHandler::(NodeInfo)  : " << relpath
+                          << " version " << v_theirs << " is concurrent with "
+                          << v_mine << " but contents are identical, merging "
+                          << "to " << v_merged << "\n";
+                m_backend->db().setVersion( relpath, v_merged );
+            }
+            else
+            {
+                std::cout << "MessageHandler::(NodeInfo)  : " << relpath
+                          << " version " << v_theirs
+                          << "is not strictly greater than " << v_mine << "\n";
             }
-
-            m_outboundQueue->insert( new AutoMessage(sendFile) );
         }
-        else
+        catch( const std::exception& ex )
         {
-            std::cout << "MessageHandler::(NodeInfo)  : "
-                      << " version " << v_theirs
-                      << "is not strictly greater than " << v_mine << "\n";
+            std::cerr << "Failed to handle NodeInfo message: " << ex.what()
+                      << "\n";
         }
     }
-    catch( const std::exception& ex )
-    {
-        std::cerr << "Failed to handle NodeInfo message: " << ex.what()
-                  << "\n";
-    }
 }
 
 void MessageHandler::handleMessage( messages::SendFile* msg )
 {
+    // the piece was received from another peer first
+    if( msg->cancel() )
+    {
+        m_backend->jobs()->cancel( m_peerId, msg->path(),
+                                   msg->tx(), msg->piece() );
+        return;
+    }
+
     // read the version vector
     VersionVector v_recd;
     for(int i=0; i < msg->version_size(); i++)
@@ -536,13 +629,19 @@ void MessageHandler::handleMessage( messages::SendFile* msg )
 
     std::cout << report.str();
 
+    // any transfer of this file to the peer from an older transaction is
+    // obsolete now
+    m_backend->jobs()->cancel( m_peerId, msg->path(), msg->tx() );
+
     // create the job
     jobs::SendFile* sendFile = new jobs::SendFile(
             m_backend, m_peerId,
             msg->path(),
             msg->tx(),
             msg->offset(),
-            v_theirs );
+            v_theirs,
+            msg->has_length() ? msg->length() : -1,
+            msg->has_piece()  ? msg->piece()  : -1 );
 
     // add the job
     m_backend->jobs()->enqueue(sendFile);
@@ -557,7 +656,13 @@ void MessageHandler::handleMessage( messages::NewVersion* msg )
 
 void MessageHandler::handleMessage( messages::RequestFile* msg )
 {
-
+    // ranged requests are for files that the peer is reading right now,
+    // they are read off of the message thread but ahead of any transfers
+    // queued for the peer
+    m_backend->jobs()->enqueue(
+        new jobs::SendRange( m_backend, m_peerId, msg->path(),
+                             msg->offset(), msg->length(),
+                             msg->request() ) );
 }
 
 
@@ -578,6 +683,11 @@ void MessageHandler::handleMessage( messages::DirChunk* msg )
         if( !fs::exists(dir) )
             fs::create_directories(dir);
         m_backend->db().merge( msg );
+
+        // the mounts may have cached that these didn't exist
+        for(int i=0; i < msg->entries_size(); i++)
+            m_backend->attrCache().notify(
+                    fs::path(msg->path()) / msg->entries(i).path(), false );
     }
     catch( const std::exception& ex )
     {
@@ -27,6 +27,7 @@
 #ifndef OPENBOOK_FS_MESSAGEHANDLER_H_
 #define OPENBOOK_FS_MESSAGEHANDLER_H_
 
+#include <vector>
 #include <cpp-pthreads.h>
 
 #include "Pool.h"
@@ -79,7 +80,7 @@ class MessageHandler
         typedef Pool<MessageHandler>        Pool_t;
         typedef RefPtr<AutoMessage>         MsgPtr_t;
         typedef PriorityQueue< MsgPtr_t >   MsgQueue_t;
-        typedef std::map<int,int>           PeerMap_t;
+        typedef std::vector<int>            PeerMap_t;
 
     private:
         int                 m_peerId;           ///< id of the peer
@@ -90,8 +91,8 @@ class MessageHandler
         pthreads::Mutex     m_mutex;            ///< locks this data
         bool                m_shouldQuit;       ///< main loop termination
         PeerMap_t           m_peerMap;          ///< maps peer ids on the remote
-                                                ///  machine to ids on this
-                                                ///  machine
+                                                ///  machine (index) to ids on
+                                                ///  this machine (-1 if none)
 
 
     public:
@@ -130,6 +131,10 @@ class MessageHandler
         /// create a version vector by mapping a peers keys to our keys
         void mapVersion( const VersionVector& v_in, VersionVector& v_out );
 
+        /// compare the versions of a set of files from the peer with our
+        /// own and request the ones that are newer
+        void syncNodes( const std::vector<const messages::NodeInfo*>& nodes );
+
         /// typed message  handlers
         void handleMessage( messages::Quit*                msg);
         void handleMessage( messages::Ping*                msg);
@@ -149,6 +154,7 @@ class MessageHandler
         void handleMessage( messages::GetBackendInfo*      msg);
         void handleMessage( messages::PeerList*            msg);
         void handleMessage( messages::MountList*           msg);
+        void handleMessage( messages::FuseStatList*        msg);
         void handleMessage( messages::StartSync*           msg);
         void handleMessage( messages::SendTree*            msg);
         void handleMessage( messages::LeaderElect*         msg);
@@ -163,6 +169,7 @@ class MessageHandler
         void handleMessage( messages::Unsubscribe*         msg);
         void handleMessage( messages::IdMap*               msg);
         void handleMessage( messages::NodeInfo*            msg);
+        void handleMessage( messages::NodeInfoBatch*       msg);
         void handleMessage( messages::SendFile*            msg);
         void handleMessage( messages::NewVersion*          msg);
         void handleMessage( messages::RequestFile*         msg);
@@ -24,11 +24,15 @@
  *  @brief  
  */
 
+#include <cerrno>
+#include <cstring>
+#include <vector>
 
 #include "fuse_operations.h"
 #include "Backend.h"
 #include "ExceptionStream.h"
 #include "FuseContext.h"
+#include "FuseLowLevel.h"
 #include "MountPoint.h"
 
 
@@ -39,14 +43,20 @@ MountPoint::MountPoint( const std::string& mount):
     m_mount(mount),
     m_fuseChan(0),
     m_fuse(0),
-    m_mt(false)
+    m_session(0),
+    m_lowFs(0),
+    m_lowlevel(false),
+    m_threads(DEFAULT_THREADS)
 {}
 
 void MountPoint::mount(Backend* backend, const std::string& reldir,
-                        int argc, char** argv)
+                        int argc, char** argv, bool lowlevel,
+                        int threads)
 {
     // for UI and configuraiton files
-    m_reldir = reldir;
+    m_reldir   = reldir;
+    m_lowlevel = lowlevel;
+    m_threads  = threads < 1 ? 1 : threads;
 
     for(int i=0; i < argc; i++)
         m_args.push_back(argv[i]);
@@ -59,12 +69,32 @@ void MountPoint::mount(Backend* backend, const std::string& reldir,
     if(!m_fuseChan)
         ex()() << "Failed to fuse_mount " << m_mount;
 
-    // initialize fuse_ops
-    setFuseOps( m_ops );
-
     // create initializer object which is passed to fuse_ops::init
     FuseContext* fctx = new FuseContext(backend,reldir);
 
+    if( m_lowlevel )
+    {
+        FuseLowLevel::setOps( m_llops );
+        m_lowFs   = new FuseLowLevel(backend,fctx,reldir);
+        m_session = fuse_lowlevel_new(&args,&m_llops,sizeof(m_llops),m_lowFs);
+        if( !m_session )
+        {
+            fuse_unmount( m_mount.c_str(), m_fuseChan );
+            m_fuseChan = 0;
+            delete m_lowFs;
+            m_lowFs = 0;
+            ex()() << "Failed to fuse_lowlevel_new";
+        }
+
+        fuse_session_add_chan(m_session,m_fuseChan);
+        m_lowFs->setChannel(m_fuseChan);
+        m_thread.launch(dispatch_main,this);
+        return;
+    }
+
+    // initialize fuse_ops
+    setFuseOps( m_ops );
+
     // initialize fuse
     m_fuse = fuse_new(m_fuseChan,&args,&m_ops,sizeof(m_ops),fctx);
     if( !m_fuse )
@@ -98,16 +128,81 @@ void* MountPoint::dispatch_main(void* vp_mountpoint)
 
 void MountPoint::main()
 {
-    std::cout << "MountPoint::main: " << (void*)this << "entering fuse loop\n";
+    std::cout << "MountPoint::main: " << (void*)this << "entering fuse loop"
+              << " with " << m_threads << " threads\n";
 
-    if( m_mt )
-        fuse_loop_mt(m_fuse);
+    if( m_threads > 1 )
+    {
+        // this thread is one of the workers
+        std::vector<pthreads::Thread> workers(m_threads-1);
+        for( auto& thread : workers )
+            thread.launch(dispatch_worker,this);
+        worker();
+        for( auto& thread : workers )
+            thread.join();
+    }
+    else if( m_lowlevel )
+        fuse_session_loop(m_session);
     else
         fuse_loop(m_fuse);
 
     std::cout << "MountPoint::main: " << (void*)this << "exiting fuse loop\n";
-    fuse_unmount(m_mount.c_str(),m_fuseChan);
-    fuse_destroy(m_fuse);
+
+    if( m_lowlevel )
+    {
+        // the frontend stops sending invalidations before the channel
+        // is closed
+        fuse_session_remove_chan(m_fuseChan);
+        fuse_session_destroy(m_session);
+        delete m_lowFs;
+        fuse_unmount(m_mount.c_str(),m_fuseChan);
+        m_session = 0;
+        m_lowFs   = 0;
+    }
+    else
+    {
+        fuse_unmount(m_mount.c_str(),m_fuseChan);
+        fuse_destroy(m_fuse);
+    }
+}
+
+void* MountPoint::dispatch_worker(void* vp_mountpoint)
+{
+    static_cast<MountPoint*>(vp_mountpoint)->worker();
+    return vp_mountpoint;
+}
+
+void MountPoint::worker()
+{
+    // this is fuse_session_loop() except that many of them may read from
+    // the channel at once. The fuse_loop_mt() of libfuse would do the same
+    // but doesn't let us choose the number of threads.
+    fuse_session* session = m_lowlevel ? m_session : fuse_get_session(m_fuse);
+    size_t bufsize = fuse_chan_bufsize(m_fuseChan);
+    std::vector<char> buf(bufsize);
+
+    while( !fuse_session_exited(session) )
+    {
+        fuse_chan* chan = m_fuseChan;
+        fuse_buf   fbuf;
+        memset(&fbuf,0,sizeof(fbuf));
+        fbuf.mem  = &buf[0];
+        fbuf.size = bufsize;
+
+        int result = fuse_session_receive_buf(session,&fbuf,&chan);
+        if( result == -EINTR )
+            continue;
+
+        // zero means the filesystem was unmounted, the other workers will
+        // get an error from the closed channel
+        if( result <= 0 )
+        {
+            fuse_session_exit(session);
+            break;
+        }
+
+        fuse_session_process_buf(session,&fbuf,chan);
+    }
 }
 
 
@@ -28,6 +28,7 @@
 #define OPENBOOK_FS_MOUNTPOINT_H_
 
 #include <string>
+#include <vector>
 #include <cpp-pthreads.h>
 #include "fuse_include.h"
 
@@ -35,6 +36,7 @@ namespace   openbook {
 namespace filesystem {
 
 class Backend;
+class FuseLowLevel;
 
 /// encapsulates the path to a mount point, the fuse channel, and fuse object
 /// for the fuse filesystem mounted at that point
@@ -43,13 +45,21 @@ class MountPoint
     public:
         typedef std::vector<std::string> argv_t;
 
+        /// number of threads that dispatch fuse requests if the config
+        /// doesn't say otherwise
+        static const int DEFAULT_THREADS = 4;
+
     private:
         pthreads::Thread  m_thread;   ///< the thread we run in
         std::string       m_mount;    ///< path to the mount point
         fuse_chan*        m_fuseChan; ///< channel from fuse_mount
         fuse*             m_fuse;     ///< fuse struct from fuse_new
         fuse_operations   m_ops;      ///< fuse operations
-        bool              m_mt;       ///< use multi threaded loop
+        fuse_session*     m_session;  ///< session from fuse_lowlevel_new
+        fuse_lowlevel_ops m_llops;    ///< low level fuse operations
+        FuseLowLevel*     m_lowFs;    ///< low level frontend
+        bool              m_lowlevel; ///< use the low level api
+        int               m_threads;  ///< number of dispatch threads
         std::string       m_reldir;   ///< where to serve files from
         argv_t            m_args;     ///< arguments passed to fuse
 
@@ -58,8 +68,15 @@ class MountPoint
         MountPoint( const std::string& mount );
 
         /// starts fuse in it's own thread
+        /**
+         *  if @p lowlevel is true then the inode based low level api is
+         *  used instead of the path based high level api. Requests are
+         *  dispatched by @p threads threads, if it is 1 then the single
+         *  threaded fuse loop is used.
+         */
         void mount(Backend* backend, const std::string& reldir,
-                    int argc, char** argv);
+                    int argc, char** argv, bool lowlevel=false,
+                    int threads=DEFAULT_THREADS);
 
         /// calls fusermount -u
         /**
@@ -75,6 +92,8 @@ class MountPoint
 
         const std::string&      mountPoint() const { return m_mount;  }
         const std::string&      relDir()     const { return m_reldir; }
+        bool                    lowlevel()   const { return m_lowlevel; }
+        int                     threads()    const { return m_threads;  }
         argv_t::const_iterator  argv()       const { return m_args.begin(); }
         argv_t::const_iterator  argv_end()   const { return m_args.end();   }
         const argv_t&           get_argv()   const { return m_args; }
@@ -83,6 +102,11 @@ class MountPoint
         static void* dispatch_main(void* vp_mountpoint);
         void main();
 
+        /// receive and process requests from the fuse channel until the
+        /// session exits, m_threads of these run concurrently
+        static void* dispatch_worker(void* vp_mountpoint);
+        void worker();
+
 
 
 };
@@ -0,0 +1,420 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/SwarmDownloader.cpp
+ *
+ *  @brief  
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include "SwarmDownloader.h"
+#include "Backend.h"
+#include "jobs/VerifyDownload.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+const int64_t SwarmDownloader::MIN_PIECE;
+const int64_t SwarmDownloader::MAX_PIECE;
+const int64_t SwarmDownloader::FIRST_PIECE;
+const int64_t SwarmDownloader::PIECE_MS;
+const int64_t SwarmDownloader::RATE_MS;
+const int     SwarmDownloader::PIPELINE;
+
+SwarmDownloader::SwarmDownloader( Backend* backend ):
+    m_backend(backend),
+    m_nextPiece(0)
+{
+    m_mutex.init();
+}
+
+SwarmDownloader::~SwarmDownloader()
+{
+    m_mutex.destroy();
+}
+
+int64_t SwarmDownloader::pieceSize( const Source& source )
+{
+    if( source.rate <= 0 )
+        return FIRST_PIECE;
+
+    int64_t size = source.rate * PIECE_MS / 1000;
+    return std::max( MIN_PIECE, std::min( MAX_PIECE, size ) );
+}
+
+void SwarmDownloader::lockless_schedule( const std::string& path,
+                                         Swarm& swarm, int64_t peer,
+                                         Outbox_t& outbox )
+{
+    Source& source = swarm.sources[peer];
+    while( source.outstanding < PIPELINE )
+    {
+        Piece piece;
+        piece.peer      = peer;
+        piece.received  = 0;
+        piece.hedge     = -1;
+        piece.hedgeOf   = -1;
+
+        int64_t id = m_nextPiece++;
+        if( !swarm.todo.empty() )
+        {
+            // take the next piece off the front of what's left, but don't
+            // leave a sliver behind
+            RangeMap_t::iterator first = swarm.todo.begin();
+            int64_t rangeEnd = first->second;
+            piece.begin = first->first;
+            piece.end   = std::min( rangeEnd, piece.begin + pieceSize(source) );
+            if( rangeEnd - piece.end < MIN_PIECE )
+                piece.end = rangeEnd;
+
+            swarm.todo.erase(first);
+            if( piece.end < rangeEnd )
+                swarm.todo[piece.end] = rangeEnd;
+        }
+        else
+        {
+            // everything has been handed out, so hedge the piece with the
+            // most left to receive
+            PieceMap_t::iterator straggler = swarm.pieces.end();
+            int64_t mostLeft = 0;
+            for( PieceMap_t::iterator it = swarm.pieces.begin();
+                    it != swarm.pieces.end(); ++it )
+            {
+                const Piece& other = it->second;
+                int64_t left = other.end - other.begin - other.received;
+                if( other.peer == peer || other.hedge >= 0
+                        || other.hedgeOf >= 0 || left <= mostLeft )
+                    continue;
+
+                straggler = it;
+                mostLeft  = left;
+            }
+
+            if( straggler == swarm.pieces.end() )
+                break;
+
+            piece.begin   = straggler->second.begin
+                                + straggler->second.received;
+            piece.end     = straggler->second.end;
+            piece.hedgeOf = straggler->first;
+            straggler->second.hedge = id;
+
+            std::stringstream report;
+            report << "SwarmDownloader: (" << path << ") hedging bytes "
+                   << piece.begin << "-" << piece.end << " of peer "
+                   << straggler->second.peer << " with peer " << peer << "\n";
+            std::cout << report.str();
+        }
+
+        swarm.pieces[id] = piece;
+        source.outstanding++;
+
+        messages::SendFile* msg = new messages::SendFile();
+        msg->set_path( path );
+        msg->set_tx( swarm.tx );
+        msg->set_offset( piece.begin );
+        msg->set_length( piece.end - piece.begin );
+        msg->set_piece( id );
+        for( auto& pair : swarm.version )
+        {
+            messages::VersionEntry* entry = msg->add_version();
+            entry->set_client(pair.first);
+            entry->set_version(pair.second);
+        }
+        outbox.push_back( Outgoing_t(peer,msg) );
+    }
+}
+
+void SwarmDownloader::lockless_addSource( const std::string& path,
+                                          Swarm& swarm, int64_t peer,
+                                          Outbox_t& outbox )
+{
+    Source& source = swarm.sources[peer];
+    source.outstanding = 0;
+    source.rate        = 0;
+    source.windowStart = 0;
+    source.windowBytes = 0;
+    lockless_schedule( path, swarm, peer, outbox );
+}
+
+void SwarmDownloader::lockless_finish( Swarm& swarm, int64_t pieceId )
+{
+    PieceMap_t::iterator it = swarm.pieces.find(pieceId);
+    if( it == swarm.pieces.end() )
+        return;
+
+    Piece piece = it->second;
+    swarm.pieces.erase(it);
+
+    SourceMap_t::iterator source = swarm.sources.find( piece.peer );
+    if( source != swarm.sources.end() )
+        source->second.outstanding--;
+
+    // whichever of a piece and it's hedge finishes first makes the other
+    // one moot
+    if( piece.hedge >= 0 )
+        lockless_finish( swarm, piece.hedge );
+    if( piece.hedgeOf >= 0 )
+        lockless_finish( swarm, piece.hedgeOf );
+}
+
+void SwarmDownloader::send( Outbox_t& outbox )
+{
+    std::vector<int64_t> lost;
+    for( auto& out : outbox )
+    {
+        if( !m_backend->sendMessage( out.first, out.second ) )
+        {
+            delete out.second;
+            lost.push_back( out.first );
+        }
+    }
+    outbox.clear();
+
+    for( auto peer : lost )
+        peerLost(peer);
+}
+
+void SwarmDownloader::offer( int64_t peer, const Path_t& path,
+                             int64_t size, const VersionVector& version )
+{
+    Outbox_t outbox;
+    bool     isNewer = true;
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        SwarmMap_t::iterator it = m_swarms.find( path.string() );
+        if( it != m_swarms.end() )
+        {
+            Swarm& swarm = it->second;
+
+            // another peer with the version we're downloading joins in
+            if( swarm.version == version && swarm.size == size
+                    && !swarm.sources.count(peer) )
+            {
+                std::cout << "SwarmDownloader: (" << path << ") peer "
+                          << peer << " joins the download\n";
+                lockless_addSource( path.string(), swarm, peer, outbox );
+            }
+
+            // if it isn't newer than what we're downloading then there is
+            // no new download to start
+            isNewer = ( swarm.version < version );
+        }
+    }
+
+    send(outbox);
+    if( !isNewer )
+        return;
+
+    // a new download, or a newer version than the one we were getting
+    int64_t tx     = 0;
+    int64_t offset = 0;
+    if( !m_backend->addDownload( peer, path, size, version, tx, offset ) )
+        return;
+
+    {
+        pthreads::ScopedLock lock(m_mutex);
+
+        // if another peer offered the same version while we were
+        // registering the download then join that one instead
+        SwarmMap_t::iterator it = m_swarms.find( path.string() );
+        if( it != m_swarms.end() && !(it->second.version < version) )
+        {
+            if( it->second.version == version
+                    && !it->second.sources.count(peer) )
+                lockless_addSource( path.string(), it->second, peer, outbox );
+        }
+        else
+        {
+            Swarm& swarm = m_swarms[ path.string() ];
+            swarm = Swarm();
+            swarm.primary = peer;
+            swarm.tx      = tx;
+            swarm.size    = size;
+            swarm.version = version;
+
+            // a download which is resuming only needs what's past the
+            // prefix we have on disk. If we have all of it then an empty
+            // piece gets the hash so the download can be verified.
+            swarm.todo[offset] = std::max( offset, size );
+            lockless_addSource( path.string(), swarm, peer, outbox );
+        }
+    }
+
+    send(outbox);
+}
+
+bool SwarmDownloader::merge( int64_t peer, messages::FileChunk* chunk )
+{
+    if( !chunk->has_piece() )
+        return false;
+
+    Outbox_t outbox;
+    int64_t  primary = -1;
+    {
+        pthreads::ScopedLock lock(m_mutex);
+
+        // chunks of an obsolete download, or of a piece that was already
+        // received from someone else, are dropped
+        SwarmMap_t::iterator iswarm = m_swarms.find( chunk->path() );
+        if( iswarm == m_swarms.end() || iswarm->second.tx != chunk->tx() )
+            return true;
+
+        Swarm& swarm = iswarm->second;
+        primary      = swarm.primary;
+
+        PieceMap_t::iterator ipiece = swarm.pieces.find( chunk->piece() );
+        if( ipiece == swarm.pieces.end() || ipiece->second.peer != peer )
+        {
+            // except for the hash, which the last piece may send after
+            // it's data, i.e. after the piece is finished
+            if( !chunk->has_hash() || !chunk->data().empty() )
+                return true;
+        }
+        else
+        {
+            Piece&  piece  = ipiece->second;
+            Source& source = swarm.sources[peer];
+
+            // sample the peer's throughput
+            int64_t now = JobWorker::clock();
+            source.windowBytes += chunk->data().size();
+            if( source.windowStart == 0 )
+                source.windowStart = now;
+            else if( now - source.windowStart >= RATE_MS*1000 )
+            {
+                double sample = source.windowBytes * 1e6
+                                    / (now - source.windowStart);
+                source.rate   = ( source.rate > 0 )
+                                    ? 0.7*source.rate + 0.3*sample : sample;
+                source.windowStart = now;
+                source.windowBytes = 0;
+            }
+
+            piece.received += chunk->data().size();
+            if( piece.received >= piece.end - piece.begin )
+            {
+                int64_t lostPiece = -1;
+                if( piece.hedge >= 0 )
+                    lostPiece = piece.hedge;
+                if( piece.hedgeOf >= 0 )
+                    lostPiece = piece.hedgeOf;
+
+                int64_t loser = -1;
+                if( lostPiece >= 0 )
+                    loser = swarm.pieces[lostPiece].peer;
+
+                lockless_finish( swarm, chunk->piece() );
+                lockless_schedule( chunk->path(), swarm, peer, outbox );
+
+                // the other copy of the piece is still being sent, so tell
+                // it's peer to stop before giving it something else
+                if( loser >= 0 )
+                {
+                    messages::SendFile* msg = new messages::SendFile();
+                    msg->set_path( chunk->path() );
+                    msg->set_tx( swarm.tx );
+                    msg->set_piece( lostPiece );
+                    msg->set_cancel( true );
+                    outbox.push_back( Outgoing_t(loser,msg) );
+
+                    if( swarm.sources.count(loser) )
+                        lockless_schedule( chunk->path(), swarm, loser,
+                                           outbox );
+                }
+            }
+        }
+    }
+
+    send(outbox);
+
+    // every piece goes into the primary's staging file. The write is done
+    // without the lock so that it doesn't hold up chunks of every other
+    // download, the database serializes merges into the same file.
+    if( !m_backend->db().mergeData( primary, m_backend->stageDir(), chunk ) )
+        return true;
+
+    // a late chunk may find the file complete as well, only the first one
+    // to get here verifies it
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        SwarmMap_t::iterator iswarm = m_swarms.find( chunk->path() );
+        if( iswarm == m_swarms.end() || iswarm->second.tx != chunk->tx() )
+            return true;
+        m_swarms.erase( iswarm );
+    }
+
+    // once the last bytes are in the file is verified off of the message
+    // thread
+    m_backend->jobs()->enqueue(
+        new jobs::VerifyDownload( m_backend, primary, chunk->path(),
+                                  chunk->tx() ) );
+
+    return true;
+}
+
+void SwarmDownloader::peerLost( int64_t peer )
+{
+    Outbox_t outbox;
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        for( auto& pair : m_swarms )
+        {
+            Swarm& swarm = pair.second;
+            if( !swarm.sources.count(peer) )
+                continue;
+
+            // whatever the peer hadn't sent yet goes back in the pool,
+            // unless another peer is already getting it
+            PieceMap_t::iterator it = swarm.pieces.begin();
+            while( it != swarm.pieces.end() )
+            {
+                Piece& piece = it->second;
+                if( piece.peer != peer )
+                {
+                    ++it;
+                    continue;
+                }
+
+                if( piece.hedge >= 0 )
+                    swarm.pieces[piece.hedge].hedgeOf = -1;
+                else if( piece.hedgeOf >= 0 )
+                    swarm.pieces[piece.hedgeOf].hedge = -1;
+                else if( piece.begin + piece.received < piece.end )
+                    swarm.todo[ piece.begin + piece.received ] = piece.end;
+
+                swarm.pieces.erase( it++ );
+            }
+
+            swarm.sources.erase(peer);
+            for( auto& source : swarm.sources )
+                lockless_schedule( pair.first, swarm, source.first, outbox );
+        }
+    }
+
+    send(outbox);
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
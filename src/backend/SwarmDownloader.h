@@ -0,0 +1,171 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/SwarmDownloader.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_SWARMDOWNLOADER_H_
+#define OPENBOOK_FS_SWARMDOWNLOADER_H_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include <boost/filesystem.hpp>
+#include <cpp-pthreads.h>
+
+#include "messages.pb.h"
+#include "VersionVector.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+class Backend;
+
+/// downloads a file from every connected peer which has the version we
+/// want, at the same time
+/**
+ *  The first peer to offer a version becomes the primary, the download is
+ *  registered in the database under it's id and every piece, whoever it
+ *  comes from, is merged into that download's staging file. The file is
+ *  split into pieces which are requested with ranged SendFile messages.
+ *  Each peer has a couple of pieces outstanding at once, and the size of
+ *  the pieces it is given follows it's observed throughput, so faster peers
+ *  end up sending more of the file. Once there is nothing left to hand out
+ *  a peer which runs out of work is given the remainder of the largest
+ *  piece still outstanding with another peer (a hedged request), and
+ *  whichever copy finishes first wins.
+ */
+class SwarmDownloader
+{
+    public:
+        typedef boost::filesystem::path     Path_t;
+
+        /// smallest piece handed out
+        static const int64_t MIN_PIECE   = 256*1024;
+
+        /// largest piece handed out
+        static const int64_t MAX_PIECE   = 16*1024*1024;
+
+        /// size of pieces given to a peer before we know it's throughput
+        static const int64_t FIRST_PIECE = 1024*1024;
+
+        /// pieces are sized to take about this long at the peer's rate
+        static const int64_t PIECE_MS    = 2000;
+
+        /// throughput is sampled over windows of this length
+        static const int64_t RATE_MS     = 1000;
+
+        /// number of pieces outstanding with each peer
+        static const int     PIPELINE    = 2;
+
+    private:
+        /// a range of the file requested from one peer
+        struct Piece
+        {
+            int64_t     peer;       ///< who it was requested from
+            int64_t     begin;      ///< first byte
+            int64_t     end;        ///< one past the last byte
+            int64_t     received;   ///< bytes received so far
+            int64_t     hedge;      ///< piece hedging this one, or -1
+            int64_t     hedgeOf;    ///< piece this one hedges, or -1
+        };
+
+        /// a peer sending pieces of the file
+        struct Source
+        {
+            int         outstanding;///< pieces requested and not finished
+            double      rate;       ///< bytes per second, 0 if unknown
+            int64_t     windowStart;///< start of the current rate sample
+            int64_t     windowBytes;///< bytes received in the sample
+        };
+
+        typedef std::map<int64_t,int64_t>   RangeMap_t;
+        typedef std::map<int64_t,Piece>     PieceMap_t;
+        typedef std::map<int64_t,Source>    SourceMap_t;
+
+        /// one file being downloaded
+        struct Swarm
+        {
+            int64_t         primary;    ///< peer the download belongs to
+            int64_t         tx;         ///< transaction of the download
+            int64_t         size;       ///< size of the file
+            VersionVector   version;    ///< version being downloaded
+            RangeMap_t      todo;       ///< ranges not yet requested
+            PieceMap_t      pieces;     ///< outstanding pieces by id
+            SourceMap_t     sources;    ///< peers with this version
+        };
+
+        typedef std::map<std::string,Swarm>     SwarmMap_t;
+        typedef std::pair<int64_t,messages::SendFile*>  Outgoing_t;
+        typedef std::vector<Outgoing_t>         Outbox_t;
+
+        Backend*        m_backend;
+        pthreads::Mutex m_mutex;        ///< locks everything below
+        SwarmMap_t      m_swarms;       ///< downloads by path
+        int64_t         m_nextPiece;    ///< id of the next piece
+
+        /// the size of the next piece to give a peer
+        int64_t pieceSize( const Source& source );
+
+        /// give a peer pieces until it has PIPELINE outstanding, messages
+        /// are added to @p outbox to be sent once the lock is released
+        void lockless_schedule( const std::string& path, Swarm& swarm,
+                                int64_t peer, Outbox_t& outbox );
+
+        /// add a peer to a download and give it pieces
+        void lockless_addSource( const std::string& path, Swarm& swarm,
+                                 int64_t peer, Outbox_t& outbox );
+
+        /// remove a piece that is finished or abandoned, along with the
+        /// piece it hedges or that hedges it
+        void lockless_finish( Swarm& swarm, int64_t pieceId );
+
+        /// send requests, peers which have gone away are dropped
+        void send( Outbox_t& outbox );
+
+    public:
+        SwarmDownloader( Backend* backend );
+        ~SwarmDownloader();
+
+        /// a peer has @p version of a file which is newer than ours. If
+        /// that version is already being downloaded the peer joins the
+        /// download, otherwise a new download is started with it
+        void offer( int64_t peer, const Path_t& path, int64_t size,
+                    const VersionVector& version );
+
+        /// merge a chunk of a piece, returns false if @p chunk isn't part
+        /// of a piece
+        bool merge( int64_t peer, messages::FileChunk* chunk );
+
+        /// return the pieces of a disconnected peer to the pool
+        void peerLost( int64_t peer );
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // SWARMDOWNLOADER_H_
@@ -0,0 +1,189 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/TreeWalker.cpp
+ *
+ *  @brief  
+ */
+
+#include <cerrno>
+#include <iostream>
+
+#include "TreeWalker.h"
+#include "Database.h"
+
+
+namespace   openbook {
+namespace filesystem {
+
+/// appends an entry of a directory listing to the children of the
+/// TreeWalker::Dir passed as @p ctx
+static int addChild( void* ctx, const Database::ListEntry& entry,
+                     off_t offset )
+{
+    TreeWalker::Child child;
+    child.name       = entry.name;
+    child.error      = 0;
+    child.subscribed = entry.meta.subscribed;
+    static_cast<TreeWalker::Dir*>(ctx)->children.push_back(child);
+    return 0;
+}
+
+TreeWalker::TreeWalker( const Path_t& root, Database& db,
+                        const Path_t& start, int nThreads, int window ):
+    m_root(root),
+    m_db(db),
+    m_window(window > 0 ? window : 1),
+    m_quit(false)
+{
+    m_mutex.init();
+    m_workCond.init();
+    m_doneCond.init();
+
+    m_queue.push_back(start);
+
+    if( nThreads < 1 )
+        nThreads = 1;
+
+    m_threads.resize(nThreads);
+    for( auto& thread : m_threads )
+    {
+        int result = thread.launch( dispatch_main, this );
+        if( result )
+            std::cerr << "TreeWalker: failed to launch worker thread, errno "
+                      << result << "\n";
+    }
+}
+
+TreeWalker::~TreeWalker()
+{
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        m_quit = true;
+        m_workCond.broadcast();
+    }
+
+    for( auto& thread : m_threads )
+        thread.join();
+
+    for( Dir* dir : m_dirs )
+        delete dir;
+
+    m_mutex.destroy();
+    m_workCond.destroy();
+    m_doneCond.destroy();
+}
+
+void TreeWalker::fill()
+{
+    // m_queue and the membership of m_dirs are only changed by the
+    // consumer thread so the listing can be done without holding the lock
+    while( (int)m_dirs.size() < m_window && m_queue.size() > 0 )
+    {
+        Dir* dir = new Dir();
+        dir->path = m_queue.front();
+        m_queue.pop_front();
+
+        // all entries along with whether we're subscribed to them, in
+        // one query
+        int64_t dirId = m_db.getFileId( dir->path );
+        if( dirId >= 0 )
+            m_db.readdir( dirId, dir, addChild, 0 );
+        dir->pending = dir->children.size();
+
+        pthreads::ScopedLock lock(m_mutex);
+        m_dirs.push_back(dir);
+        for( int i=0; i < (int)dir->children.size(); i++ )
+        {
+            Task task = { dir, i };
+            m_tasks.push_back(task);
+        }
+        m_workCond.broadcast();
+    }
+}
+
+bool TreeWalker::next( Dir& out )
+{
+    fill();
+    if( m_dirs.empty() )
+        return false;
+
+    Dir* dir = m_dirs.front();
+    {
+        pthreads::ScopedLock lock(m_mutex);
+        while( dir->pending > 0 )
+            m_doneCond.wait(m_mutex);
+        m_dirs.pop_front();
+    }
+
+    // queue up subdirectories in breadth first order
+    for( auto& child : dir->children )
+    {
+        if( !child.error && S_ISDIR(child.stat.st_mode) )
+            m_queue.push_back( dir->path / child.name );
+    }
+
+    out.path = dir->path;
+    out.children.swap( dir->children );
+    out.pending = 0;
+    delete dir;
+
+    // keep the workers busy while the consumer handles this one
+    fill();
+    return true;
+}
+
+void* TreeWalker::dispatch_main( void* vp_walker )
+{
+    static_cast<TreeWalker*>(vp_walker)->main();
+    return vp_walker;
+}
+
+void TreeWalker::main()
+{
+    while( true )
+    {
+        Task task;
+        {
+            pthreads::ScopedLock lock(m_mutex);
+            while( !m_quit && m_tasks.empty() )
+                m_workCond.wait(m_mutex);
+            if( m_quit )
+                return;
+
+            // tasks are in breadth first order so the earliest directory
+            // is always finished first
+            task = m_tasks.front();
+            m_tasks.pop_front();
+        }
+
+        Child& child = task.dir->children[task.child];
+        Path_t fullpath = m_root / task.dir->path / child.name;
+        if( stat( fullpath.c_str(), &child.stat ) )
+            child.error = errno;
+
+        pthreads::ScopedLock lock(m_mutex);
+        if( --task.dir->pending == 0 && task.dir == m_dirs.front() )
+            m_doneCond.signal();
+    }
+}
+
+
+} //< namespace filesystem
+} //< namespace openbook
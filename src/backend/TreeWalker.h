@@ -0,0 +1,127 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/backend/TreeWalker.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_TREEWALKER_H_
+#define OPENBOOK_FS_TREEWALKER_H_
+
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+#include <cpp-pthreads.h>
+
+
+namespace   openbook {
+namespace filesystem {
+
+class Database;
+
+/// walks the mirrored tree breadth first, stat'ing the children of many
+/// directories concurrently on a small pool of threads
+/**
+ *  The consumer calls next() to retrieve directories in breadth first
+ *  order, each with all of it's children already stat'ed. Behind the
+ *  scenes up to @p window directories are listed ahead of the consumer
+ *  and the stat calls for all of their children are farmed out to the
+ *  pool, earliest directory first, so that on cold caches the walk is
+ *  bounded by the IOPS of the disk rather than the latency of each stat.
+ */
+class TreeWalker
+{
+    public:
+        typedef boost::filesystem::path Path_t;
+
+        /// one entry of a directory
+        struct Child
+        {
+            std::string name;       ///< name of the entry
+            bool        subscribed; ///< if we are subscribed to it
+            int         error;      ///< errno if the stat failed, else 0
+            struct stat stat;       ///< result of stat
+        };
+
+        /// a directory and its entries
+        struct Dir
+        {
+            Path_t              path;       ///< relative to the root
+            std::vector<Child>  children;   ///< entries of the directory
+            int                 pending;    ///< children not yet stat'ed
+        };
+
+    private:
+        /// one stat to perform
+        struct Task
+        {
+            Dir*    dir;
+            int     child;
+        };
+
+        Path_t          m_root;     ///< real root of the tree
+        Database&       m_db;       ///< provides directory listings
+        int             m_window;   ///< max directories listed ahead
+
+        std::list<Path_t>   m_queue;    ///< directories not yet listed
+        std::list<Dir*>     m_dirs;     ///< listed directories, in order
+        std::deque<Task>    m_tasks;    ///< stats not yet started
+
+        pthreads::Mutex     m_mutex;    ///< locks the queues
+        pthreads::Condition m_workCond; ///< signals workers of new tasks
+        pthreads::Condition m_doneCond; ///< signals the consumer
+        bool                m_quit;     ///< tells workers to exit
+
+        std::vector<pthreads::Thread> m_threads;
+
+        /// list directories from the queue until the window is full
+        void fill();
+
+        /// worker thread main
+        void main();
+
+        /// static entry point for worker threads
+        static void* dispatch_main( void* vp_walker );
+
+    public:
+        /// start walking at @p start, relative to @p root, using
+        /// @p nThreads threads to stat entries
+        TreeWalker( const Path_t& root, Database& db, const Path_t& start,
+                    int nThreads=8, int window=64 );
+
+        /// stops the worker threads
+        ~TreeWalker();
+
+        /// retrieve the next directory in breadth first order, returns
+        /// false when the walk is finished. Subdirectories of the returned
+        /// directory are queued to be walked.
+        bool next( Dir& dir );
+};
+
+
+} //< namespace filesystem
+} //< namespace openbook
+
+
+#endif // TREEWALKER_H_
@@ -24,12 +24,89 @@
  *  @brief  
  */
 
+#include <algorithm>
+
 #include "VersionVector.h"
 #include <boost/format.hpp>
 
 namespace   openbook {
 namespace filesystem {
 
+const int VersionVector::INLINE_SIZE;
+
+VersionVector::VersionVector():
+    m_data(m_inline),
+    m_size(0),
+    m_capacity(INLINE_SIZE)
+{}
+
+VersionVector::VersionVector( const VersionVector& other ):
+    m_data(m_inline),
+    m_size(0),
+    m_capacity(INLINE_SIZE)
+{
+    *this = other;
+}
+
+VersionVector::~VersionVector()
+{
+    if( m_data != m_inline )
+        delete [] m_data;
+}
+
+VersionVector& VersionVector::operator=( const VersionVector& other )
+{
+    if( &other == this )
+        return *this;
+
+    reserve( other.m_size );
+    std::copy( other.begin(), other.end(), m_data );
+    m_size = other.m_size;
+    return *this;
+}
+
+void VersionVector::reserve( int capacity )
+{
+    if( capacity <= m_capacity )
+        return;
+
+    int newCapacity = 2*m_capacity;
+    if( newCapacity < capacity )
+        newCapacity = capacity;
+
+    pair_t* data = new pair_t[newCapacity];
+    std::copy( begin(), end(), data );
+    if( m_data != m_inline )
+        delete [] m_data;
+
+    m_data     = data;
+    m_capacity = newCapacity;
+}
+
+/// compare only the keys of version vector entries
+static bool keyLess( const VersionVector::pair_t& entry, int64_t key )
+{
+    return entry.first < key;
+}
+
+VersionVector::iterator VersionVector::find( int64_t key )
+{
+    iterator it = std::lower_bound( begin(), end(), key, keyLess );
+    if( it != end() && it->first == key )
+        return it;
+    else
+        return end();
+}
+
+VersionVector::const_iterator VersionVector::find( int64_t key ) const
+{
+    const_iterator it = std::lower_bound( begin(), end(), key, keyLess );
+    if( it != end() && it->first == key )
+        return it;
+    else
+        return end();
+}
+
 void VersionVector::keyUnion( set_t& keys, const VersionVector& other ) const
 {
     for( auto& pair : *this )
@@ -40,7 +117,7 @@ void VersionVector::keyUnion( set_t& keys, const VersionVector& other ) const
 
 int64_t VersionVector::operator[]( int64_t key ) const
 {
-    auto it = find(key);
+    const_iterator it = find(key);
     if( it != end() )
         return it->second;
     else
@@ -49,53 +126,68 @@ int64_t VersionVector::operator[]( int64_t key ) const
 
 int64_t& VersionVector::operator[]( int64_t key )
 {
-    auto it = find(key);
-    if( it != end() )
+    iterator it = std::lower_bound( begin(), end(), key, keyLess );
+    if( it != end() && it->first == key )
         return it->second;
-    else
-    {
-        std::pair< map_t::iterator,bool > result =
-            insert( pair_t(key,0) );
-        return result.first->second;
-    }
+
+    // insert a new zero entry, keeping the array sorted
+    int idx = it - begin();
+    reserve( m_size + 1 );
+    std::copy_backward( begin() + idx, end(), end() + 1 );
+    m_size++;
+
+    m_data[idx] = pair_t(key,0);
+    return m_data[idx].second;
 }
 
-bool VersionVector::operator<( const VersionVector& other ) const
+VersionVector::Order VersionVector::compare( const VersionVector& other ) const
 {
-    // build a set of all keys in both vectors
-    set_t   keys;
-    keyUnion(keys,other);
-
-    bool atLeastOneLess = false;
+    bool anyLess    = false;
+    bool anyGreater = false;
 
-    for( auto& key : keys )
+    // walk both sorted arrays together, missing entries are zero
+    const_iterator a = begin();
+    const_iterator b = other.begin();
+    while( a != end() || b != other.end() )
     {
-        int64_t v1 = (*this)[key];
-        int64_t v2 = other[key];
-        if( v1 > v2 )
-            return false;
-        else if( v1 < v2 )
-            atLeastOneLess = true;
+        int64_t v1 = 0;
+        int64_t v2 = 0;
+        if( b == other.end() || ( a != end() && a->first < b->first ) )
+            v1 = (a++)->second;
+        else if( a == end() || b->first < a->first )
+            v2 = (b++)->second;
+        else
+        {
+            v1 = (a++)->second;
+            v2 = (b++)->second;
+        }
+
+        if( v1 < v2 )
+            anyLess = true;
+        else if( v1 > v2 )
+            anyGreater = true;
+
+        if( anyLess && anyGreater )
+            return CONCURRENT;
     }
 
-    return atLeastOneLess;
+    if( anyLess )
+        return LESS;
+    else if( anyGreater )
+        return GREATER;
+    else
+        return EQUAL;
 }
 
-bool VersionVector::operator<=( const VersionVector& other ) const
+bool VersionVector::operator<( const VersionVector& other ) const
 {
-    // build a set of all keys in both vectors
-    set_t   keys;
-    keyUnion(keys,other);
-
-    for( auto& key : keys )
-    {
-        int64_t v1 = (*this)[key];
-        int64_t v2 = other[key];
-        if( v1 > v2 )
-            return false;
-    }
+    return compare(other) == LESS;
+}
 
-    return true;
+bool VersionVector::operator<=( const VersionVector& other ) const
+{
+    Order order = compare(other);
+    return order == LESS || order == EQUAL;
 }
 
 bool VersionVector::operator>( const VersionVector& other ) const
@@ -111,19 +203,7 @@ bool VersionVector::operator>=( const VersionVector& other ) const
 
 bool VersionVector::operator==( const VersionVector& other ) const
 {
-    // build a set of all keys in both vectors
-    set_t   keys;
-    keyUnion(keys,other);
-
-    for( auto& key : keys )
-    {
-        int64_t v1 = (*this)[key];
-        int64_t v2 = other[key];
-        if( v1 != v2 )
-            return false;
-    }
-
-    return true;
+    return compare(other) == EQUAL;
 }
 
 bool VersionVector::operator!=( const VersionVector& other ) const
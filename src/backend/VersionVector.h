@@ -27,28 +27,81 @@
 #ifndef OPENBOOK_FS_VERSIONVECTOR_H_
 #define OPENBOOK_FS_VERSIONVECTOR_H_
 
-#include <map>
 #include <set>
 #include <cstdint>
 #include <ostream>
+#include <utility>
 
 namespace   openbook {
 namespace filesystem {
 
 /// maps client id to version number
-class VersionVector:
-    public std::map<int64_t,int64_t>
+/**
+ *  Stored as a flat array of (client,version) pairs sorted by client id.
+ *  Most files are only ever touched by a handful of peers so the first
+ *  few pairs are stored inline and the vector only allocates when it
+ *  grows past INLINE_SIZE. Comparisons are a single merge walk over the
+ *  two arrays, with missing entries taken to be zero.
+ */
+class VersionVector
 {
     public:
         typedef std::pair<int64_t,int64_t>  pair_t;
-        typedef std::map<int64_t,int64_t>   map_t;
+        typedef pair_t                      value_type;
+        typedef pair_t*                     iterator;
+        typedef const pair_t*               const_iterator;
         typedef std::set<int64_t>           set_t;
 
+        /// number of entries stored without allocating
+        static const int INLINE_SIZE = 4;
+
+        /// result of comparing two version vectors
+        enum Order
+        {
+            EQUAL,      ///< every entry is the same
+            LESS,       ///< every entry is <=, at least one is <
+            GREATER,    ///< every entry is >=, at least one is >
+            CONCURRENT  ///< some entries are < and some are >
+        };
+
+    private:
+        pair_t      m_inline[INLINE_SIZE];  ///< storage for small vectors
+        pair_t*     m_data;                 ///< m_inline or heap storage
+        int         m_size;                 ///< number of entries
+        int         m_capacity;             ///< size of m_data
+
+        /// make room for at least @p capacity entries
+        void reserve( int capacity );
+
+    public:
+        VersionVector();
+        VersionVector( const VersionVector& other );
+        ~VersionVector();
+
+        VersionVector& operator=( const VersionVector& other );
+
+        iterator        begin()         { return m_data; }
+        iterator        end()           { return m_data + m_size; }
+        const_iterator  begin() const   { return m_data; }
+        const_iterator  end()   const   { return m_data + m_size; }
+
+        int     size()  const { return m_size; }
+        bool    empty() const { return m_size == 0; }
+        void    clear()       { m_size = 0; }
+
+        /// return the entry for @p key, or end() if there isn't one
+        iterator        find( int64_t key );
+        const_iterator  find( int64_t key ) const;
+
         void keyUnion( set_t& keys, const VersionVector& other ) const;
 
         int64_t  operator[]( int64_t key ) const;
         int64_t& operator[]( int64_t key );
 
+        /// determine the ordering of this vector with respect to
+        /// @p other in one pass
+        Order compare( const VersionVector& other ) const;
+
         /// for ordering of version vectors
         bool operator<( const VersionVector& other ) const;
 
@@ -34,6 +34,7 @@
 #define HAVE_SETXATTR
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 
 
 #endif // FUSE_INCLUDE_H_
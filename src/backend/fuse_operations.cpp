@@ -56,6 +56,10 @@ void setFuseOps( fuse_operations& fuse_ops )
     fuse_ops.open        = fuse_ops::open;
     fuse_ops.read        = fuse_ops::read;
     fuse_ops.write       = fuse_ops::write;
+#if FUSE_VERSION >= 29
+    fuse_ops.read_buf    = fuse_ops::read_buf;
+    fuse_ops.write_buf   = fuse_ops::write_buf;
+#endif
     fuse_ops.statfs      = fuse_ops::statfs;
     fuse_ops.flush       = fuse_ops::flush;
     fuse_ops.release     = fuse_ops::release;
@@ -81,6 +85,9 @@ void setFuseOps( fuse_operations& fuse_ops )
     fuse_ops.bmap        = NULL;
     fuse_ops.ioctl       = fuse_ops::ioctl;
     fuse_ops.poll        = fuse_ops::poll;
+#if FUSE_VERSION >= 29
+    fuse_ops.fallocate   = fuse_ops::fallocate;
+#endif
 }
 
 
@@ -102,7 +109,8 @@ int getattr (const char *path, struct stat *out)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->getattr(path,out);
+    FuseStats::Timer timer( fs->stats(), FuseStats::GETATTR );
+    return timer.done( fs->getattr(path,out) );
 }
 
 
@@ -111,7 +119,8 @@ int readlink (const char *path, char *buf, size_t bufsize)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->readlink(path,buf,bufsize);
+    FuseStats::Timer timer( fs->stats(), FuseStats::READLINK );
+    return timer.done( fs->readlink(path,buf,bufsize) );
 }
 
 
@@ -127,7 +136,8 @@ int mknod (const char *pathname, mode_t mode, dev_t dev)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->mknod(pathname,mode,dev);
+    FuseStats::Timer timer( fs->stats(), FuseStats::MKNOD );
+    return timer.done( fs->mknod(pathname,mode,dev) );
 }
 
 
@@ -136,7 +146,8 @@ int mkdir (const char *pathname, mode_t mode)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->mkdir(pathname,mode);
+    FuseStats::Timer timer( fs->stats(), FuseStats::MKDIR );
+    return timer.done( fs->mkdir(pathname,mode) );
 }
 
 
@@ -145,7 +156,8 @@ int unlink (const char *pathname)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->unlink(pathname);
+    FuseStats::Timer timer( fs->stats(), FuseStats::UNLINK );
+    return timer.done( fs->unlink(pathname) );
 }
 
 
@@ -154,7 +166,8 @@ int rmdir (const char *pathname)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->rmdir(pathname);
+    FuseStats::Timer timer( fs->stats(), FuseStats::RMDIR );
+    return timer.done( fs->rmdir(pathname) );
 }
 
 
@@ -163,7 +176,8 @@ int symlink (const char *oldpath, const char *newpath)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->symlink(oldpath,newpath);
+    FuseStats::Timer timer( fs->stats(), FuseStats::SYMLINK );
+    return timer.done( fs->symlink(oldpath,newpath) );
 }
 
 
@@ -172,7 +186,8 @@ int rename (const char *oldpath, const char *newpath)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->rename(oldpath,newpath);
+    FuseStats::Timer timer( fs->stats(), FuseStats::RENAME );
+    return timer.done( fs->rename(oldpath,newpath) );
 }
 
 
@@ -181,7 +196,8 @@ int link (const char *oldpath, const char *newpath)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->link(oldpath,newpath);
+    FuseStats::Timer timer( fs->stats(), FuseStats::LINK );
+    return timer.done( fs->link(oldpath,newpath) );
 }
 
 
@@ -190,7 +206,8 @@ int chmod (const char *path, mode_t mode)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->chmod(path,mode);
+    FuseStats::Timer timer( fs->stats(), FuseStats::CHMOD );
+    return timer.done( fs->chmod(path,mode) );
 }
 
 
@@ -199,7 +216,8 @@ int chown (const char *path, uid_t owner, gid_t group)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->chown(path,owner,group);
+    FuseStats::Timer timer( fs->stats(), FuseStats::CHOWN );
+    return timer.done( fs->chown(path,owner,group) );
 }
 
 
@@ -208,7 +226,8 @@ int truncate (const char *path, off_t length)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->truncate(path,length);
+    FuseStats::Timer timer( fs->stats(), FuseStats::TRUNCATE );
+    return timer.done( fs->truncate(path,length) );
 }
 
 
@@ -224,7 +243,8 @@ int open (const char *pathname, struct fuse_file_info *info)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->open(pathname,info);
+    FuseStats::Timer timer( fs->stats(), FuseStats::OPEN );
+    return timer.done( fs->open(pathname,info) );
 }
 
 
@@ -237,11 +257,48 @@ int read (const char *pathname,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->read(pathname,buf,bufsize,offset,info);
+    FuseStats::Timer timer( fs->stats(), FuseStats::READ );
+    return timer.transferred( fs->read(pathname,buf,bufsize,offset,info) );
 }
 
 
 
+#if FUSE_VERSION >= 29
+int read_buf (const char *pathname,
+                        struct fuse_bufvec **bufp,
+                        size_t bufsize,
+                        off_t offset,
+                        struct fuse_file_info *info)
+{
+    fuse_context* ctx = fuse_get_context();
+    FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
+
+    // libfuse copies or splices the buffer into the reply after we return,
+    // so the latency only covers producing the buffer. The buffer is sized
+    // to what the reply will hold (see FuseContext::read_buf()).
+    FuseStats::Timer timer( fs->stats(), FuseStats::READ );
+    int result = timer.done( fs->read_buf(pathname,bufp,bufsize,offset,info) );
+    if( result == 0 )
+        FuseStats::bytes( fuse_buf_size(*bufp) );
+    return result;
+}
+
+
+
+int write_buf (const char *pathname,
+                        struct fuse_bufvec *buf,
+                        off_t offset,
+                        struct fuse_file_info *info)
+{
+    fuse_context* ctx = fuse_get_context();
+    FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
+    FuseStats::Timer timer( fs->stats(), FuseStats::WRITE );
+    return timer.transferred( fs->write_buf(pathname,buf,offset,info) );
+}
+#endif
+
+
+
 int write (const char *pathname,
                         const char *buf,
                         size_t bufsize,
@@ -250,7 +307,8 @@ int write (const char *pathname,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->write(pathname,buf,bufsize,offset,info);
+    FuseStats::Timer timer( fs->stats(), FuseStats::WRITE );
+    return timer.transferred( fs->write(pathname,buf,bufsize,offset,info) );
 }
 
 
@@ -259,7 +317,8 @@ int statfs (const char *path, struct statvfs *buf)
 {
    fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->statfs(path,buf);
+    FuseStats::Timer timer( fs->stats(), FuseStats::STATFS );
+    return timer.done( fs->statfs(path,buf) );
 }
 
 
@@ -268,7 +327,8 @@ int flush (const char *path, struct fuse_file_info *info)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->flush(path,info);
+    FuseStats::Timer timer( fs->stats(), FuseStats::FLUSH );
+    return timer.done( fs->flush(path,info) );
 }
 
 
@@ -277,7 +337,8 @@ int release (const char *path, struct fuse_file_info *info)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->release(path,info);
+    FuseStats::Timer timer( fs->stats(), FuseStats::RELEASE );
+    return timer.done( fs->release(path,info) );
 }
 
 
@@ -288,7 +349,8 @@ int fsync (const char *path,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->fsync(path,syncdata,info);
+    FuseStats::Timer timer( fs->stats(), FuseStats::FSYNC );
+    return timer.done( fs->fsync(path,syncdata,info) );
 }
 
 
@@ -301,7 +363,8 @@ int setxattr (const char *pathname,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->setxattr(pathname,key,value,bufsize,unknown);
+    FuseStats::Timer timer( fs->stats(), FuseStats::SETXATTR );
+    return timer.done( fs->setxattr(pathname,key,value,bufsize,unknown) );
 }
 
 
@@ -313,7 +376,8 @@ int getxattr (const char *pathname,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->getxattr(pathname,key,buf,bufsize);
+    FuseStats::Timer timer( fs->stats(), FuseStats::GETXATTR );
+    return timer.done( fs->getxattr(pathname,key,buf,bufsize) );
 }
 
 
@@ -324,7 +388,8 @@ int listxattr (const char *pathname,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->listxattr(pathname,buf,bufsize);
+    FuseStats::Timer timer( fs->stats(), FuseStats::LISTXATTR );
+    return timer.done( fs->listxattr(pathname,buf,bufsize) );
 }
 
 
@@ -333,7 +398,8 @@ int removexattr (const char *pathname, const char *key)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->removexattr(pathname,key);
+    FuseStats::Timer timer( fs->stats(), FuseStats::REMOVEXATTR );
+    return timer.done( fs->removexattr(pathname,key) );
 }
 
 
@@ -343,7 +409,8 @@ int opendir (const char *path,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->opendir(path,fi);
+    FuseStats::Timer timer( fs->stats(), FuseStats::OPENDIR );
+    return timer.done( fs->opendir(path,fi) );
 }
 
 
@@ -356,7 +423,8 @@ int readdir (const char *path,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->readdir(path,buf,filler,offset,fi);
+    FuseStats::Timer timer( fs->stats(), FuseStats::READDIR );
+    return timer.done( fs->readdir(path,buf,filler,offset,fi) );
 }
 
 
@@ -365,7 +433,8 @@ int releasedir (const char *path, struct fuse_file_info *fi)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->releasedir(path,fi);
+    FuseStats::Timer timer( fs->stats(), FuseStats::RELEASEDIR );
+    return timer.done( fs->releasedir(path,fi) );
 }
 
 
@@ -375,7 +444,8 @@ int fsyncdir (const char *path, int datasync,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->fsyncdir(path,datasync,fi);
+    FuseStats::Timer timer( fs->stats(), FuseStats::FSYNCDIR );
+    return timer.done( fs->fsyncdir(path,datasync,fi) );
 }
 
 
@@ -384,6 +454,8 @@ void *init (struct fuse_conn_info *conn)
 {
     std::cout << "fuse_opts::init: INIT!!\n\n";
     fuse_context*       ctx  = fuse_get_context();
+    FuseContext*        fs   = static_cast<FuseContext*>(ctx->private_data);
+    fs->init(conn);
     return ctx->private_data;
 }
 
@@ -401,7 +473,8 @@ int access (const char *path, int mode)
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->access(path,mode);
+    FuseStats::Timer timer( fs->stats(), FuseStats::ACCESS );
+    return timer.done( fs->access(path,mode) );
 }
 
 
@@ -412,7 +485,8 @@ int create (const char *path,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->create(path,mode,fi);
+    FuseStats::Timer timer( fs->stats(), FuseStats::CREATE );
+    return timer.done( fs->create(path,mode,fi) );
 }
 
 
@@ -423,7 +497,8 @@ int ftruncate (const char *path,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->ftruncate(path,length,fi);
+    FuseStats::Timer timer( fs->stats(), FuseStats::FTRUNCATE );
+    return timer.done( fs->ftruncate(path,length,fi) );
 }
 
 
@@ -434,7 +509,8 @@ int fgetattr (   const char *path,
 {
     fuse_context* ctx = fuse_get_context();
     FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
-    return fs->fgetattr(path,sf,fi);
+    FuseStats::Timer timer( fs->stats(), FuseStats::FGETATTR );
+    return timer.done( fs->fgetattr(path,sf,fi) );
 }
 
 
@@ -477,6 +553,22 @@ int poll ( const char *, struct fuse_file_info *,
 
 
 
+#if FUSE_VERSION >= 29
+int fallocate (const char *pathname,
+                        int mode,
+                        off_t offset,
+                        off_t length,
+                        struct fuse_file_info *info)
+{
+    fuse_context* ctx = fuse_get_context();
+    FuseContext*    fs = static_cast<FuseContext*>(ctx->private_data);
+    FuseStats::Timer timer( fs->stats(), FuseStats::FALLOCATE );
+    return timer.done( fs->fallocate(pathname,mode,offset,length,info) );
+}
+#endif
+
+
+
 } // namespace fuseops
 } // namespace filesystem
 } // namespace openbook
@@ -65,6 +65,12 @@ int truncate (const char *, off_t);
 int open (const char *, struct fuse_file_info *);
 int read (const char *, char *, size_t, off_t,
                         struct fuse_file_info *);
+#if FUSE_VERSION >= 29
+int read_buf (const char *, struct fuse_bufvec **, size_t, off_t,
+                struct fuse_file_info *);
+int write_buf (const char *, struct fuse_bufvec *, off_t,
+                struct fuse_file_info *);
+#endif
 int write (const char *, const char *, size_t, off_t,
                       struct fuse_file_info *);
 int statfs (const char *, struct statvfs *);
@@ -94,6 +100,10 @@ int ioctl (const char *, int cmd, void *arg,
                       struct fuse_file_info *, unsigned int flags, void *data);
 int poll ( const char *, struct fuse_file_info *,
                       struct fuse_pollhandle *ph, unsigned *reventsp);
+#if FUSE_VERSION >= 29
+int fallocate (const char *, int, off_t, off_t,
+                      struct fuse_file_info *);
+#endif
 
 
 
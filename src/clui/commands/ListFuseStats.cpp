@@ -0,0 +1,101 @@
+
+#include <iomanip>
+
+#include "connection.h"
+#include "global.h"
+#include "FileDescriptor.h"
+#include "ReferenceCounted.h"
+#include "ExceptionStream.h"
+#include "ListFuseStats.h"
+
+namespace   openbook {
+namespace filesystem {
+namespace       clui {
+
+/// return the upper bound, in microseconds, of the histogram bucket which
+/// contains the @p fraction quantile of calls
+static int64_t quantile( const messages::FuseOpStats& stats, double fraction )
+{
+    int64_t count  = 0;
+    int64_t needed = (int64_t)( fraction * stats.calls() );
+    for(int i=0; i < stats.latency_size(); i++)
+    {
+        count += stats.latency(i);
+        if( count > needed || i+1 == stats.latency_size() )
+            return int64_t(1) << i;
+    }
+    return 0;
+}
+
+ListFuseStats::ListFuseStats(TCLAP::CmdLine& cmd):
+    Options(cmd)
+    {}
+
+void ListFuseStats::go(){
+    FdPtr_t sockfd = connectToClient(*this);    //< create a connection
+    Marshall marshall;        //< create a marshaller
+    marshall.setFd(*sockfd);  //< tell the marshaller the socket to use
+    handshake(marshall);      //< perform handshake protocol
+
+    // send the message
+    messages::GetBackendInfo* msg =
+            new messages::GetBackendInfo();
+    // fill the message
+    msg->set_req(messages::FUSE_STATS);
+
+    // send the message to the backend
+    marshall.writeMsg(msg);
+
+    // wait for the reply
+    RefPtr<AutoMessage> reply = marshall.read();
+
+    // if the backend replied with a message we weren't expecting then
+    // print an error
+    if( reply->type != MSG_FUSE_STAT_LIST )
+    {
+        std::cerr << "Unexpected reply of type: "
+                  << messageIdToString( reply->type )
+                  << "\n";
+    }
+    // otherwise print the table
+    else
+    {
+        messages::FuseStatList* msg =
+                static_cast<messages::FuseStatList*>(reply->msg);
+
+        std::cout << std::left  << std::setw(16) << "op"
+                  << std::right << std::setw(12) << "calls"
+                                << std::setw(10) << "errors"
+                                << std::setw(14) << "bytes"
+                                << std::setw(10) << "mean(us)"
+                                << std::setw(10) << "p50(us)"
+                                << std::setw(10) << "p99(us)"
+                  << "\n";
+
+        for(int i=0; i < msg->ops_size(); i++)
+        {
+            const messages::FuseOpStats& stats = msg->ops(i);
+            int64_t mean = stats.calls() ?
+                            stats.totalus() / stats.calls() : 0;
+
+            // latencies are only known to within a power of two
+            std::cout << std::left  << std::setw(16) << stats.op()
+                      << std::right << std::setw(12) << stats.calls()
+                                    << std::setw(10) << stats.errors()
+                                    << std::setw(14) << stats.bytes()
+                                    << std::setw(10) << mean
+                                    << std::setw(10) << quantile(stats,0.5)
+                                    << std::setw(10) << quantile(stats,0.99)
+                      << "\n";
+        }
+    }
+}
+
+const std::string ListFuseStats::COMMAND       = "fuse";
+const std::string ListFuseStats::DESCRIPTION   =
+        "per operation statistics of the fuse mounts";
+
+}
+}
+}
+
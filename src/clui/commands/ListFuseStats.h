@@ -0,0 +1,25 @@
+#ifndef OPENBOOK_FS_CLUI_LISTFUSESTATS_H_
+#define OPENBOOK_FS_CLUI_LISTFUSESTATS_H_
+
+#include "Options.h"
+
+namespace   openbook {
+namespace filesystem {
+namespace       clui {
+
+class ListFuseStats:
+	public Options
+{
+	public:
+        static const std::string COMMAND;
+        static const std::string DESCRIPTION;
+		ListFuseStats(TCLAP::CmdLine& cmd);
+		void go();
+};
+
+
+}
+}
+}
+
+#endif
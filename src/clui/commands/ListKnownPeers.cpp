@@ -1,6 +1,7 @@
 
 #include <crypto++/sha.h>
 #include <cmath>
+#include <iomanip>
 
 #include "connection.h"
 #include "global.h"
@@ -65,7 +66,9 @@ FdPtr_t sockfd = connectToClient(*this);    //< create a connection
 
         char idHeader[]   = "id";
         char nameHeader[] = "name";
+        char rttHeader[]  = "rtt (ms)";
         char fpHeader[]   = "fingerprint";
+        std::size_t lenRtt = sizeof(rttHeader);
 
         // print headers
         if( lenId < sizeof(idHeader) )
@@ -83,6 +86,10 @@ FdPtr_t sockfd = connectToClient(*this);    //< create a connection
         for(int i=0; i < 4 + lenName - sizeof(nameHeader); i++)
             std::cout << " ";
 
+        std::cout << rttHeader;
+        for(int i=0; i < 4 + lenRtt - sizeof(rttHeader); i++)
+            std::cout << " ";
+
         std::cout << fpHeader;
         std::cout <<"\n";
 
@@ -105,6 +112,18 @@ FdPtr_t sockfd = connectToClient(*this);    //< create a connection
                 strm << " ";
             std::cout << strm.str() << "   ";
 
+            // round trip time is only known for connected peers
+            strm.str("");
+            if( msg->peers(i).has_rtt() )
+                strm << std::fixed << std::setprecision(1)
+                     << msg->peers(i).rtt() / 1000.0;
+            else
+                strm << "-";
+            nSpaces = lenRtt - strm.str().length();
+            for(int i=0; i < nSpaces; i++)
+                strm << " ";
+            std::cout << strm.str() << "   ";
+
             using namespace CryptoPP;
             typedef SHA1 sha;
             std::string pubkey = msg->peers(i).publickey();
@@ -54,6 +54,7 @@
 #include "commands/SetLocalSocket.h"
 #include "commands/Release.h"
 #include "commands/ListKnownPeers.h"
+#include "commands/ListFuseStats.h"
 #include "commands/ListMounts.h"
 #include "commands/LoadConfig.h"
 #include "commands/SetRemoteSocket.h"
@@ -237,7 +238,8 @@ typedef DispatchList< Connect,
                       Release>          SingleCommands;
 
 typedef DispatchList< ListKnownPeers,
-                      ListMounts >      ListCommands;
+                      ListMounts,
+                      ListFuseStats >   ListCommands;
 
 typedef DispatchList< SetClientSocket,
                       SetDataDir,
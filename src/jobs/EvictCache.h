@@ -0,0 +1,66 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/EvictCache.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_EVICTCACHE_H_
+#define OPENBOOK_FS_EVICTCACHE_H_
+
+#include "LongJob.h"
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+/// periodically releases least recently used files if the checked-out
+/// files exceed the cache quota
+class EvictCache:
+    public LongJob
+{
+    private:
+        Backend*    m_backend;  ///< the backend object
+
+    public:
+        /// time between checks of the cache quota
+        static const int64_t INTERVAL_MS = 60000;
+
+        EvictCache(Backend* backend):
+            m_backend(backend)
+        {}
+
+        virtual ~EvictCache(){}
+
+        virtual void go()
+        {
+            m_backend->cache().evict();
+            m_backend->jobs()->schedule(
+                    new EvictCache(m_backend), INTERVAL_MS );
+        }
+};
+
+} //< jobs
+} //< filesystem
+} //< openbook
+
+
+
+#endif // EVICTCACHE_H_
@@ -0,0 +1,66 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/ExpireFetches.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_EXPIREFETCHES_H_
+#define OPENBOOK_FS_EXPIREFETCHES_H_
+
+#include "LongJob.h"
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+/// periodically fails the block requests of lazy reads that a peer hasn't
+/// answered (see LazyFetcher::expire)
+class ExpireFetches:
+    public LongJob
+{
+    private:
+        Backend*    m_backend;  ///< the backend object
+
+    public:
+        /// time between checks
+        static const int INTERVAL_MS = 1000;
+
+        ExpireFetches(Backend* backend):
+            m_backend(backend)
+        {}
+
+        virtual ~ExpireFetches(){}
+
+        virtual void go()
+        {
+            m_backend->fetcher().expire();
+            m_backend->jobs()->schedule(
+                    new ExpireFetches(m_backend), INTERVAL_MS );
+        }
+};
+
+} //< jobs
+} //< filesystem
+} //< openbook
+
+
+
+#endif // EXPIREFETCHES_H_
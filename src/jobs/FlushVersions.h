@@ -0,0 +1,67 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/FlushVersions.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_FLUSHVERSIONS_H_
+#define OPENBOOK_FS_FLUSHVERSIONS_H_
+
+#include "LongJob.h"
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+/// periodically applies the version increases of files that were modified
+/// through the mounts (see Database::incrementVersion)
+class FlushVersions:
+    public LongJob
+{
+    private:
+        Backend*    m_backend;  ///< the backend object
+
+    public:
+        /// default time between flushes
+        static const int INTERVAL_MS = 1000;
+
+        FlushVersions(Backend* backend):
+            m_backend(backend)
+        {}
+
+        virtual ~FlushVersions(){}
+
+        virtual void go()
+        {
+            m_backend->db().flushVersions();
+            m_backend->jobs()->schedule(
+                    new FlushVersions(m_backend),
+                    m_backend->versionFlushInterval() );
+        }
+};
+
+} //< jobs
+} //< filesystem
+} //< openbook
+
+
+
+#endif // FLUSHVERSIONS_H_
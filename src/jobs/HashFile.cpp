@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/HashFile.cpp
+ *
+ *  @brief  
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "HashFile.h"
+#include "Backend.h"
+#include "ContentHash.h"
+#include "FileDescriptor.h"
+
+
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+
+void HashFile::go()
+{
+    // another job may have got to it first
+    if( !m_backend->db().getContentHash( m_path ).empty() )
+        return;
+
+    // if the file changes while we're reading it the hash isn't stored
+    Database::GenerationWatch watch( m_backend->db(), m_path );
+
+    path_t fullpath = m_backend->realRoot() / m_path;
+    int result = open( fullpath.c_str(), O_RDONLY );
+    if( result < 0 )
+        codedExcept(errno)() << "HashFile: Failed to open " << fullpath;
+    RefPtr<FileDescriptor> fd = FileDescriptor::create(result);
+
+    struct stat fileStat;
+    if( fstat( *fd, &fileStat ) < 0 )
+        codedExcept(errno)() << "HashFile: Failed to stat " << fullpath;
+
+    // this job holds a single cpu slot, any others that are idle are
+    // borrowed for the duration of the hash
+    std::string digest = ContentHash::hashFile( *fd, fileStat.st_size,
+                                                m_backend->jobs(), 1 );
+    m_backend->db().setContentHash( m_path, digest, watch.gen() );
+}
+
+} //< jobs
+} //< filesystem
+} //< openbook
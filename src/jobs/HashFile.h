@@ -0,0 +1,83 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/HashFile.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_HASHFILE_H_
+#define OPENBOOK_FS_HASHFILE_H_
+
+#include <boost/filesystem.hpp>
+
+#include "LongJob.h"
+
+namespace   openbook {
+namespace filesystem {
+
+class Backend;
+
+} //< filesystem
+} //< openbook
+
+
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+
+/// computes the content hash of a local file and stores it in the
+/// database, so that a sender which is asked for the last piece of the
+/// file already has it
+class HashFile:
+    public LongJob
+{
+    public:
+        typedef boost::filesystem::path path_t;
+
+    private:
+        Backend*        m_backend;  ///< the backend object
+        path_t          m_path;     ///< path to the file
+
+    public:
+        HashFile(Backend* backend, const std::string& path):
+            m_backend(backend),
+            m_path(path)
+        {}
+
+        virtual ~HashFile(){}
+
+        virtual JobClass jobClass() const { return JOB_CPU; }
+
+        virtual std::string path() const { return m_path.string(); }
+
+        /// hash the file unless the hash is already known
+        virtual void go();
+};
+
+
+} //< jobs
+} //< filesystem
+} //< openbook
+
+
+
+#endif // HASHFILE_H_
@@ -34,55 +34,50 @@ namespace   openbook {
 namespace filesystem {
 namespace       jobs {
 
+/// sends a keepalive ping to a peer, the peer echoes it back in a pong
+/// which is used to measure the round trip time and schedule the next ping
+/**
+ *  Pings are urgent jobs, so a ping which comes due doesn't wait behind
+ *  the file transfers queued for the peer.
+ */
 class Ping:
     public LongJob
 {
     private:
         Backend*    m_backend;  ///< the backend object
-        int         m_peerId;   ///< peer to reply to
+        int         m_peerId;   ///< peer to ping
+        int32_t     m_cookie;   ///< identifies the connection we're pinging
 
     public:
-        Ping(Backend* backend, int peerId):
+        /// time between keepalive pings
+        static const int64_t INTERVAL_MS = 5000;
+
+        Ping(Backend* backend, int peerId, int32_t cookie):
             m_backend(backend),
-            m_peerId(peerId)
+            m_peerId(peerId),
+            m_cookie(cookie)
         {}
 
         virtual ~Ping(){}
 
-        virtual void go()
-        {
-            std::cout << "PingJob: sleeping\n";
-            sleep(2);
-            std::cout << "PingJob: queing PONG\n";
-            messages::Ping* ping = new messages::Ping();
-            ping->set_payload(0xdeadf00d);
-            m_backend->sendMessage(m_peerId,ping);
-        }
-};
+        virtual int peerId() const { return m_peerId; }
 
-class Pong:
-    public LongJob
-{
-    private:
-        Backend*    m_backend;  ///< the backend object
-        int         m_peerId;   ///< peer to reply to
-
-    public:
-        Pong(Backend* backend, int peerId):
-            m_backend(backend),
-            m_peerId(peerId)
-        {}
-
-        virtual ~Pong(){}
+        virtual bool urgent() const { return true; }
 
         virtual void go()
         {
-            std::cout << "PongJob: sleeping\n";
-            sleep(2);
-            std::cout << "PongJob: queing Ping\n";
-            messages::Pong* pong = new messages::Pong();
-            pong->set_payload(0xdeadf00d);
-            m_backend->sendMessage(m_peerId,pong);
+            // if the peer has reconnected since this ping was scheduled
+            // then a newer ping chain is already running
+            int64_t sent = JobWorker::clock();
+            if( !m_backend->pingSent(m_peerId,m_cookie,sent) )
+                return;
+
+            std::cout << "PingJob: queing PING\n";
+            messages::Ping* ping = new messages::Ping();
+            ping->set_payload(m_cookie);
+            ping->set_sent(sent);
+            if( !m_backend->sendMessage(m_peerId,ping,PRIO_NOW) )
+                delete ping;
         }
 };
 
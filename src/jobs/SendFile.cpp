@@ -24,10 +24,15 @@
  *  @brief  
  */
 
+#include <algorithm>
+#include <vector>
 #include <fcntl.h>
 
 #include "SendFile.h"
 #include "Backend.h"
+#include "ContentHash.h"
+#include "FileDescriptor.h"
+#include "HashFile.h"
 #include "messages.h"
 
 
@@ -37,76 +42,223 @@ namespace filesystem {
 namespace       jobs {
 
 
+const int64_t SendFile::CHUNK_SIZE;
+
 void SendFile::go()
 {
     path_t root     = m_backend->realRoot();
     path_t fullpath = root / m_path;
 
-    struct stat fileStat;
-    int result = stat( fullpath.c_str(), &fileStat );
+    // note the change generation before checking the version, if it is
+    // unchanged at each block then so is the version
+    Database::GenerationWatch watch( m_backend->db(), m_path );
+
+    // make sure the version requested is the version we have
+    VersionVector v_curr;
+    m_backend->db().getVersion( m_path, v_curr );
+    if( v_curr != m_version )
+    {
+        ex()() << "SendFile: Local file " << m_path
+                << " is not the requested version";
+    }
+
+    // the file stays open for the whole transfer
+    int result = open( fullpath.c_str(), O_RDONLY );
     if( result < 0 )
-        codedExcept(errno) << "Failed to stat file to send\n";
+        codedExcept(errno)() << "SendFile: Failed to open " << fullpath;
+    RefPtr<FileDescriptor> fd = FileDescriptor::create(result);
+
+    struct stat fileStat;
+    if( fstat( *fd, &fileStat ) < 0 )
+        codedExcept(errno)() << "Failed to stat file to send\n";
 
     int64_t size = fileStat.st_size;
 
+    // the receiver may be resuming an interrupted transfer, but the
+    // requested offset can't be past the end of the file
+    if( m_off < 0 || m_off > size )
+        m_off = 0;
+
+    // if only a piece of the file was requested then stop at the end of
+    // the piece
+    int64_t end = size;
+    if( m_len >= 0 )
+        end = std::min( size, m_off + m_len );
+
     std::stringstream report;
-    report << "SendFile: (" << m_path << ") starting up\n";
+    report << "SendFile: (" << m_path << ") starting up";
+    if( m_off > 0 )
+        report << ", resuming at byte " << m_off << " of " << size;
+    report << "\n";
     std::cout << report.str();
 
-    while( m_off < size )
+    // the receiver verifies the file against it's content hash, which is
+    // sent with the last chunk. If we don't already know it then we
+    // compute it as we go.
+    std::string digest = m_backend->db().getContentHash( m_path );
+    ContentHash hash;
+    if( digest.empty() && m_len >= 0 )
     {
-        // get the version of the file
-        VersionVector v_curr;
-        m_backend->db().getVersion( m_path, v_curr );
+        // a piece isn't streamed front to back so the hash has to be
+        // computed separately. The first piece starts that in the
+        // background so that it's usually known by the time the last piece
+        // is asked for, otherwise the last piece sends it after the data.
+        if( m_off == 0 && end < size )
+            m_backend->jobs()->enqueue( new HashFile( m_backend,
+                                                      m_path.string() ) );
+    }
+    else if( digest.empty() && m_off > 0 )
+    {
+        // if resuming then the leaves before the offset aren't streamed
+        // so hash them on whatever cpu slots are idle (this is an io job
+        // so it has none of it's own), and pick up the partial leaf that
+        // ends at the offset
+        int64_t leafStart = m_off - m_off % ContentHash::LEAF_SIZE;
+        hash.hashLeaves( *fd, leafStart, m_backend->jobs(), 0 );
+        hash.reset( leafStart );
 
-        // if the version has changed then abort the send
-        if( v_curr != m_version )
+        std::vector<char> partial( m_off - leafStart );
+        for( int64_t got = 0; got < (int64_t)partial.size(); )
+        {
+            int result = pread( *fd, &partial[got], partial.size() - got,
+                                leafStart + got );
+            if( result <= 0 )
+                codedExcept(errno)() << "SendFile: Failed to read from "
+                                     << fullpath;
+            got += result;
+        }
+        if( !partial.empty() )
+            hash.update( &partial[0], partial.size() );
+    }
+
+    // we read the file front to back so let the kernel know, and start
+    // reading the first block
+    const int64_t blockSize = m_backend->xferBlockSize();
+    std::vector<char> buf( blockSize );
+    posix_fadvise( *fd, m_off, 0, POSIX_FADV_SEQUENTIAL );
+    readahead( *fd, m_off, blockSize );
+
+    // an empty file (or a transfer resumed at the very end) still gets
+    // one (empty) chunk to carry the hash
+    while( true )
+    {
+        // if the transfer has been superseded or the peer has gone away
+        // then don't waste any more bandwidth on it
+        if( isCancelled() )
+        {
+            report.str("");
+            report << "SendFile: (" << m_path << ") tx " << m_tx
+                   << " cancelled at byte " << m_off << "\n";
+            std::cout << report.str();
+            return;
+        }
+
+        // read in a block
+        int64_t toRead    = std::min( blockSize, end - m_off );
+        int64_t bytesRead = 0;
+        while( bytesRead < toRead )
+        {
+            int result = pread( *fd, &buf[bytesRead], toRead - bytesRead,
+                                m_off + bytesRead );
+            if( result < 0 )
+                codedExcept(errno)() << "SendFile: Failed to read from "
+                                     << fullpath;
+            if( result == 0 )
+                break;
+            bytesRead += result;
+        }
+
+        // the file shrank underneath us, which means it was changed
+        if( bytesRead < toRead )
+            size = end = m_off + bytesRead;
+
+        // if the file has changed then abort the send, checked after the
+        // read so that the block we're about to send is consistent
+        if( watch.changed() )
         {
             ex()() << "SendFile: Local file " << m_path
                     << " changed during xfer";
         }
 
-        // otherwise read in some bytes
-        const int nBytes = 1024;
-        char buf[nBytes];
-        int fd = open(fullpath.c_str(), O_RDONLY );
-        if( fd < 0 )
-            codedExcept(errno) << "SendFile: Failed to open " << fullpath;
+        // start reading the next block while this one is being sent
+        readahead( *fd, m_off + bytesRead, blockSize );
 
-        // move the read head
-        if( m_off != lseek(fd,m_off,SEEK_SET) )
+        // if this is the last block then finish the hash
+        bool last = ( m_off + bytesRead >= end );
+        if( digest.empty() && m_len < 0 )
         {
-            close(fd);
-            codedExcept(errno) << "SendFile: Failed to seek to offset "
-                               << m_off
-                               << " of file " << fullpath;
+            hash.update( &buf[0], bytesRead );
+            if( last )
+            {
+                digest = hash.digest( size );
+                m_backend->db().setContentHash( m_path, digest, watch.gen() );
+            }
         }
 
-        // read the data
-        int bytesRead = read(fd,buf,nBytes);
-        if( bytesRead < 0 )
+        // send the block in chunks that fit in a message
+        int64_t chunkOff = 0;
+        do
         {
-            close(fd);
-            codedExcept(errno) << "SendFile: Failed to read from " << fullpath;
-        }
+            int64_t chunkSize = std::min( bytesRead - chunkOff, CHUNK_SIZE );
+
+            // build the message
+            messages::FileChunk* fileChunk = new messages::FileChunk();
+            fileChunk->set_path(m_path.string());
+            fileChunk->set_tx(m_tx);
+            fileChunk->set_offset(m_off + chunkOff);
+            fileChunk->set_data(&buf[chunkOff],chunkSize);
+            if( m_piece >= 0 )
+                fileChunk->set_piece(m_piece);
+
+            chunkOff += chunkSize;
 
-        // close the file
-        close(fd);
+            // the last chunk of the file carries the hash
+            if( last && end >= size && chunkOff >= bytesRead
+                    && !digest.empty() )
+                fileChunk->set_hash(digest);
 
-        // build the message
-        messages::FileChunk* fileChunk = new messages::FileChunk();
-        fileChunk->set_path(m_path.string());
-        fileChunk->set_tx(m_tx);
-        fileChunk->set_offset(m_off);
-        fileChunk->set_data(buf,bytesRead);
+            // send the message, if disconnected then quit
+            if( !m_backend->sendMessage(m_peerId,fileChunk,PRIO_XFER) )
+            {
+                delete fileChunk;
+                return;
+            }
+        } while( chunkOff < bytesRead );
 
         // increment the offset
         m_off += bytesRead;
 
-        // send the message, if disconnected then quit
-        if( !m_backend->sendMessage(m_peerId,fileChunk,PRIO_XFER) )
+        if( last )
             break;
     }
+
+    // the last piece of a file whose hash wasn't known when it started
+    // follows the data with an empty chunk carrying the hash
+    if( end < size || !digest.empty() || isCancelled() )
+        return;
+
+    digest = m_backend->db().getContentHash( m_path );
+    if( digest.empty() )
+    {
+        digest = ContentHash::hashFile( *fd, size, m_backend->jobs(), 0 );
+        if( watch.changed() )
+        {
+            ex()() << "SendFile: Local file " << m_path
+                    << " changed during xfer";
+        }
+        m_backend->db().setContentHash( m_path, digest, watch.gen() );
+    }
+
+    messages::FileChunk* fileChunk = new messages::FileChunk();
+    fileChunk->set_path(m_path.string());
+    fileChunk->set_tx(m_tx);
+    fileChunk->set_offset(end);
+    fileChunk->set_data(std::string());
+    fileChunk->set_hash(digest);
+    if( m_piece >= 0 )
+        fileChunk->set_piece(m_piece);
+    if( !m_backend->sendMessage(m_peerId,fileChunk,PRIO_XFER) )
+        delete fileChunk;
 }
 
 } //< jobs
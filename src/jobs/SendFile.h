@@ -61,24 +61,42 @@ class SendFile:
         path_t          m_path;     ///< path to the file
         int64_t         m_tx;
         int64_t         m_off;
+        int64_t         m_len;      ///< bytes to send, -1 for all
+        int64_t         m_piece;    ///< piece id to echo, -1 for none
         VersionVector   m_version;
 
     public:
+        /// maximum number of bytes in one FileChunk message, a message
+        /// must fit in a single frame on the wire
+        static const int64_t CHUNK_SIZE = 1024;
+
         SendFile(Backend* backend, int peerId,
                     const std::string& path,
                     int64_t tx,
                     int64_t off,
-                    const VersionVector& v):
+                    const VersionVector& v,
+                    int64_t len=-1,
+                    int64_t piece=-1):
             m_backend(backend),
             m_peerId(peerId),
             m_path(path),
             m_tx(tx),
             m_off(off),
+            m_len(len),
+            m_piece(piece),
             m_version(v)
         {}
 
         virtual ~SendFile(){}
 
+        virtual int peerId() const { return m_peerId; }
+
+        virtual std::string path() const { return m_path.string(); }
+
+        virtual int64_t tx() const { return m_tx; }
+
+        virtual int64_t piece() const { return m_piece; }
+
         /// navigates the entire file system and sends version information
         /// to the connected peer
         virtual void go();
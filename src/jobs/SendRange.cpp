@@ -0,0 +1,130 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/SendRange.cpp
+ *
+ *  @brief  
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "SendRange.h"
+#include "SendFile.h"
+#include "Backend.h"
+#include "FileDescriptor.h"
+#include "LazyFetcher.h"
+
+
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+
+void SendRange::go()
+{
+    path_t fullpath = m_backend->realRoot() / m_path;
+    try
+    {
+        if( !m_backend->db().isSubscribed(m_path) )
+            ex()() << "Not subscribed to " << m_path;
+
+        int result = open( fullpath.c_str(), O_RDONLY );
+        if( result < 0 )
+            codedExcept(errno)() << "Failed to open " << fullpath;
+        RefPtr<FileDescriptor> fd = FileDescriptor::create(result);
+
+        struct stat fileStat;
+        if( fstat( *fd, &fileStat ) < 0 )
+            codedExcept(errno)() << "Failed to stat " << fullpath;
+
+        int64_t length = std::min( m_len, LazyFetcher::BLOCK_SIZE );
+        int64_t begin  = std::max( m_off, (int64_t)0 );
+        int64_t end    = std::min( begin + length,
+                                   (int64_t)fileStat.st_size );
+
+        std::vector<char> buf( SendFile::CHUNK_SIZE );
+        int64_t off = begin;
+        while( off < end )
+        {
+            if( isCancelled() )
+                return;
+
+            int64_t chunkSize = std::min( end - off, SendFile::CHUNK_SIZE );
+            int bytesRead = pread( *fd, &buf[0], chunkSize, off );
+            if( bytesRead < 0 )
+                codedExcept(errno)() << "Failed to read " << fullpath;
+            if( bytesRead == 0 )
+                break;
+
+            messages::FileChunk* chunk = new messages::FileChunk();
+            chunk->set_path( m_path.string() );
+            chunk->set_offset( off );
+            chunk->set_data( &buf[0], bytesRead );
+            chunk->set_request( m_request );
+
+            // if the peer is gone then there's no one to send the rest to
+            if( !m_backend->sendMessage( m_peerId, chunk, PRIO_SYNC ) )
+            {
+                delete chunk;
+                return;
+            }
+
+            off += bytesRead;
+        }
+
+        // if our copy is shorter than the peer thinks then an empty chunk
+        // tells it where our copy ends
+        if( off < begin + length )
+        {
+            messages::FileChunk* chunk = new messages::FileChunk();
+            chunk->set_path( m_path.string() );
+            chunk->set_offset( off );
+            chunk->set_data( std::string() );
+            chunk->set_request( m_request );
+            if( !m_backend->sendMessage( m_peerId, chunk, PRIO_SYNC ) )
+                delete chunk;
+        }
+    }
+    catch( const std::exception& ex )
+    {
+        std::cerr << "SendRange: failed to serve " << m_path << ": "
+                  << ex.what() << "\n";
+
+        // the peer is blocked on this request so it has to be told, it
+        // then reads from somewhere else
+        messages::FileChunk* chunk = new messages::FileChunk();
+        chunk->set_path( m_path.string() );
+        chunk->set_offset( m_off );
+        chunk->set_data( std::string() );
+        chunk->set_request( m_request );
+        chunk->set_error( true );
+        if( !m_backend->sendMessage( m_peerId, chunk, PRIO_SYNC ) )
+            delete chunk;
+    }
+}
+
+
+} //< jobs
+} //< filesystem
+} //< openbook
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/SendRange.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_SENDRANGE_H_
+#define OPENBOOK_FS_SENDRANGE_H_
+
+#include <boost/filesystem.hpp>
+
+#include "LongJob.h"
+
+namespace   openbook {
+namespace filesystem {
+
+class Backend;
+
+} //< filesystem
+} //< openbook
+
+
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+
+/// answers a RequestFile, sending one block of a file to a peer which is
+/// reading it right now
+/**
+ *  The peer is blocked on the request so the job is urgent, it doesn't
+ *  wait behind the transfers queued for the peer.
+ */
+class SendRange:
+    public LongJob
+{
+    public:
+        typedef boost::filesystem::path path_t;
+
+    private:
+        Backend*        m_backend;  ///< the backend object
+        int             m_peerId;   ///< the peer to send to
+        path_t          m_path;     ///< path of the file
+        int64_t         m_off;      ///< first byte requested
+        int64_t         m_len;      ///< number of bytes requested
+        int64_t         m_request;  ///< request id to echo
+
+    public:
+        SendRange(Backend* backend, int peerId, const std::string& path,
+                    int64_t offset, int64_t length, int64_t request):
+            m_backend(backend),
+            m_peerId(peerId),
+            m_path(path),
+            m_off(offset),
+            m_len(length),
+            m_request(request)
+        {}
+
+        virtual ~SendRange(){}
+
+        virtual int peerId() const { return m_peerId; }
+
+        virtual std::string path() const { return m_path.string(); }
+
+        virtual bool urgent() const { return true; }
+
+        /// read the range and send it in chunks, if the file can't be
+        /// served then the peer is told so it can read from somewhere else
+        virtual void go();
+};
+
+
+} //< jobs
+} //< filesystem
+} //< openbook
+
+
+
+#endif // SENDRANGE_H_
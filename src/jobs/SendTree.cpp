@@ -28,6 +28,7 @@
 #include <boost/filesystem.hpp>
 #include "Backend.h"
 #include "SendTree.h"
+#include "TreeWalker.h"
 #include "ExceptionStream.h"
 #include "VersionVector.h"
 
@@ -36,6 +37,8 @@ namespace filesystem {
 namespace       jobs {
 
 
+const int SendTree::BATCH_BYTES;
+
 //static boost::filesystem::path make_relative(
 //        const boost::filesystem::path& base,
 //        const boost::filesystem::path& query )
@@ -84,60 +87,62 @@ void SendTree::go()
 
     fs::path root = m_backend->realRoot();
 
-    std::list<fs::path> queue;
-    queue.push_back(fs::path("/"));
+    // the walker stats entries of upcoming directories in parallel and
+    // hands them to us in breadth first order
+    TreeWalker walker( root, m_backend->db(), fs::path("/"),
+                       WALK_THREADS, WALK_WINDOW );
+    TreeWalker::Dir walkDir;
 
-    std::list<fs::path> files;
+    // node infos are sent in batches rather than one message per file
+    msg::NodeInfoBatch* batch = new msg::NodeInfoBatch();
 
-    while(queue.size() > 0)
+    while( walker.next(walkDir) )
     {
-        files.clear();
+        // stop if the peer has disconnected
+        if( isCancelled() )
+        {
+            std::cout << "SendTree: cancelled\n";
+            delete batch;
+            return;
+        }
 
-        // get the next directory from the queue
-        fs::path dir = queue.front();
-        queue.pop_front();
+        const fs::path& dir = walkDir.path;
 
         // create a chunk unless we didn't use it at the last round
         // pointer to message to send
         msg::DirChunk* chunk = new msg::DirChunk();
         chunk->set_path(dir.string());
 
-        // get the contents
-        std::list<std::string> listing;
-        m_backend->db().readdir( dir, listing );
-
-        // if the directory has children then recurse on any subidrs
+        // subdirectories have already been queued by the walker
         std::cout << "SendTree::go() : built directory message: "
                   << "\n directory : " << dir
                   << "\n contents  : \n";
 
-        for( auto& child : listing )
+        for( auto& child : walkDir.children )
         {
-            std::cout << "   " << child << "\n";
-            if( fs::is_directory(root/dir/child) )
-                queue.push_back(dir/child);
-
+            std::cout << "   " << child.name << "\n";
             msg::DirEntry* entry = chunk->add_entries();
-            entry->set_path(child);
+            entry->set_path(child.name);
         }
 
         if( !m_backend->sendMessage(m_peerId,chunk,PRIO_SYNC) )
             break;
 
-        listing.clear();
-        m_backend->db().readdir( dir, listing, true );
-
-        for( auto& child : listing )
+        for( auto& walkChild : walkDir.children )
         {
+            if( !walkChild.subscribed )
+                continue;
+
+            const std::string& child = walkChild.name;
             fs::path fullpath = root/dir/child;
 
-            struct stat statBuf;
-            if( stat( fullpath.c_str(), &statBuf ) )
+            const struct stat& statBuf = walkChild.stat;
+            if( walkChild.error )
             {
                 std::stringstream report;
                 report << "SendTree: failed to stat "
-                        << fullpath << " errno: " << errno
-                        << ", " << strerror(errno) << "\n";
+                        << fullpath << " errno: " << walkChild.error
+                        << ", " << strerror(walkChild.error) << "\n";
                 std::cout << report.str();
                 continue;
             }
@@ -163,31 +168,55 @@ void SendTree::go()
                     break;
             }
 
-            msg::NodeInfo* nodeInfo = new msg::NodeInfo();
-            nodeInfo->set_parent(dir.string());
-            nodeInfo->set_path(child);
-            nodeInfo->set_mode(mode);
-            nodeInfo->set_size(statBuf.st_size);
-            nodeInfo->set_ctime(statBuf.st_ctim.tv_sec);
-            nodeInfo->set_mtime(statBuf.st_mtim.tv_sec);
-            nodeInfo->set_type( ntype );
+            msg::NodeInfo info;
+            info.set_parent(dir.string());
+            info.set_path(child);
+            info.set_mode(mode);
+            info.set_size(statBuf.st_size);
+            info.set_ctime(statBuf.st_ctim.tv_sec);
+            info.set_mtime(statBuf.st_mtim.tv_sec);
+            info.set_type( ntype );
 
             VersionVector version;
             m_backend->db().getVersion(dir/child,version);
 
             for( auto& pair : version )
             {
-                msg::VersionEntry* entry = nodeInfo->add_version();
+                msg::VersionEntry* entry = info.add_version();
                 entry->set_client( pair.first );
                 entry->set_version( pair.second );
             }
 
-            // send the message
-            if( !m_backend->sendMessage(m_peerId,nodeInfo,PRIO_SYNC) )
-                break;
+            // if we know the content hash then the peer can use it to
+            // resolve concurrent versions with identical contents
+            std::string hash = m_backend->db().getContentHash(dir/child);
+            if( !hash.empty() )
+                info.set_hash( hash );
+
+            // if this entry doesn't fit in the current batch then send
+            // the batch and start a new one
+            if( batch->node_size() > 0
+                && batch->ByteSize() + info.ByteSize() + 4 > BATCH_BYTES )
+            {
+                // the backend only takes ownership if the peer is still
+                // connected
+                if( !m_backend->sendMessage(m_peerId,batch,PRIO_SYNC) )
+                {
+                    delete batch;
+                    return;
+                }
+                batch = new msg::NodeInfoBatch();
+            }
+
+            batch->add_node()->Swap(&info);
         }
 
     }
+
+    // send whatever is left over
+    if( batch->node_size() < 1
+        || !m_backend->sendMessage(m_peerId,batch,PRIO_SYNC) )
+        delete batch;
 }
 
 
@@ -55,6 +55,18 @@ class SendTree:
         int         m_peerId;   ///< the peer to send to
 
     public:
+        /// maximum serialized size of a NodeInfoBatch, a message must fit
+        /// in a single frame on the wire (along with it's type byte and
+        /// the cipher's tag)
+        static const int BATCH_BYTES = 1800;
+
+        /// number of threads used to stat files while walking the tree
+        static const int WALK_THREADS = 8;
+
+        /// number of directories that are listed and stat'ed ahead of the
+        /// one being sent
+        static const int WALK_WINDOW  = 64;
+
         SendTree(Backend* backend, int peerId ):
             m_backend(backend),
             m_peerId(peerId)
@@ -62,6 +74,8 @@ class SendTree:
 
         virtual ~SendTree(){}
 
+        virtual int peerId() const { return m_peerId; }
+
         /// navigates the entire file system and sends version information
         /// to the connected peer
         virtual void go();
@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/VerifyDownload.cpp
+ *
+ *  @brief  
+ */
+
+#include <fcntl.h>
+
+#include "VerifyDownload.h"
+#include "Backend.h"
+#include "ContentHash.h"
+#include "FileDescriptor.h"
+
+
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+
+void VerifyDownload::go()
+{
+    path_t      stagePath;
+    int64_t     size;
+    std::string expected;
+
+    // if the download was pre-empted in the mean time then there's
+    // nothing to do
+    if( !m_backend->db().getStagedDownload( m_peerId, m_path, m_tx,
+                                            m_backend->stageDir(),
+                                            stagePath, size, expected ) )
+        return;
+
+    // a peer that doesn't send a hash can't be verified
+    bool verified = true;
+    std::string actual;
+    if( !expected.empty() )
+    {
+        int result = open( stagePath.c_str(), O_RDONLY );
+        if( result < 0 )
+            codedExcept(errno)() << "VerifyDownload: Failed to open "
+                                 << stagePath;
+        RefPtr<FileDescriptor> fd = FileDescriptor::create(result);
+
+        // this job holds a single cpu slot, any others that are idle are
+        // borrowed for the duration of the hash
+        actual   = ContentHash::hashFile( *fd, size, m_backend->jobs(), 1 );
+        verified = ( actual == expected );
+
+        std::stringstream report;
+        report << "VerifyDownload: (" << m_path << ") "
+               << ContentHash::toHex(actual)
+               << ( verified ? " ok" : " MISMATCH" ) << "\n";
+        std::cout << report.str();
+    }
+
+    m_backend->db().finishDownload( m_peerId, m_path, m_tx,
+                                    m_backend->stageDir(),
+                                    m_backend->realRoot(),
+                                    actual, verified );
+
+    // the file may have been replaced underneath the mounts
+    m_backend->attrCache().notify( m_path );
+}
+
+} //< jobs
+} //< filesystem
+} //< openbook
@@ -0,0 +1,92 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   src/jobs/VerifyDownload.h
+ *
+ *  @brief  
+ */
+
+#ifndef OPENBOOK_FS_VERIFYDOWNLOAD_H_
+#define OPENBOOK_FS_VERIFYDOWNLOAD_H_
+
+#include <boost/filesystem.hpp>
+
+#include "LongJob.h"
+
+namespace   openbook {
+namespace filesystem {
+
+class Backend;
+
+} //< filesystem
+} //< openbook
+
+
+
+namespace   openbook {
+namespace filesystem {
+namespace       jobs {
+
+
+/// hashes a completed download and compares it to the hash that the
+/// sender reported before moving it into the tree
+class VerifyDownload:
+    public LongJob
+{
+    public:
+        typedef boost::filesystem::path path_t;
+
+    private:
+        Backend*        m_backend;  ///< the backend object
+        int             m_peerId;   ///< the peer the file came from
+        path_t          m_path;     ///< path to the file
+        int64_t         m_tx;       ///< transaction of the download
+
+    public:
+        VerifyDownload(Backend* backend, int peerId,
+                        const std::string& path,
+                        int64_t tx):
+            m_backend(backend),
+            m_peerId(peerId),
+            m_path(path),
+            m_tx(tx)
+        {}
+
+        virtual ~VerifyDownload(){}
+
+        virtual int peerId() const { return m_peerId; }
+
+        virtual JobClass jobClass() const { return JOB_CPU; }
+
+        virtual std::string path() const { return m_path.string(); }
+
+        virtual int64_t tx() const { return m_tx; }
+
+        /// hash the staging file and finish the download
+        virtual void go();
+};
+
+
+} //< jobs
+} //< filesystem
+} //< openbook
+
+
+
+#endif // VERIFYDOWNLOAD_H_
@@ -51,6 +51,7 @@ enum MessageId
     MSG_GET_BACKEND_INFO,
     MSG_PEER_LIST,
     MSG_MOUNT_LIST,
+    MSG_FUSE_STAT_LIST,
     MSG_START_SYNC,
     MSG_LEADER_ELECT,
     MSG_DH_PARAMS,
@@ -64,6 +65,7 @@ enum MessageId
     MSG_UNSUBSCRIBE,
     MSG_ID_MAP,
     MSG_NODE_INFO,
+    MSG_NODE_INFO_BATCH,
     MSG_SEND_TREE,
     MSG_SEND_FILE,
     MSG_NEW_VERSION,
@@ -65,6 +65,7 @@ MAP_MSG_TYPE(          UI_REPLY, UserInterfaceReply)
 MAP_MSG_TYPE(  GET_BACKEND_INFO, GetBackendInfo)
 MAP_MSG_TYPE(         PEER_LIST, PeerList)
 MAP_MSG_TYPE(        MOUNT_LIST, MountList)
+MAP_MSG_TYPE(    FUSE_STAT_LIST, FuseStatList)
 MAP_MSG_TYPE(        START_SYNC, StartSync)
 MAP_MSG_TYPE(      LEADER_ELECT, LeaderElect)
 MAP_MSG_TYPE(         DH_PARAMS, DiffieHellmanParams)
@@ -78,6 +79,7 @@ MAP_MSG_TYPE(         SUBSCRIBE, Subscribe)
 MAP_MSG_TYPE(       UNSUBSCRIBE, Unsubscribe)
 MAP_MSG_TYPE(            ID_MAP, IdMap)
 MAP_MSG_TYPE(         NODE_INFO, NodeInfo)
+MAP_MSG_TYPE(   NODE_INFO_BATCH, NodeInfoBatch)
 MAP_MSG_TYPE(         SEND_TREE, SendTree)
 MAP_MSG_TYPE(         SEND_FILE, SendFile)
 MAP_MSG_TYPE(       NEW_VERSION, NewVersion)
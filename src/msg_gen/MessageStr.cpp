@@ -52,6 +52,7 @@ const char* g_msgIdStr[] =
     "GET_BACKEND_INFO",
     "PEER_LIST",
     "MOUNT_LIST",
+    "FUSE_STAT_LIST",
     "START_SYNC",
     "LEADER_ELECT",
     "DH_PARAMS",
@@ -65,6 +66,7 @@ const char* g_msgIdStr[] =
     "UNSUBSCRIBE",
     "ID_MAP",
     "NODE_INFO",
+    "NODE_INFO_BATCH",
     "SEND_TREE",
     "SEND_FILE",
     "NEW_VERSION",
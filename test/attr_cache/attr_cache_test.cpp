@@ -0,0 +1,93 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   test/attr_cache/attr_cache_test.cpp
+ *
+ *  @brief  checks that notifications from peers drop the entries that
+ *          getattr stored
+ */
+
+#include <cstring>
+#include <iostream>
+
+#include "AttrCache.h"
+
+using namespace openbook::filesystem;
+
+static int failures = 0;
+
+static void check( bool ok, const char* what )
+{
+    std::cout << ( ok ? "   ok: " : "FAIL: " ) << what << "\n";
+    if( !ok )
+        failures++;
+}
+
+static bool cached( AttrCache& cache, const char* path )
+{
+    struct stat attr;
+    int error = 0;
+    return cache.get( path, attr, error );
+}
+
+int main()
+{
+    struct stat attr;
+    memset( &attr, 0, sizeof(attr) );
+
+    // the paths that getattr stores and that peers notify are the same
+    {
+        AttrCache cache;
+        cache.put( "/a", attr );
+        check( cached(cache,"/a"), "getattr entry is cached" );
+        cache.notify( "/a" );
+        check( !cached(cache,"/a"), "notify on /a drops /a" );
+    }
+
+    // a path built by appending a fuse path to a root of "/" names the
+    // same file
+    {
+        AttrCache cache;
+        cache.put( "//a", attr );
+        check( cached(cache,"/a"), "//a is found as /a" );
+        cache.notify( "/a" );
+        check( !cached(cache,"//a"), "notify on /a drops //a" );
+    }
+
+    // negative entries are dropped too
+    {
+        AttrCache cache;
+        cache.putError( "/a", ENOENT );
+        cache.notify( "/a/" );
+        check( !cached(cache,"/a"), "notify on /a/ drops a cached error" );
+    }
+
+    // a directory's notification drops everything beneath it, but not
+    // it's siblings
+    {
+        AttrCache cache;
+        cache.put( "/d/f", attr );
+        cache.put( "/dx", attr );
+        cache.notify( "/d", false );
+        check( !cached(cache,"/d/f"), "notify on /d drops /d/f" );
+        check( cached(cache,"/dx"), "notify on /d keeps /dx" );
+    }
+
+    return failures ? 1 : 0;
+}
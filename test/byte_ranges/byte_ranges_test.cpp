@@ -0,0 +1,86 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   test/byte_ranges/byte_ranges_test.cpp
+ *
+ *  @brief  checks when a download is considered complete
+ */
+
+#include <iostream>
+
+#include "ByteRanges.h"
+
+using namespace openbook::filesystem;
+
+static int failures = 0;
+
+static void check( bool ok, const char* what )
+{
+    std::cout << ( ok ? "   ok: " : "FAIL: " ) << what << "\n";
+    if( !ok )
+        failures++;
+}
+
+int main()
+{
+    // an empty file is finished by the single empty chunk with the hash
+    {
+        RangeMap_t ranges;
+        int64_t    prefix = 0;
+        check( mergeChunk( ranges, prefix, 0, 0, 0 ),
+                "empty file completes on an empty chunk" );
+        check( prefix == 0, "empty file prefix stays at zero" );
+    }
+
+    // a download resumed with every byte on disk is finished by an empty
+    // chunk at the end of the file
+    {
+        RangeMap_t ranges;
+        int64_t    prefix = 100;
+        check( mergeChunk( ranges, prefix, 100, 100, 100 ),
+                "resume at the end completes on an empty chunk" );
+        check( prefix == 100, "resume at the end keeps the prefix" );
+    }
+
+    // in order chunks complete on the last one
+    {
+        RangeMap_t ranges;
+        int64_t    prefix = 0;
+        check( !mergeChunk( ranges, prefix, 100, 0, 50 ),
+                "first half is not complete" );
+        check( mergeChunk( ranges, prefix, 100, 50, 100 ),
+                "second half completes" );
+    }
+
+    // out of order chunks complete once the gap is filled
+    {
+        RangeMap_t ranges;
+        int64_t    prefix = 0;
+        check( !mergeChunk( ranges, prefix, 100, 50, 100 ),
+                "chunk past a gap is not complete" );
+        check( prefix == 0, "chunk past a gap doesn't move the prefix" );
+        check( !mergeChunk( ranges, prefix, 100, 100, 100 ),
+                "empty chunk past a gap is not complete" );
+        check( mergeChunk( ranges, prefix, 100, 0, 50 ),
+                "filling the gap completes" );
+        check( ranges.empty(), "filled gap leaves no ranges" );
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   test/fuse_stress/fuse_stress_bench.cpp
+ *
+ *  @brief  runs many clients against a mounted filesystem at once and
+ *          reports throughput and latency for each operation
+ *
+ *  usage: fuse_stress_bench <dir> [max clients] [seconds] [file size]
+ *
+ *  Each client repeatedly creates, writes, stats, reads, lists and unlinks
+ *  it's own files in <dir>. The run is repeated for 1, 2, 4, ... clients up
+ *  to max clients so that the scaling of the mount can be compared with
+ *  the number of fuse threads it is configured with.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum Op
+{
+    OP_CREATE,
+    OP_WRITE,
+    OP_STAT,
+    OP_READ,
+    OP_READDIR,
+    OP_UNLINK,
+    NUM_OPS
+};
+
+static const char* opNames[NUM_OPS] =
+    { "create", "write", "stat", "read", "readdir", "unlink" };
+
+static double now()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/// state for one client thread
+struct Client
+{
+    std::string         dir;
+    int                 id;
+    size_t              fileSize;
+    double              deadline;
+    int                 errors;
+    std::vector<double> latency[NUM_OPS];   ///< seconds
+};
+
+static void* runClient( void* vp_client )
+{
+    Client* client = static_cast<Client*>(vp_client);
+    std::vector<char> buf( 4096, 'a' + client->id % 26 );
+
+    for( int i=0; now() < client->deadline; i++ )
+    {
+        char name[64];
+        snprintf( name, sizeof(name), "/stress_%d_%d", client->id, i );
+        std::string path = client->dir + name;
+
+        double start = now();
+        int fd = ::open( path.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644 );
+        if( fd < 0 )
+        {
+            client->errors++;
+            continue;
+        }
+        client->latency[OP_CREATE].push_back( now() - start );
+
+        start = now();
+        for( size_t off=0; off < client->fileSize; off += buf.size() )
+        {
+            size_t len = std::min( buf.size(), client->fileSize - off );
+            if( ::pwrite( fd, &buf[0], len, off ) != (ssize_t)len )
+                client->errors++;
+        }
+        ::close(fd);
+        client->latency[OP_WRITE].push_back( now() - start );
+
+        start = now();
+        struct stat st;
+        if( ::stat( path.c_str(), &st ) < 0 )
+            client->errors++;
+        client->latency[OP_STAT].push_back( now() - start );
+
+        start = now();
+        fd = ::open( path.c_str(), O_RDONLY );
+        if( fd < 0 )
+            client->errors++;
+        else
+        {
+            for( size_t off=0; off < client->fileSize; off += buf.size() )
+                if( ::pread( fd, &buf[0], buf.size(), off ) < 0 )
+                    client->errors++;
+            ::close(fd);
+        }
+        client->latency[OP_READ].push_back( now() - start );
+
+        start = now();
+        DIR* dir = ::opendir( client->dir.c_str() );
+        if( !dir )
+            client->errors++;
+        else
+        {
+            while( ::readdir(dir) ) {}
+            ::closedir(dir);
+        }
+        client->latency[OP_READDIR].push_back( now() - start );
+
+        start = now();
+        if( ::unlink( path.c_str() ) < 0 )
+            client->errors++;
+        client->latency[OP_UNLINK].push_back( now() - start );
+    }
+
+    return client;
+}
+
+/// returns the number of errors
+static int bench( const std::string& dir, int nClients, double seconds,
+                    size_t fileSize )
+{
+    std::vector<Client>    clients(nClients);
+    std::vector<pthread_t> threads(nClients);
+
+    double deadline = now() + seconds;
+    for( int i=0; i < nClients; i++ )
+    {
+        clients[i].dir      = dir;
+        clients[i].id       = i;
+        clients[i].fileSize = fileSize;
+        clients[i].deadline = deadline;
+        clients[i].errors   = 0;
+        pthread_create( &threads[i], 0, runClient, &clients[i] );
+    }
+
+    int errors = 0;
+    for( int i=0; i < nClients; i++ )
+    {
+        pthread_join( threads[i], 0 );
+        errors += clients[i].errors;
+    }
+
+    for( int op=0; op < NUM_OPS; op++ )
+    {
+        std::vector<double> all;
+        for( auto& client : clients )
+            all.insert( all.end(), client.latency[op].begin(),
+                                    client.latency[op].end() );
+        if( all.empty() )
+            continue;
+
+        std::sort( all.begin(), all.end() );
+        double sum = 0;
+        for( double t : all )
+            sum += t;
+
+        std::cout << nClients << "\t" << opNames[op]
+                  << "\t" << all.size() / seconds
+                  << "\t\t" << 1e6 * sum / all.size()
+                  << "\t\t" << 1e6 * all[ all.size() * 99 / 100 ]
+                  << "\n";
+    }
+
+    return errors;
+}
+
+int main( int argc, char** argv )
+{
+    if( argc < 2 )
+    {
+        std::cerr << "usage: " << argv[0]
+                  << " <dir> [max clients] [seconds] [file size]\n";
+        return 1;
+    }
+
+    std::string dir      = argv[1];
+    int         nClients = 16;
+    double      seconds  = 5;
+    size_t      fileSize = 64*1024;
+
+    if( argc > 2 )
+        nClients = atoi(argv[2]);
+    if( argc > 3 )
+        seconds = atof(argv[3]);
+    if( argc > 4 )
+        fileSize = atol(argv[4]);
+
+    int errors = 0;
+    std::cout << "clients\top\tops/s\t\tmean (us)\tp99 (us)\n";
+    for( int n=1; n <= nClients; n *= 2 )
+        errors += bench( dir, n, seconds, fileSize );
+
+    if( errors )
+    {
+        std::cerr << errors << " operations failed\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ *  Copyright (C) 2012 Josh Bialkowski (jbialk@mit.edu)
+ *
+ *  This file is part of openbook.
+ *
+ *  openbook is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  openbook is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with openbook.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ *  @file   test/version_vector/version_vector_bench.cpp
+ *
+ *  @brief  compares the flat VersionVector against the std::map based
+ *          implementation that it replaced
+ */
+
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "VersionVector.h"
+
+using openbook::filesystem::VersionVector;
+
+/// the previous implementation, a std::map with comparisons done over
+/// the union of keys
+struct MapVersionVector:
+    public std::map<int64_t,int64_t>
+{
+    int64_t get( int64_t key ) const
+    {
+        auto it = find(key);
+        return it == end() ? 0 : it->second;
+    }
+
+    bool operator<( const MapVersionVector& other ) const
+    {
+        std::set<int64_t> keys;
+        for( auto& pair : *this )
+            keys.insert( pair.first );
+        for( auto& pair : other )
+            keys.insert( pair.first );
+
+        bool atLeastOneLess = false;
+        for( auto& key : keys )
+        {
+            int64_t v1 = get(key);
+            int64_t v2 = other.get(key);
+            if( v1 > v2 )
+                return false;
+            else if( v1 < v2 )
+                atLeastOneLess = true;
+        }
+        return atLeastOneLess;
+    }
+};
+
+static double now()
+{
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/// build pairs of random vectors with @p nPeers entries out of
+/// @p nKeys possible peers
+template <class Vector_t>
+void build( std::vector<Vector_t>& vecs, int nVecs, int nPeers, int nKeys )
+{
+    srand(1);
+    vecs.resize(nVecs);
+    for( auto& v : vecs )
+        for( int i=0; i < nPeers; i++ )
+            v[ rand() % nKeys ] = rand() % 4;
+}
+
+template <class Vector_t>
+double bench( int nPeers, int nIter, int& count )
+{
+    const int nVecs = 1024;
+    std::vector<Vector_t> vecs;
+    build( vecs, nVecs, nPeers, 2*nPeers );
+
+    count = 0;
+    double start = now();
+    for( int i=0; i < nIter; i++ )
+        for( int j=0; j < nVecs; j++ )
+            count += vecs[j] < vecs[(j+1) % nVecs];
+    double elapsed = now() - start;
+
+    return 1e9 * elapsed / ( double(nIter) * nVecs );
+}
+
+int main( int argc, char** argv )
+{
+    int nIter = 1000;
+    if( argc > 1 )
+        nIter = atoi(argv[1]);
+
+    std::cout << "peers   map (ns/cmp)   flat (ns/cmp)\n";
+    for( int nPeers : { 2, 4, 8, 16, 64 } )
+    {
+        int countMap  = 0;
+        int countFlat = 0;
+        double tMap  = bench<MapVersionVector>( nPeers, nIter, countMap );
+        double tFlat = bench<VersionVector>( nPeers, nIter, countFlat );
+
+        std::cout << nPeers << "\t" << tMap << "\t\t" << tFlat << "\n";
+
+        // both implementations must agree
+        if( countMap != countFlat )
+        {
+            std::cerr << "mismatch: map found " << countMap
+                      << " less than, flat found " << countFlat << "\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}